@@ -26,7 +26,8 @@ WHERE
 
 -- BEGIN QUERY Q_FETCH_COMMANDS --
 SELECT
-	cmd.command_id, cmd.command_name, cmd.command_line, th.trap_use_sender_ip
+	cmd.command_id, cmd.command_name, cmd.command_line, th.trap_use_sender_ip, th.trap_persistent_pool, th.trap_timeout, th.trap_max_concurrency,
+	th.trap_delivery, th.trap_varbinds, th.trap_contract
 	FROM command cmd 
 	JOIN trap_handler th ON cmd.command_id = th.trap_command_id 
 	WHERE
@@ -8,7 +8,8 @@ ALTER TABLE service ADD trap_command_id INT(11) NULL;
 ALTER TABLE service ADD trap_command_arg TEXT;
 ALTER TABLE service ADD trap_check_enabled TINYINT(4) NULL;
 
--- trap_handler
+-- trap_handler (trap_oid may use * for any one arc, and end with .* for a
+-- whole subtree: the most specific match wins)
 CREATE TABLE IF NOT EXISTS trap_handler (
 	trap_command_id INT(11) NULL,
 	trap_oid varchar(512) NULL,
@@ -16,6 +17,22 @@ CREATE TABLE IF NOT EXISTS trap_handler (
 	PRIMARY KEY (trap_command_id)
 ) ENGINE=MyISAM;
 
+-- trap_handler, columns added since
+-- > 0: that many handlers per worker stay alive, fed one trap per line
+ALTER TABLE trap_handler ADD trap_persistent_pool INT(11) NOT NULL DEFAULT 0;
+-- overrides :plugin_timeout, in seconds
+ALTER TABLE trap_handler ADD trap_timeout INT(11) NULL;
+-- > 0: at most that many traps at once per worker, the others queue
+ALTER TABLE trap_handler ADD trap_max_concurrency INT(11) NOT NULL DEFAULT 0;
+-- the varbinds as OID=value lines on stdin (a pipe, or a sealed memfd)
+-- instead of on the command line
+ALTER TABLE trap_handler ADD trap_delivery ENUM('argv', 'stdin', 'memfd') NOT NULL DEFAULT 'argv';
+-- the OIDs of the varbinds delivered on stdin, if not all of them
+ALTER TABLE trap_handler ADD trap_varbinds TEXT NULL;
+-- 'v2': a collector's plugin runs once, with the hosts and services
+-- of its command on stdin, and every result it prints is final
+ALTER TABLE trap_handler ADD trap_contract ENUM('v1', 'v2') NOT NULL DEFAULT 'v1';
+
 -- command
 INSERT INTO command (command_name, command_line, command_type)
 VALUES
@@ -52,6 +52,20 @@
 #        associati a quel check (e dunque a quella trap) e richiama il check stesso
 #        passandogli il nome dell'host/servizio individuato allo step precedente.
 #
+#    Con trap_contract = 'v2' (tabella trap_handler) i due step si riducono ad
+#    uno: il plugin viene eseguito una sola volta e riceve sullo standard
+#    input l'elenco degli host/servizi associati al check, uno per riga nel
+#    formato
+#
+#        ip_host|nome_host|nome_servizio
+#
+#    (preceduto da una riga vuota se anche le varbind arrivano sullo standard
+#    input), scelti come per la v1: per indirizzo dell'host, per nome o per
+#    indirizzo del mittente.  Gli host/servizi con '|' o un a capo in un
+#    campo vengono omessi.  Il plugin deve stampare direttamente un record
+#    di output completo per ciascun host/servizio interessato.  I record privi di stato vengono
+#    scartati.
+#
 
 
 function usage()
@@ -81,6 +81,7 @@ install -o root -g root -m 0755 -d $PREFIX_DIR/etc/nagiostrapd
 install -o root -g root -m 0644 config/nagiostrapd.ini $PREFIX_DIR/etc/nagiostrapd
 install -o root -g root -m 0644 config/nagiostrapd.limits $PREFIX_DIR/etc/nagiostrapd
 install -o root -g root -m 0644 config/nagiostrapd.sql $PREFIX_DIR/etc/nagiostrapd
+install -o root -g root -m 0644 config/nagiostrapd.rules $PREFIX_DIR/etc/nagiostrapd
 
 ##
 ## avoid to compile while being root
@@ -218,6 +219,14 @@ install -o root -g root -m 0755 -d $PREFIX_DIR/usr/share/mibs/netsnmp
 
 install -o root -g root -m 0644 mibs/* $PREFIX_DIR/usr/share/mibs/netsnmp
 
+##
+## compile them into nagiostrapd's OID name table
+##
+
+install -o root -g root -m 0755 -d $PREFIX_DIR/usr/share/nagiostrapd
+bash script/generate-oid-table mibs NAGIOS-ROOT-MIB.diff > $PREFIX_DIR/usr/share/nagiostrapd/oids.tab
+chmod 0644 $PREFIX_DIR/usr/share/nagiostrapd/oids.tab
+
 
 ###############################################################################
 ##
@@ -0,0 +1,245 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     arena.c --- bump allocator for per-trap memory
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * Everything belonging to a trap (pdu, varbinds, strings, ...) is carved
+ * out of a single arena and released at once with arena_free().  Chunks
+ * are recycled through a free-list, so a busy daemon in steady state
+ * parses traps without calling malloc() at all.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* usable bytes in a standard chunk */
+#define ARENA_CHUNK_SIZE 8192
+
+/* standard chunks kept for reuse */
+#define ARENA_MAX_FREE_CHUNKS 256
+
+/* alignment of every allocation */
+#define ARENA_ALIGN sizeof(void *)
+#define ALIGN(N) (((N) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+
+struct arena_chunk_t {
+	struct arena_chunk_t *next;
+	size_t size;
+	char data[];
+};
+
+
+struct arena_t {
+	struct arena_chunk_t *chunk;
+	char *ptr;
+	size_t left;
+
+	/* last allocation, which can grow in place */
+	char *last;
+};
+
+
+/* free-list of standard chunks and mutex thereof */
+static struct arena_chunk_t *free_chunks = NULL;
+static int free_chunks_count = 0;
+static pthread_mutex_t free_chunks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static struct arena_chunk_t *get_chunk(size_t size)
+{
+	struct arena_chunk_t *chunk = NULL;
+
+	if (size <= ARENA_CHUNK_SIZE) {
+		pthread_mutex_lock(&free_chunks_mutex);
+		if ((chunk = free_chunks) != NULL) {
+			free_chunks = chunk->next;
+			free_chunks_count--;
+		}
+		pthread_mutex_unlock(&free_chunks_mutex);
+
+		size = ARENA_CHUNK_SIZE;
+	}
+
+	if (chunk == NULL) {
+		chunk = xmalloc(sizeof *chunk + size);
+		chunk->size = size;
+	}
+
+	chunk->next = NULL;
+
+	return chunk;
+}
+
+
+static void put_chunk(struct arena_chunk_t *chunk)
+{
+	if (chunk->size == ARENA_CHUNK_SIZE) {
+		pthread_mutex_lock(&free_chunks_mutex);
+		if (free_chunks_count < ARENA_MAX_FREE_CHUNKS) {
+			chunk->next = free_chunks;
+			free_chunks = chunk;
+			free_chunks_count++;
+			chunk = NULL;
+		}
+		pthread_mutex_unlock(&free_chunks_mutex);
+	}
+
+	free(chunk);
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * the arena lives at the start of its own first chunk
+ */
+
+struct arena_t *arena_new(void)
+{
+	struct arena_chunk_t *chunk;
+	struct arena_t *arena;
+
+	chunk = get_chunk(ARENA_CHUNK_SIZE);
+
+	arena = (struct arena_t *) chunk->data;
+	arena->chunk = chunk;
+	arena->ptr = chunk->data + ALIGN(sizeof *arena);
+	arena->left = chunk->size - ALIGN(sizeof *arena);
+	arena->last = NULL;
+
+	return arena;
+}
+
+
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	struct arena_chunk_t *chunk;
+	char *p;
+
+	size = ALIGN(size ? size : 1);
+
+	if (size > arena->left) {
+		chunk = get_chunk(size);
+
+		if (chunk->size - size < arena->left) {
+			/* a big block: keep filling the current chunk */
+			chunk->next = arena->chunk->next;
+			arena->chunk->next = chunk;
+			arena->last = NULL;
+			return chunk->data;
+		}
+
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+		arena->ptr = chunk->data;
+		arena->left = chunk->size;
+	}
+
+	p = arena->ptr;
+	arena->ptr += size;
+	arena->left -= size;
+	arena->last = p;
+
+	return p;
+}
+
+
+/*
+ * resize a block (of OLDSIZE bytes) allocated from ARENA; the last block
+ * allocated grows in place whenever there is room
+ */
+
+void *arena_realloc(struct arena_t *arena, void *ptr, size_t oldsize, size_t newsize)
+{
+	char *p;
+	size_t used;
+
+	if (ptr == NULL)
+		return arena_alloc(arena, newsize);
+
+	if (ptr == arena->last) {
+		used = arena->ptr - arena->last;
+		if (ALIGN(newsize) <= used + arena->left) {
+			arena->left = used + arena->left - ALIGN(newsize);
+			arena->ptr = arena->last + ALIGN(newsize);
+			return ptr;
+		}
+	}
+
+	p = arena_alloc(arena, newsize);
+	memcpy(p, ptr, oldsize < newsize ? oldsize : newsize);
+
+	return p;
+}
+
+
+char *arena_strndup(struct arena_t *arena, const char *s, size_t len)
+{
+	char *p;
+
+	p = arena_alloc(arena, len + 1);
+	memcpy(p, s, len);
+	p[len] = '\0';
+
+	return p;
+}
+
+
+char *arena_strdup(struct arena_t *arena, const char *s)
+{
+	if (s == NULL)
+		s = "";
+
+	return arena_strndup(arena, s, strlen(s));
+}
+
+
+void arena_free(struct arena_t *arena)
+{
+	struct arena_chunk_t *chunk, *next;
+
+	if (arena == NULL)
+		return;
+
+	/* the arena itself is in the last chunk of the list */
+	for (chunk = arena->chunk; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		put_chunk(chunk);
+	}
+}
@@ -0,0 +1,318 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     bulkhead.c --- per-command concurrency limits
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A command whose trap_max_concurrency is N > 0 runs for at most N traps
+ * at once in a worker, so that a slow handler cannot take every thread of
+ * the pool.  Traps beyond that wait in the command's own queue; as each of
+ * the N finishes, the next queued trap is handed to the pool as a task of
+ * its own, so that it queues up behind the traps of other commands, not
+ * ahead of them.  Once the queue holds :bulkhead_queue_length traps,
+ * further ones are dropped (and logged as not executed).
+ *
+ * Whether a trap has a place is decided with bulkhead_reserve() before
+ * the client is answered, so that a dropped trap is answered DROPPED, not
+ * ACCEPTED; bulkhead_submit() then runs it, or queues it, in that place.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "nagiostrapd.h"
+#include "threadpool.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+struct bulkhead_t {
+	int cmd_id;
+	int limit;
+
+	/* traps being run, and waiting (or with a place reserved in the queue) */
+	int running;
+	int queued;
+	struct bulkhead_ticket_t *head, *tail;
+
+	/* the queue overflowed since it was last empty */
+	int overflowing;
+};
+
+
+/* a trap's place, allocated along with its pdu */
+struct bulkhead_ticket_t {
+	/* NULL if its command has no limit */
+	struct bulkhead_t *bulkhead;
+
+	/* a place in the queue, rather than a slot to run in */
+	int is_queued;
+
+	struct pdu_t *pdu;
+	bulkhead_handler_t handler;
+	struct bulkhead_ticket_t *next;
+};
+
+
+/* bulkheads by command id, created as traps come */
+static GHashTable *bulkheads = NULL;
+static pthread_mutex_t bulkheads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int max_queued = 0;
+
+/* the worker's pool (NULL if it has none: queued traps run inline) */
+static struct threadpool *pool = NULL;
+
+/* for diagnostics */
+static unsigned int count_queued = 0;
+static unsigned long count_overflows = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * the command TRAP would run (-1 if it is handled in-process or not at all)
+ */
+
+static int lookup_cmd_id(struct trap_t *trap)
+{
+	const uint32_t *arcs;
+	size_t narcs;
+	oid_t oid;
+
+	arcs = trap_get_oid_arcs(trap, &narcs);
+	oid = trap_get_oid_id(trap);
+
+	if (notify_may_handle(oid, arcs, narcs) || rule_may_handle(oid, arcs, narcs))
+		return -1;
+
+	return db_lookup_cmd_id_by_oid(oid, arcs, narcs);
+}
+
+
+/*
+ * with BULKHEADS_MUTEX held
+ */
+
+static struct bulkhead_t *get_bulkhead(int cmd_id, int limit)
+{
+	struct bulkhead_t *bulkhead;
+
+	if ((bulkhead = g_hash_table_lookup(bulkheads, &cmd_id)) != NULL)
+		return bulkhead;
+
+	bulkhead = xcalloc(1, sizeof *bulkhead);
+	bulkhead->cmd_id = cmd_id;
+	bulkhead->limit = limit;
+	g_hash_table_insert(bulkheads, &bulkhead->cmd_id, bulkhead);
+
+	DEBUG("new bulkhead for command %d (limit: %d)", cmd_id, limit);
+
+	return bulkhead;
+}
+
+
+static void run_ticket(void *arg);
+
+
+/*
+ * a trap of BULKHEAD is over: its slot goes to the next one queued, as a
+ * task of its own
+ */
+
+static void release_slot(struct bulkhead_t *bulkhead)
+{
+	struct bulkhead_ticket_t *ticket;
+
+	pthread_mutex_lock(&bulkheads_mutex);
+
+	if ((ticket = bulkhead->head) != NULL) {
+		if ((bulkhead->head = ticket->next) == NULL)
+			bulkhead->tail = NULL;
+		bulkhead->queued--;
+		count_queued--;
+	} else {
+		bulkhead->running--;
+		bulkhead->overflowing = 0;
+	}
+
+	pthread_mutex_unlock(&bulkheads_mutex);
+
+	if (ticket == NULL)
+		return;
+
+	/* the pool's task queue is full, or there is no pool: run it here */
+	if (pool == NULL || threadpool_add_task(pool, run_ticket, ticket, 0) != 0)
+		run_ticket(ticket);
+}
+
+
+/*
+ * run the trap of TICKET, which holds a slot (TICKET goes with its pdu)
+ */
+
+static void run_ticket(void *arg)
+{
+	struct bulkhead_ticket_t *ticket = (struct bulkhead_ticket_t *) arg;
+	struct bulkhead_t *bulkhead = ticket->bulkhead;
+
+	ticket->handler(ticket->pdu);
+
+	if (bulkhead != NULL)
+		release_slot(bulkhead);
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * a place for PDU, a trap, within the limit of its command: a slot to run
+ * in, or in the command's queue; NULL if the queue is full (PDU is left
+ * as it is)
+ */
+
+struct bulkhead_ticket_t *bulkhead_reserve(struct pdu_t *pdu)
+{
+	struct bulkhead_t *bulkhead;
+	struct bulkhead_ticket_t *ticket;
+	int cmd_id, limit;
+
+	cmd_id = lookup_cmd_id(trap_is_trap(pdu));
+	if (cmd_id == -1 || (limit = db_lookup_max_concurrency_by_cmd_id(cmd_id)) <= 0) {
+		ticket = trap_pdu_alloc(pdu, sizeof *ticket);
+		memset(ticket, 0, sizeof *ticket);
+		ticket->pdu = pdu;
+		return ticket;
+	}
+
+	pthread_mutex_lock(&bulkheads_mutex);
+
+	bulkhead = get_bulkhead(cmd_id, limit);
+
+	if (bulkhead->running >= bulkhead->limit && bulkhead->queued >= max_queued) {
+		count_overflows++;
+		if (!bulkhead->overflowing)
+			log_warning(0, "%d traps queued for %s, dropping further ones", bulkhead->queued, db_lookup_filename_by_cmd_id(cmd_id));
+		bulkhead->overflowing = 1;
+		pthread_mutex_unlock(&bulkheads_mutex);
+		return NULL;
+	}
+
+	ticket = trap_pdu_alloc(pdu, sizeof *ticket);
+	memset(ticket, 0, sizeof *ticket);
+	ticket->bulkhead = bulkhead;
+	ticket->pdu = pdu;
+
+	if (bulkhead->running < bulkhead->limit) {
+		bulkhead->running++;
+	} else {
+		ticket->is_queued = 1;
+		bulkhead->queued++;
+		count_queued++;
+	}
+
+	pthread_mutex_unlock(&bulkheads_mutex);
+
+	return ticket;
+}
+
+
+/*
+ * have HANDLER run (and free) the pdu of TICKET, from bulkhead_reserve():
+ * now, or later from the command's queue
+ */
+
+void bulkhead_submit(struct bulkhead_ticket_t *ticket, bulkhead_handler_t handler)
+{
+	struct bulkhead_t *bulkhead = ticket->bulkhead;
+
+	ticket->handler = handler;
+
+	if (ticket->is_queued) {
+		pthread_mutex_lock(&bulkheads_mutex);
+
+		/* a slot freed up meanwhile, and nothing waits before it */
+		if (bulkhead->running < bulkhead->limit && bulkhead->head == NULL) {
+			ticket->is_queued = 0;
+			bulkhead->queued--;
+			count_queued--;
+			bulkhead->running++;
+		} else {
+			if (bulkhead->tail != NULL)
+				bulkhead->tail->next = ticket;
+			else
+				bulkhead->head = ticket;
+			bulkhead->tail = ticket;
+		}
+
+		pthread_mutex_unlock(&bulkheads_mutex);
+
+		if (ticket->is_queued)
+			return;
+	}
+
+	run_ticket(ticket);
+}
+
+
+
+/*
+ *     Callbacks for diagnostics
+ *
+ ******************************************************************************/
+
+
+unsigned int bulkhead_get_queued(void)
+{
+	return count_queued;
+}
+
+
+unsigned long bulkhead_get_overflows(void)
+{
+	return count_overflows;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void bulkhead_init(struct threadpool *worker_pool)
+{
+	max_queued = atoi(config_get_option_value(":bulkhead_queue_length"));
+	pool = worker_pool;
+
+	bulkheads = g_hash_table_new(g_int_hash, g_int_equal);
+}
@@ -200,7 +200,7 @@ void channel_init(int is_daemon)
 	DEBUG("channel path is %s", channel_path);
 
 	if (is_daemon) {
-		if ((channel_handle = fopen(channel_path, "a")) == NULL)
+		if ((channel_handle = fopen(channel_path, "ae")) == NULL)
 			log_critical(errno, "cannot open channel: %s", channel_path);
 
 		channel_is_daemon = 1;
@@ -40,6 +40,8 @@ struct option_element {
 };
 
 static struct option_element options[] = {
+	{ ":bulkhead_queue_length", "1000", 0 },
+	{ ":connection_timeout", "60", 0 },
 	{ ":daemonize", "true", 0 },
 	{ ":db_host", NULL, 0 },
 	{ ":db_user", NULL, 0 },
@@ -56,24 +58,41 @@ static struct option_element options[] = {
 	{ ":local_socket_prefix", "/tmp/nagiostrapd", 0 },
 	{ ":log_verbosity", "warning", 0 },
 	{ ":monitor_port_number", "6111", 0 },
+	{ ":nagios_notify_native", "false", 0 },
 	{ ":nagios_pipe", "/usr/local/nagios/var/rw/nagios.cmd", 0 },
+	{ ":oid_name_table", NULL, 0 },
+	{ ":oid_name_translation", "false", 0 },
 	{ ":pending_connections", "100", 0 },
+	{ ":persistent_handler_idle_timeout", "300", 0 },
+	{ ":persistent_handler_timeout", "10", 0 },
+	{ ":persistent_handlers_max", "64", 0 },
 	{ ":php_cli", "/usr/bin/php", 0 },
 	{ ":pid_file", "/var/run/nagiostrapd.pid", 0 },
-	{ ":plugins_max_executions", "10000", 0 },
+	{ ":plugin_max_output", "1048576", 0 },
+	{ ":plugin_timeout", "60", 0 },
+	{ ":plugin_zygote", "true", 0 },
+	{ ":plugins_max_children", "0", 0 },
 	{ ":port_number", "6110", 0 },
 	{ ":query_source_file", "/etc/nagiostrapd/nagiostrapd.sql", 0 },
 	{ ":send_enabled", "true", 0 },
 	{ ":nagios_conf_file", "/usr/local/nagios/nagios.conf.php", 0 },
+	{ ":snmp_community", NULL, 0 },
+	{ ":snmp_listener", "false", 0 },
+	{ ":snmp_port_number", "162", 0 },
 	{ ":socket_reuse", "true", 0 },
+	{ ":socket_reuse_port", "true", 0 },
 	{ ":socket_set_nonblocking", "false", 0 },
 	{ ":temp_dir", "/tmp", 0 },
 	{ ":threadpool_size", "5", 0 },
+	{ ":trap_cpu_budget", "60", 0 },
 	{ ":trap_log", "/var/log/nagiostrapd.traps", 0 },
 	{ ":trap_log_delimiter", ",", 0 },
 	{ ":trap_rate_threshold", ".005", 0 },
+	{ ":trap_rules_file", NULL, 0 },
 	{ ":trap_serialize_mode", "new", 0 },
+	{ ":trap_time_budget", "300", 0 },
 	{ ":trap_tokenizer", "@TRAPTKN@", 0 },
+	{ ":unhandled_trap_log_sample", "1000", 0 },
 	{ ":workers", "5", 0 },
 	{ NULL, NULL, 0 }
 };
@@ -198,7 +217,7 @@ static int parse_nagios_conf(const char *filename, const char *php_cli, const ch
 	char buffer[TMPBUFLEN], auxfilename[TMPBUFLEN_SMALL], command[TMPBUFLEN];
 	char db_host[TMPBUFLEN], db_user[TMPBUFLEN], db_password[TMPBUFLEN], db_name[TMPBUFLEN];
 
-	if ((conffile = fopen(filename, "r")) != NULL) {
+	if ((conffile = fopen(filename, "re")) != NULL) {
 		strncpy(auxfilename, temp_dir, strlen(temp_dir));
 		strncpy(auxfilename+strlen(temp_dir), template, strlen(template));
 		auxfilename[strlen(temp_dir)+strlen(template)] = '\0';
@@ -0,0 +1,800 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     connection.c --- per-connection state for the worker event loop
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * Two protocols are spoken on the primary socket:
+ *
+ *   v1 (legacy)  the first line is the whole pdu; we answer and hang up
+ *
+ *   v2           the client opens with "PROTO 2" and we answer "PROTO 2 OK";
+ *                the connection then stays open and carries any number of
+ *                frames, each one answered (in order) by its own response
+ *                line.  A frame is either a line terminated by '\n', or
+ *                a "#<len>" line followed by exactly <len> bytes, which
+ *                may contain newlines
+ *
+ * The event loop hands received bytes to the connection, which cuts them
+ * into frames and feeds them to the trap parser as they arrive: only the
+ * parser state is kept between reads, never the raw frame.  Parsed pdus are
+ * queued; at most one pool thread at a time drains the queue of a
+ * connection, so responses leave in the same order as the frames arrived.
+ *
+ * A client must complete a line (or a payload) within :connection_timeout
+ * seconds of starting it, or it is hung up on: the event loop keeps the
+ * connections with a partial frame in order of their deadlines, and drops
+ * those past it, unless a pool thread is still working on their frames.  A
+ * new client owes us its first line; a v2 client between frames may stay
+ * idle as long as it likes.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* size of a single recv() */
+#define CONN_BUF_SIZE 4096
+
+/* a frame (or an unterminated line) longer than this is a protocol error */
+#define CONN_MAX_FRAME_SIZE (1024 * 1024)
+
+/* stop reading from a v2 client when this many frames are waiting */
+#define CONN_MAX_QUEUED_FRAMES 1024
+
+/* enough to recognize the hello and "#<len>" lines */
+#define CONN_LINE_HEAD_SIZE 16
+
+#define PROTO_V2_HELLO "PROTO 2"
+#define PROTO_V2_HELLO_RESPONSE "PROTO 2 OK\n"
+
+
+typedef enum { PROTO_UNKNOWN, PROTO_V1, PROTO_V2 } proto_version_t;
+
+typedef enum { F_LINE, F_PAYLOAD } frame_status_t;
+
+
+/* queue node, allocated along with its pdu */
+struct frame_t {
+	struct pdu_t *pdu;
+	struct frame_t *next;
+};
+
+
+struct connection_t {
+	int fd;
+	int is_private;
+
+	/* epoll instance we are registered with */
+	int epfd;
+
+	proto_version_t protocol;
+	frame_status_t frame_status;
+
+	/* bytes of the current payload still to come */
+	size_t payload_len;
+
+	/* the frame being received */
+	struct trap_parser_t *parser;
+	size_t framelen;
+
+	/* first bytes of the current line */
+	char line_head[CONN_LINE_HEAD_SIZE];
+
+	/* what is left of the hello response, sent as the socket allows */
+	const char *reply;
+	size_t reply_len;
+
+	/* EPOLLOUT is being watched for REPLY */
+	int want_write;
+
+	/* everything below is shared with the pool thread and protected by MUTEX */
+	pthread_mutex_t mutex;
+
+	struct frame_t *head;
+	struct frame_t *tail;
+	int queued;
+
+	/* a pool thread is draining the queue */
+	int busy;
+
+	/* reading stopped because the queue is full */
+	int paused;
+
+	/* no more frames will be queued */
+	int eof;
+
+	/* when the partial frame must be complete (ms), and our place in the list */
+	long deadline;
+	int watched;
+	struct connection_t *prev_watched;
+	struct connection_t *next_watched;
+};
+
+
+/* seconds to complete a line, 0 for no limit */
+static int connection_timeout = 0;
+
+/* connections the event loop reads from, earliest deadline first */
+static struct connection_t *watched_head = NULL;
+static struct connection_t *watched_tail = NULL;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static long monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+static void unwatch(struct connection_t *conn)
+{
+	if (!conn->watched)
+		return;
+
+	if (conn->prev_watched != NULL)
+		conn->prev_watched->next_watched = conn->next_watched;
+	else
+		watched_head = conn->next_watched;
+
+	if (conn->next_watched != NULL)
+		conn->next_watched->prev_watched = conn->prev_watched;
+	else
+		watched_tail = conn->prev_watched;
+
+	conn->watched = 0;
+}
+
+
+/*
+ * give CONN another :connection_timeout seconds: with the same timeout
+ * for all, the list stays sorted by appending
+ */
+
+static void rearm_deadline(struct connection_t *conn)
+{
+	if (connection_timeout <= 0)
+		return;
+
+	unwatch(conn);
+
+	conn->deadline = monotonic_ms() + connection_timeout * 1000L;
+	conn->watched = 1;
+	conn->next_watched = NULL;
+	conn->prev_watched = watched_tail;
+
+	if (watched_tail != NULL)
+		watched_tail->next_watched = conn;
+	else
+		watched_head = conn;
+	watched_tail = conn;
+}
+
+
+/*
+ * is CONN in the middle of a frame (or yet to send its first line)?
+ */
+
+static int is_partial(struct connection_t *conn)
+{
+	return conn->protocol == PROTO_UNKNOWN || conn->framelen > 0 || conn->frame_status == F_PAYLOAD;
+}
+
+
+/*
+ * the deadline runs from the read that started the partial frame, and
+ * only while there is one
+ */
+
+static void update_deadline(struct connection_t *conn)
+{
+	if (!is_partial(conn))
+		unwatch(conn);
+	else if (!conn->watched)
+		rearm_deadline(conn);
+}
+
+
+static void free_connection(struct connection_t *conn)
+{
+	struct frame_t *frame, *next;
+
+	DEBUG("closing fd %d", conn->fd);
+
+	close(conn->fd);
+
+	for (frame = conn->head; frame != NULL; frame = next) {
+		next = frame->next;
+		trap_free_pdu(frame->pdu);
+	}
+
+	pthread_mutex_destroy(&conn->mutex);
+	trap_parser_free(conn->parser);
+	free(conn);
+}
+
+
+/*
+ * append PDU to the (unlocked) pending list
+ */
+
+static void append_frame(struct frame_t **head, struct frame_t **tail, struct pdu_t *pdu)
+{
+	struct frame_t *frame;
+
+	frame = trap_pdu_alloc(pdu, sizeof *frame);
+	frame->pdu = pdu;
+	frame->next = NULL;
+
+	if (*tail == NULL)
+		*head = frame;
+	else
+		(*tail)->next = frame;
+	*tail = frame;
+}
+
+
+static int is_length_prefix(const char *line, size_t len, size_t *payload_len)
+{
+	size_t i, n = 0;
+
+	if (len < 2 || line[0] != '#')
+		return 0;
+
+	for (i = 1; i < len; i++) {
+		if (line[i] < '0' || line[i] > '9')
+			return 0;
+		n = n * 10 + (line[i] - '0');
+		if (n > CONN_MAX_FRAME_SIZE)
+			return 0;
+	}
+
+	*payload_len = n;
+	return 1;
+}
+
+
+/*
+ * hand LEN bytes of the current frame to the parser; if the line ends
+ * there (ENDS), the terminator goes along as a delimiter, so that the
+ * parser knows the last word is complete
+ */
+
+static void feed_frame(struct connection_t *conn, const char *data, size_t len, int ends)
+{
+	size_t n;
+
+	if (len == 0)
+		return;
+
+	if (conn->parser == NULL)
+		conn->parser = trap_parser_new(conn->is_private);
+
+	if (conn->frame_status == F_LINE && conn->framelen < CONN_LINE_HEAD_SIZE) {
+		n = CONN_LINE_HEAD_SIZE - conn->framelen;
+		memcpy(conn->line_head + conn->framelen, data, len < n ? len : n);
+	}
+
+	trap_parser_feed(conn->parser, data, ends && data[len] != '\0' ? len + 1 : len);
+	conn->framelen += len;
+}
+
+
+static void end_frame(struct connection_t *conn, struct frame_t **head, struct frame_t **tail, int *count)
+{
+	if (conn->parser == NULL)
+		conn->parser = trap_parser_new(conn->is_private);
+
+	append_frame(head, tail, trap_parser_finish(conn->parser));
+	(*count)++;
+
+	conn->parser = NULL;
+	conn->framelen = 0;
+}
+
+
+static void discard_frame(struct connection_t *conn)
+{
+	trap_parser_free(conn->parser);
+	conn->parser = NULL;
+	conn->framelen = 0;
+}
+
+
+/*
+ * a line is over; returns 0 on protocol error
+ */
+
+static int end_line(struct connection_t *conn, struct frame_t **head, struct frame_t **tail, int *count)
+{
+	size_t len = conn->framelen;
+
+	unwatch(conn);
+
+	if (len > 0 && len <= CONN_LINE_HEAD_SIZE && conn->line_head[len-1] == '\r')
+		len--;
+
+	switch (conn->protocol) {
+		case PROTO_UNKNOWN:
+			if (len == strlen(PROTO_V2_HELLO) && memcmp(conn->line_head, PROTO_V2_HELLO, len) == 0) {
+				DEBUG("client speaks protocol v2");
+				conn->protocol = PROTO_V2;
+				discard_frame(conn);
+				conn->reply = PROTO_V2_HELLO_RESPONSE;
+				conn->reply_len = strlen(PROTO_V2_HELLO_RESPONSE);
+				return 1;
+			}
+			conn->protocol = PROTO_V1;
+			/* fall through */
+		case PROTO_V1:
+			/* accept only first line */
+			end_frame(conn, head, tail, count);
+			conn->eof = 1;
+			break;
+		case PROTO_V2:
+			if (len == 0) {
+				/* keep-alive or separator: ignore */
+				discard_frame(conn);
+			} else if (len <= CONN_LINE_HEAD_SIZE && is_length_prefix(conn->line_head, len, &conn->payload_len)) {
+				discard_frame(conn);
+				if (conn->payload_len == 0)
+					end_frame(conn, head, tail, count);
+				else
+					conn->frame_status = F_PAYLOAD;
+			} else {
+				end_frame(conn, head, tail, count);
+			}
+			break;
+	}
+
+	return 1;
+}
+
+
+/*
+ * cut the LEN bytes just received into frames; returns 0 on protocol error
+ */
+
+static int consume(struct connection_t *conn, const char *data, size_t len, struct frame_t **head, struct frame_t **tail, int *count)
+{
+	size_t i, n;
+
+	while (len > 0 && !conn->eof) {
+
+		if (conn->frame_status == F_PAYLOAD) {
+			n = len < conn->payload_len ? len : conn->payload_len;
+
+			feed_frame(conn, data, n, 0);
+			data += n;
+			len -= n;
+
+			if ((conn->payload_len -= n) == 0) {
+				unwatch(conn);
+				end_frame(conn, head, tail, count);
+				conn->frame_status = F_LINE;
+			}
+			continue;
+		}
+
+		/* look for the end of the line */
+		if (conn->protocol == PROTO_V2)
+			i = scan_any3(data, len, '\n', '\n', '\n');
+		else
+			i = scan_any3(data, len, '\n', '\r', '\0');
+
+		feed_frame(conn, data, i, i < len);
+
+		if (conn->framelen > CONN_MAX_FRAME_SIZE) {
+			log_error(0, "frame too long on fd %d, dropping connection", conn->fd);
+			return 0;
+		}
+
+		if (i == len)
+			break;
+
+		data += i + 1;
+		len -= i + 1;
+
+		if (!end_line(conn, head, tail, count))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * send what the socket takes of the hello response, never blocking: the
+ * rest goes when it becomes writable; returns 0 on error
+ */
+
+static int flush_reply(struct connection_t *conn)
+{
+	struct epoll_event ev;
+	ssize_t retcode;
+
+	while (conn->reply_len > 0) {
+		retcode = send(conn->fd, conn->reply, conn->reply_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (retcode < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			DEBUG("send() error on fd %d: %s", conn->fd, strerror(errno));
+			return 0;
+		}
+
+		conn->reply += retcode;
+		conn->reply_len -= retcode;
+	}
+
+	/* the peer doesn't read: wait for room rather than hold up the loop */
+	if ((conn->reply_len > 0) != conn->want_write) {
+		conn->want_write = conn->reply_len > 0;
+		DEBUG("%s writability of fd %d", conn->want_write ? "watching" : "no longer watching", conn->fd);
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (conn->want_write ? EPOLLOUT : 0);
+		ev.data.ptr = conn;
+		epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	}
+
+	return 1;
+}
+
+
+/*
+ * what is left of the current frame when the peer hangs up
+ */
+
+static void flush_at_eof(struct connection_t *conn, struct frame_t **head, struct frame_t **tail, int *count)
+{
+	if (conn->framelen == 0)
+		return;
+
+	if (conn->protocol == PROTO_V2) {
+		DEBUG("discarding incomplete frame (%d bytes)", conn->framelen);
+		discard_frame(conn);
+		return;
+	}
+
+	/* a v1 pdu needs no terminator */
+	end_frame(conn, head, tail, count);
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+struct connection_t *connection_new(int fd, int is_private, int epfd)
+{
+	struct connection_t *conn;
+
+	conn = xmalloc(sizeof *conn);
+
+	conn->fd = fd;
+	conn->is_private = is_private;
+	conn->epfd = epfd;
+	conn->protocol = PROTO_UNKNOWN;
+	conn->frame_status = F_LINE;
+	conn->payload_len = 0;
+	conn->parser = NULL;
+	conn->framelen = 0;
+	conn->reply = NULL;
+	conn->reply_len = 0;
+	conn->want_write = 0;
+
+	pthread_mutex_init(&conn->mutex, NULL);
+	conn->head = NULL;
+	conn->tail = NULL;
+	conn->queued = 0;
+	conn->busy = 0;
+	conn->paused = 0;
+	conn->eof = 0;
+
+	conn->watched = 0;
+	rearm_deadline(conn);
+
+	return conn;
+}
+
+
+/*
+ * read whatever is available on the (non-blocking) socket, never blocking,
+ * and queue the frames found
+ *
+ * The hello response of a v2 client is sent from here too, as the socket
+ * becomes writable.
+ *
+ * Returns CONNECTION_DISPATCH when the caller must schedule
+ * connection_process() on a pool thread, CONNECTION_DONE when the event
+ * loop must forget about CONN (it may already have been freed), and
+ * CONNECTION_WAIT otherwise.
+ */
+
+int connection_read(struct connection_t *conn)
+{
+	struct frame_t *head = NULL, *tail = NULL;
+	char buffer[CONN_BUF_SIZE];
+	ssize_t retcode;
+	int count = 0, hangup = 0, broken = 0, dispatch = 0, done = 0, paused, queued;
+
+	DEBUG("called on socket descriptor %d", conn->fd);
+
+	pthread_mutex_lock(&conn->mutex);
+	paused = conn->paused;
+	queued = conn->queued;
+	pthread_mutex_unlock(&conn->mutex);
+
+	while (!paused && !conn->eof) {
+		retcode = recv(conn->fd, buffer, sizeof buffer, 0);
+
+		if (retcode < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			log_error(errno, "recv() error detected, possibly lost pdu...");
+			broken = 1;
+			break;
+		}
+
+		if (retcode == 0) {
+			DEBUG("peer closed fd %d", conn->fd);
+			hangup = 1;
+			break;
+		}
+
+		if (!consume(conn, buffer, retcode, &head, &tail, &count)) {
+			broken = 1;
+			break;
+		}
+
+		/* don't let a pipelining client fill our memory */
+		if (queued + count >= CONN_MAX_QUEUED_FRAMES)
+			paused = 1;
+	}
+
+	if (hangup)
+		flush_at_eof(conn, &head, &tail, &count);
+
+	if (!broken && !flush_reply(conn))
+		broken = 1;
+
+	if (hangup || broken || conn->eof) {
+		/* the socket stays open until the pending responses are sent */
+		epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		unwatch(conn);
+	} else {
+		update_deadline(conn);
+	}
+
+	pthread_mutex_lock(&conn->mutex);
+
+	if (head != NULL) {
+		if (conn->tail == NULL)
+			conn->head = head;
+		else
+			conn->tail->next = head;
+		conn->tail = tail;
+		conn->queued += count;
+	}
+
+	if (paused && !conn->paused) {
+		DEBUG("too many frames queued on fd %d, pausing", conn->fd);
+		conn->paused = 1;
+	}
+
+	if (hangup || broken)
+		conn->eof = 1;
+
+	if (conn->eof && conn->reply_len > 0) {
+		DEBUG("fd %d is done, hello response dropped", conn->fd);
+		conn->reply_len = 0;
+	}
+
+	/* responses must not overtake the hello response */
+	if (conn->queued > 0 && !conn->busy && conn->reply_len == 0) {
+		conn->busy = 1;
+		dispatch = 1;
+	}
+
+	if (conn->eof) {
+		/* from now on the pool thread owns the connection, if any */
+		done = 1;
+		if (!conn->busy) {
+			pthread_mutex_unlock(&conn->mutex);
+			free_connection(conn);
+			return CONNECTION_DONE;
+		}
+	}
+
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (dispatch)
+		return done ? CONNECTION_DISPATCH_DONE : CONNECTION_DISPATCH;
+	else
+		return done ? CONNECTION_DONE : CONNECTION_WAIT;
+}
+
+
+/*
+ * drain the frame queue (called by exactly one pool thread at a time):
+ * every parsed pdu is handed to PROCESS, which answers and frees it
+ */
+
+void connection_process(struct connection_t *conn, connection_frame_handler_t process)
+{
+	struct frame_t *frames, *frame, *next;
+	int must_free = 0, resume = 0;
+
+	while (1) {
+		pthread_mutex_lock(&conn->mutex);
+
+		frames = conn->head;
+		conn->head = conn->tail = NULL;
+		conn->queued = 0;
+
+		if (frames == NULL) {
+			conn->busy = 0;
+			must_free = conn->eof;
+		} else if (conn->paused && !conn->eof) {
+			conn->paused = 0;
+			resume = 1;
+		}
+
+		pthread_mutex_unlock(&conn->mutex);
+
+		if (frames == NULL)
+			break;
+
+		if (resume) {
+			struct epoll_event ev;
+
+			/* re-arming reports data already waiting on the socket */
+			DEBUG("resuming reads on fd %d", conn->fd);
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+			ev.data.ptr = conn;
+			epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+			resume = 0;
+		}
+
+		for (frame = frames; frame != NULL; frame = next) {
+			next = frame->next;
+			/* FRAME goes away with its pdu */
+			process(conn, frame->pdu);
+		}
+	}
+
+	if (must_free)
+		free_connection(conn);
+}
+
+
+/*
+ * free a connection the event loop never got to watch
+ */
+
+void connection_destroy(struct connection_t *conn)
+{
+	unwatch(conn);
+	free_connection(conn);
+}
+
+
+/*
+ * milliseconds until the earliest deadline, -1 if there is none: what the
+ * event loop may wait for at most
+ */
+
+int connection_next_timeout(void)
+{
+	long ms;
+
+	if (watched_head == NULL)
+		return -1;
+
+	ms = watched_head->deadline - monotonic_ms();
+
+	return ms > 0 ? (int) ms : 0;
+}
+
+
+/*
+ * hang up on the connections past their deadline (from the event loop)
+ */
+
+void connection_expire(void)
+{
+	struct connection_t *conn;
+	long now;
+	int busy;
+
+	now = monotonic_ms();
+
+	while ((conn = watched_head) != NULL && conn->deadline <= now) {
+		pthread_mutex_lock(&conn->mutex);
+		if (!(busy = conn->busy))
+			conn->eof = 1;
+		pthread_mutex_unlock(&conn->mutex);
+
+		/* the client may well be waiting for us */
+		if (busy) {
+			rearm_deadline(conn);
+			continue;
+		}
+
+		log_warning(0, "frame on fd %d not complete after %d seconds, hanging up", conn->fd, connection_timeout);
+
+		epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		unwatch(conn);
+		free_connection(conn);
+	}
+}
+
+
+int connection_get_fd(struct connection_t *conn)
+{
+	return conn->fd;
+}
+
+
+int connection_is_private(struct connection_t *conn)
+{
+	return conn->is_private;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void connection_init(void)
+{
+	connection_timeout = atoi(config_get_option_value(":connection_timeout"));
+}
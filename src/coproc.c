@@ -0,0 +1,627 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     coproc.c --- persistent trap handlers
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A command whose trap_persistent_pool is N > 0 is not run once per trap:
+ * each worker keeps up to N copies of it alive, one pool per command line,
+ * and hands a trap to an idle one.  The protocol is line-based: the trap
+ * contents are written to the handler's standard input as one line, and
+ * the handler answers with the usual result lines on its standard output,
+ * followed by an empty line.
+ *
+ * A handler found dead when it's taken from the pool is restarted; one that
+ * doesn't answer within :persistent_handler_timeout seconds, or answers
+ * garbage, is killed (and will be restarted by the next trap).
+ *
+ * Command lines are expanded per host, so pools come and go: a handler
+ * idle for :persistent_handler_idle_timeout seconds is stopped, a pool left
+ * without handlers is dropped, and no more than :persistent_handlers_max
+ * handlers run per worker, the least recently used idle one making room
+ * for a new one.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+struct coproc_t {
+	pid_t pid;
+
+	/* its standard input (we write) and output (we read) */
+	int in, out;
+
+	/* when it went back to the pool (ms, monotonic) */
+	long idle_since;
+
+	struct coproc_t *next;
+};
+
+
+struct coproc_pool_t {
+	char *command;
+	int size;
+
+	/* handlers alive (idle or busy), the idle ones most recently used first */
+	int count;
+	struct coproc_t *idle;
+
+	/* threads holding it (under pools_mutex) */
+	int users;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	struct coproc_pool_t *next;
+};
+
+
+/* one pool per command line */
+static struct coproc_pool_t *pools = NULL;
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* handlers alive in all pools, and how many may be (under pools_mutex) */
+static int handlers_count = 0;
+static int handlers_max = 64;
+
+/* milliseconds a handler has to answer */
+static int timeout_ms = 10000;
+
+/* milliseconds an idle handler is kept (0: forever), and the last sweep */
+static long idle_timeout_ms = 300000;
+static long last_sweep = 0;
+
+/* how long to wait before looking for room again, at the cap */
+#define CAP_WAIT_MS 100
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static long monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+static struct coproc_pool_t *get_pool(const char *command, int size)
+{
+	struct coproc_pool_t *pool;
+
+	pthread_mutex_lock(&pools_mutex);
+
+	for (pool = pools; pool != NULL; pool = pool->next) {
+		if (!strcmp(pool->command, command))
+			break;
+	}
+
+	if (pool == NULL) {
+		pool = xcalloc(1, sizeof *pool);
+		pool->command = xstrdup(command);
+		pool->size = size;
+		pthread_mutex_init(&pool->mutex, NULL);
+		pthread_cond_init(&pool->cond, NULL);
+		pool->next = pools;
+		pools = pool;
+		DEBUG("new pool of %d persistent handler(s) for %s", size, command);
+	}
+
+	pool->users++;
+
+	pthread_mutex_unlock(&pools_mutex);
+
+	return pool;
+}
+
+
+static void put_pool(struct coproc_pool_t *pool)
+{
+	pthread_mutex_lock(&pools_mutex);
+	pool->users--;
+	pthread_mutex_unlock(&pools_mutex);
+}
+
+
+static struct coproc_t *start_coproc(const char *command, char **argv)
+{
+	struct coproc_t *coproc;
+	char **split_argv = NULL;
+	char *shell_argv[4];
+	int in, out;
+	pid_t pid;
+
+	if (argv == NULL)
+		argv = split_argv = spawn_split_args(command, 1);
+
+	if (argv == NULL || argv[0] == NULL) {
+		shell_argv[0] = "/bin/sh";
+		shell_argv[1] = "-c";
+		shell_argv[2] = (char *) command;
+		shell_argv[3] = NULL;
+		pid = spawn_coprocess(shell_argv, &in, &out);
+	} else {
+		pid = spawn_coprocess(argv, &in, &out);
+	}
+
+	free(split_argv);
+
+	if (pid == -1)
+		return NULL;
+
+	DEBUG("persistent handler %s started (pid %d)", command, (int) pid);
+
+	coproc = xmalloc(sizeof *coproc);
+	coproc->pid = pid;
+	coproc->in = in;
+	coproc->out = out;
+	coproc->next = NULL;
+
+	return coproc;
+}
+
+
+static void stop_coproc(struct coproc_t *coproc)
+{
+	close(coproc->in);
+	close(coproc->out);
+
+	kill(coproc->pid, SIGKILL);
+	spawn_wait(coproc->pid);
+
+	free(coproc);
+}
+
+
+static void stop_coprocs(struct coproc_t *list)
+{
+	struct coproc_t *next;
+
+	for (; list != NULL; list = next) {
+		next = list->next;
+		DEBUG("stopping persistent handler (pid %d)", (int) list->pid);
+		stop_coproc(list);
+	}
+}
+
+
+/*
+ * a handler is gone from POOL (whose mutex is held)
+ */
+
+static void forget_coproc(struct coproc_pool_t *pool)
+{
+	pool->count--;
+
+	pthread_mutex_lock(&pools_mutex);
+	handlers_count--;
+	pthread_mutex_unlock(&pools_mutex);
+}
+
+
+/*
+ * room for one more handler in POOL (whose mutex is held): under the cap,
+ * or by taking the least recently used idle handler of another pool, which
+ * goes into *VICTIM for the caller to stop; 0 if there is none
+ */
+
+static int make_room(struct coproc_pool_t *pool, struct coproc_t **victim)
+{
+	struct coproc_pool_t *p, *oldest_pool = NULL;
+	struct coproc_t *c, **link;
+	long oldest = 0;
+	int found = 0;
+
+	*victim = NULL;
+
+	pthread_mutex_lock(&pools_mutex);
+
+	if (handlers_max <= 0 || handlers_count < handlers_max) {
+		handlers_count++;
+		pthread_mutex_unlock(&pools_mutex);
+		return 1;
+	}
+
+	/* pools are only tried: we hold one already */
+	for (p = pools; p != NULL; p = p->next) {
+		if (p == pool || p->idle == NULL || pthread_mutex_trylock(&p->mutex) != 0)
+			continue;
+		for (c = p->idle; c != NULL && c->next != NULL; c = c->next)
+			;
+		if (c != NULL && (oldest_pool == NULL || c->idle_since < oldest)) {
+			oldest_pool = p;
+			oldest = c->idle_since;
+		}
+		pthread_mutex_unlock(&p->mutex);
+	}
+
+	if (oldest_pool != NULL && pthread_mutex_trylock(&oldest_pool->mutex) == 0) {
+		for (link = &oldest_pool->idle; *link != NULL && (*link)->next != NULL; link = &(*link)->next)
+			;
+		if (*link != NULL) {
+			*victim = *link;
+			*link = NULL;
+			oldest_pool->count--;
+			found = 1;
+		}
+		pthread_mutex_unlock(&oldest_pool->mutex);
+	}
+
+	pthread_mutex_unlock(&pools_mutex);
+
+	return found;
+}
+
+
+/*
+ * stop the handlers idle for too long, and drop the pools left empty (once
+ * a second at most)
+ */
+
+static void sweep_idle(void)
+{
+	struct coproc_pool_t *pool, **link, *dead = NULL;
+	struct coproc_t *c, **clink, *stale = NULL;
+	long now;
+
+	if (idle_timeout_ms <= 0)
+		return;
+
+	now = monotonic_ms();
+
+	pthread_mutex_lock(&pools_mutex);
+
+	if (now - last_sweep < 1000) {
+		pthread_mutex_unlock(&pools_mutex);
+		return;
+	}
+	last_sweep = now;
+
+	for (link = &pools; (pool = *link) != NULL;) {
+		if (pthread_mutex_trylock(&pool->mutex) != 0) {
+			link = &pool->next;
+			continue;
+		}
+
+		for (clink = &pool->idle; (c = *clink) != NULL;) {
+			if (now - c->idle_since >= idle_timeout_ms) {
+				*clink = c->next;
+				c->next = stale;
+				stale = c;
+				pool->count--;
+				handlers_count--;
+			} else {
+				clink = &c->next;
+			}
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		/* nobody holds it, nothing runs in it */
+		if (pool->count == 0 && pool->users == 0) {
+			*link = pool->next;
+			pool->next = dead;
+			dead = pool;
+		} else {
+			link = &pool->next;
+		}
+	}
+
+	pthread_mutex_unlock(&pools_mutex);
+
+	stop_coprocs(stale);
+
+	for (; dead != NULL; dead = pool) {
+		pool = dead->next;
+		DEBUG("dropping pool for %s", dead->command);
+		pthread_mutex_destroy(&dead->mutex);
+		pthread_cond_destroy(&dead->cond);
+		free(dead->command);
+		free(dead);
+	}
+}
+
+
+/*
+ * is COPROC still running?  (if not, it's reaped)
+ */
+
+static int is_alive(struct coproc_t *coproc)
+{
+	return waitpid(coproc->pid, NULL, WNOHANG) == 0;
+}
+
+
+/*
+ * write the whole of BUF, without dying of SIGPIPE if the handler is gone
+ */
+
+static int write_request(int fd, const char *buf, size_t len)
+{
+	sigset_t sigpipe, oldset;
+	struct timespec zero = { 0, 0 };
+	ssize_t res = 0;
+	int pending;
+
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &oldset);
+
+	while (len > 0) {
+		if ((res = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		buf += res;
+		len -= res;
+	}
+
+	/* swallow our SIGPIPE, if any, before unblocking it */
+	if (res == -1 && errno == EPIPE) {
+		do {
+			pending = sigtimedwait(&sigpipe, NULL, &zero);
+		} while (pending == -1 && errno == EINTR);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	return len == 0;
+}
+
+
+/*
+ * read an answer, up to the empty line that ends it, within WAIT_MS (-1
+ * for ever); returns it (without the empty line) or NULL
+ */
+
+static char *read_answer(struct coproc_t *coproc, const char *command, int wait_ms)
+{
+	struct pollfd pfd;
+	size_t len = 0, size = 256;
+	char *answer;
+	ssize_t res;
+	long deadline, left;
+	int ready;
+
+	answer = xmalloc(size);
+
+	pfd.fd = coproc->out;
+	pfd.events = POLLIN;
+
+	/* the whole answer is due in time, however many reads it takes */
+	deadline = monotonic_ms() + wait_ms;
+
+	while (1) {
+		left = -1;
+		if (wait_ms > 0 && (left = deadline - monotonic_ms()) < 0)
+			left = 0;
+
+		if ((ready = poll(&pfd, 1, (int) left)) == -1) {
+			if (errno == EINTR)
+				continue;
+			log_error(errno, "cannot wait for persistent handler %s", command);
+			break;
+		}
+
+		if (ready == 0) {
+			log_error(0, "persistent handler %s (pid %d) timed out", command, (int) coproc->pid);
+			break;
+		}
+
+		if (len + 1 == size)
+			answer = xrealloc(answer, size *= 2);
+
+		if ((res = read(coproc->out, answer + len, size - len - 1)) == -1) {
+			if (errno == EINTR)
+				continue;
+			log_error(errno, "cannot read from persistent handler %s", command);
+			break;
+		}
+
+		if (res == 0) {
+			log_error(0, "persistent handler %s (pid %d) exited", command, (int) coproc->pid);
+			break;
+		}
+
+		len += res;
+		answer[len] = '\0';
+
+		/* a handler doesn't speak until spoken to */
+		if (len == 1 && answer[0] == '\n') {
+			answer[0] = '\0';
+			return answer;
+		}
+		if (len >= 2 && answer[len - 1] == '\n' && answer[len - 2] == '\n') {
+			answer[len - 1] = '\0';
+			return answer;
+		}
+		if (strstr(answer, "\n\n") != NULL || answer[0] == '\n') {
+			log_error(0, "persistent handler %s (pid %d) answered past the empty line", command, (int) coproc->pid);
+			break;
+		}
+	}
+
+	free(answer);
+
+	return NULL;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * hand REQUEST (one line) to a persistent handler for COMMAND (ARGV, if
+ * already split), from a pool of up to POOL_SIZE, and wait no more than
+ * MAX_SECONDS (if > 0) for it, whatever :persistent_handler_timeout says;
+ * returns its answer, one result per line, or NULL.  The CPU time the
+ * handler took meanwhile goes into *CPU_MS (0 if unknown)
+ */
+
+char *coproc_request(const char *command, char **argv, int pool_size, const char *request, int max_seconds, long *cpu_ms)
+{
+	struct coproc_pool_t *pool;
+	struct coproc_t *coproc = NULL, *victim;
+	struct timespec until;
+	char *line, *answer = NULL;
+	size_t len, i;
+	long cpu_before, cpu_after;
+	int wait_ms;
+
+	*cpu_ms = 0;
+
+	if (is_empty(command) || pool_size < 1)
+		return NULL;
+
+	sweep_idle();
+
+	pool = get_pool(command, pool_size);
+
+	/* take an idle handler, or start a new one, or wait for one */
+	pthread_mutex_lock(&pool->mutex);
+	while (coproc == NULL) {
+		if (pool->idle != NULL) {
+			coproc = pool->idle;
+			pool->idle = coproc->next;
+			if (!is_alive(coproc)) {
+				log_warning(0, "persistent handler %s (pid %d) died, restarting it", command, (int) coproc->pid);
+				close(coproc->in);
+				close(coproc->out);
+				free(coproc);
+				coproc = NULL;
+				forget_coproc(pool);
+			}
+		} else if (pool->count < pool->size && make_room(pool, &victim)) {
+			pool->count++;
+			pthread_mutex_unlock(&pool->mutex);
+			if (victim != NULL)
+				stop_coprocs(victim);
+			coproc = start_coproc(command, argv);
+			pthread_mutex_lock(&pool->mutex);
+			if (coproc == NULL) {
+				forget_coproc(pool);
+				pthread_cond_signal(&pool->cond);
+				pthread_mutex_unlock(&pool->mutex);
+				put_pool(pool);
+				return NULL;
+			}
+		} else if (pool->count < pool->size) {
+			/* at the cap, and nothing idle anywhere: a handler may be soon */
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += CAP_WAIT_MS * 1000000L;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&pool->cond, &pool->mutex, &until);
+		} else {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* one trap, one line */
+	len = strlen(request);
+	line = xmalloc(len + 1);
+	for (i = 0; i < len; i++)
+		line[i] = (request[i] == '\n' || request[i] == '\r') ? ' ' : request[i];
+	line[len] = '\n';
+
+	wait_ms = timeout_ms;
+	if (max_seconds > 0 && (wait_ms <= 0 || wait_ms > max_seconds * 1000))
+		wait_ms = max_seconds * 1000;
+
+	/* it is ours and alive: its pid is its own until we reap it */
+	cpu_before = spawn_cpu_ms(coproc->pid);
+
+	if (write_request(coproc->in, line, len + 1))
+		answer = read_answer(coproc, command, wait_ms);
+	else
+		log_error(errno, "cannot write to persistent handler %s (pid %d)", command, (int) coproc->pid);
+
+	free(line);
+
+	cpu_after = spawn_cpu_ms(coproc->pid);
+	if (cpu_before >= 0 && cpu_after >= cpu_before)
+		*cpu_ms = cpu_after - cpu_before;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (answer != NULL) {
+		coproc->idle_since = monotonic_ms();
+		coproc->next = pool->idle;
+		pool->idle = coproc;
+	} else {
+		forget_coproc(pool);
+	}
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	put_pool(pool);
+
+	/* out of sync, or gone: don't reuse it */
+	if (answer == NULL)
+		stop_coproc(coproc);
+
+	return answer;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void coproc_init(void)
+{
+	timeout_ms = atoi(config_get_option_value(":persistent_handler_timeout")) * 1000;
+
+	if (timeout_ms <= 0)
+		timeout_ms = -1;
+
+	idle_timeout_ms = atol(config_get_option_value(":persistent_handler_idle_timeout")) * 1000;
+	handlers_max = atoi(config_get_option_value(":persistent_handlers_max"));
+}
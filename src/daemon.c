@@ -40,6 +40,12 @@
 /* server socket descriptor */
 static unsigned int server_sckt = 0;
 
+/* has this process got a server socket of its own? */
+static int server_sckt_open = 0;
+
+/* UDP socket for native SNMP traps (-1 = disabled) */
+static int snmp_sckt = -1;
+
 
 
 /*
@@ -57,7 +63,59 @@ unsigned int daemon_get_socket(void)
 void daemon_close_socket(void)
 {
 	DEBUG("called");
-	close(server_sckt);
+
+	if (server_sckt_open) {
+		close(server_sckt);
+		server_sckt_open = 0;
+	}
+}
+
+
+int daemon_get_snmp_socket(void)
+{
+	return snmp_sckt;
+}
+
+
+void daemon_close_snmp_socket(void)
+{
+	DEBUG("called");
+
+	if (snmp_sckt >= 0) {
+		close(snmp_sckt);
+		snmp_sckt = -1;
+	}
+}
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * create the primary socket (and the SNMP one, if enabled); with REUSE_PORT
+ * every worker binds its own sockets to the same ports and the kernel
+ * balances connections and datagrams among them
+ */
+
+static void open_socket(int reuse_port)
+{
+	server_sckt = socket_create(atoi(config_get_option_value(":port_number")),
+		!strcmp(config_get_option_value(":socket_reuse"), "true"),
+		reuse_port,
+		!strcmp(config_get_option_value(":localhost_only"), "true"));
+
+	/* set non-blocking */
+	socket_set_nonblocking(server_sckt);
+
+	server_sckt_open = 1;
+
+	/* the SNMP port is privileged: bind it before dropping root */
+	if (!strcmp(config_get_option_value(":snmp_listener"), "true"))
+		snmp_sckt = socket_create_udp(atoi(config_get_option_value(":snmp_port_number")), reuse_port);
 }
 
 
@@ -82,6 +140,9 @@ void daemon_init(uid_t uid, gid_t gid)
 	/* number of workers */
 	int workers;
 
+	/* one SO_REUSEPORT socket per worker? */
+	int reuse_port;
+
 
 	DEBUG("called");
 
@@ -91,6 +152,9 @@ void daemon_init(uid_t uid, gid_t gid)
 	/* enable monitor? */
 	enable_monitor = !strcmp(config_get_option_value(":enable_monitor"), "true");
 
+	/* per-worker sockets only make sense when there are several workers */
+	reuse_port = enable_monitor && !strcmp(config_get_option_value(":socket_reuse_port"), "true");
+
 	if (daemonize) {
 
 		DEBUG("daemonizing");
@@ -142,13 +206,9 @@ void daemon_init(uid_t uid, gid_t gid)
 		DEBUG("forked a second time");
 	}
 
-	/* create a new socket */
-	server_sckt = socket_create(atoi(config_get_option_value(":port_number")),
-		!strcmp(config_get_option_value(":socket_reuse"), "true"),
-		!strcmp(config_get_option_value(":localhost_only"), "true"));
-
-	/* set non-blocking */
-	socket_set_nonblocking(server_sckt);
+	/* create a new socket, shared by all workers */
+	if (!reuse_port)
+		open_socket(0);
 
 	if (enable_monitor) {
 		/* create workers() */
@@ -169,6 +229,8 @@ void daemon_init(uid_t uid, gid_t gid)
 				monitor_register_pid(res, i);
 			else {
 				/* we are the children, i.e, the workers (``slaves'')... */
+				if (reuse_port)
+					open_socket(1);
 				worker_init(i, uid, gid);
 				worker_start_main_loop();
 				return;
@@ -182,7 +244,8 @@ void daemon_init(uid_t uid, gid_t gid)
 	/* from now on we are the parent (i.e., the monitor) */
 
 	/* we don't need to hold open the primary socket */
-	close(server_sckt);
+	daemon_close_socket();
+	daemon_close_snmp_socket();
 
 	monitor_init();
 	monitor_start_main_loop();
@@ -14,6 +14,7 @@
 
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 #include <my_global.h>
@@ -42,6 +43,10 @@ struct db_status_t {
 	GHashTable *svcs_by_host_name_hash_table;
 	GHashTable *svcs_by_host_address_hash_table;
 	GHashTable *svcs_by_cmd_id_hash_table;
+
+	/* numeric OID patterns, and symbolic OIDs keyed by interned OID; NULL
+	   until the trap handlers are fetched */
+	struct oid_trie_t *trap_handlers_trie;
 	GHashTable *trap_handlers_hash_table;
 };
 
@@ -59,6 +64,17 @@ struct command_t {
 	char *c_text;
 	char *c_expanded_text;
 	int c_use_sender_address;
+	int c_persistent_pool;
+	int c_timeout;
+	int c_max_concurrency;
+
+	/* how the trap gets to the plugin, and which varbinds (all if none) */
+	int c_delivery;
+	oid_t *c_varbinds;
+	size_t c_varbinds_count;
+
+	/* DB_CONTRACT_V2: the plugin gets the candidates, and answers for all */
+	int c_contract;
 };
 
 struct host_t {
@@ -69,6 +85,8 @@ struct host_t {
 	char **h_args;
 	int h_args_no;
 	char *h_expanded_text;
+	unsigned int h_expanded_hash;
+	char **h_argv;
 	struct host_t *h_next_by_name;
 	struct host_t *h_next_by_address;
 	struct host_t *h_next_by_cmd_id;
@@ -83,6 +101,8 @@ struct svc_t {
 	char **svc_args;
 	int svc_args_no;
 	char *svc_expanded_text;
+	unsigned int svc_expanded_hash;
+	char **svc_argv;
 	struct svc_t *svc_next_by_host_name;
 	struct svc_t *svc_next_by_host_address;
 	struct svc_t *svc_next_by_cmd_id;
@@ -90,6 +110,7 @@ struct svc_t {
 
 struct trap_handler_t {
 	char *th_oid;
+	oid_t th_oid_id;
 	struct command_t *th_trap_command;
 	struct trap_handler_t *next;
 };
@@ -202,6 +223,32 @@ static int fetch_resources(void)
  * fetch command
  */
 
+/*
+ * intern the OIDs of a list separated by blanks or commas; returns how
+ * many there are
+ */
+
+static size_t parse_varbinds(const char *string, oid_t **oids)
+{
+	char *copy, *word, *saveptr = NULL;
+	size_t count = 0;
+
+	*oids = NULL;
+
+	if ((copy = xstrdup(string)) == NULL)
+		return 0;
+
+	for (word = strtok_r(copy, " \t,", &saveptr); word != NULL; word = strtok_r(NULL, " \t,", &saveptr)) {
+		*oids = xrealloc(*oids, (count + 1) * sizeof **oids);
+		(*oids)[count++] = oid_intern(word, strlen(word));
+	}
+
+	free(copy);
+
+	return count;
+}
+
+
 static int fetch_commands(void)
 {
 	MYSQL_RES *result;
@@ -226,6 +273,31 @@ static int fetch_commands(void)
 		else
 			command->c_use_sender_address = 0;
 
+		/* persistent handlers kept alive by each worker (0: run once per trap) */
+		command->c_persistent_pool = row[4] != NULL ? atoi(row[4]) : 0;
+		if (command->c_persistent_pool < 0)
+			command->c_persistent_pool = 0;
+
+		/* seconds the plugin may run (NULL: :plugin_timeout, 0: no limit) */
+		command->c_timeout = row[5] != NULL ? atoi(row[5]) : -1;
+
+		/* traps run at once per worker, the others queue (0: no limit) */
+		command->c_max_concurrency = row[6] != NULL ? atoi(row[6]) : 0;
+
+		if (row[7] != NULL && !strcmp(row[7], "stdin"))
+			command->c_delivery = DB_DELIVERY_STDIN;
+		else if (row[7] != NULL && !strcmp(row[7], "memfd"))
+			command->c_delivery = DB_DELIVERY_MEMFD;
+		else
+			command->c_delivery = DB_DELIVERY_ARGV;
+
+		command->c_varbinds_count = parse_varbinds(row[8], &command->c_varbinds);
+
+		if (row[9] != NULL && !strcmp(row[9], "v2"))
+			command->c_contract = DB_CONTRACT_V2;
+		else
+			command->c_contract = DB_CONTRACT_V1;
+
 		expanded_text = command_expand_1(command->c_text);
 		if (expanded_text != NULL) {
 			command->c_expanded_text = expanded_text;
@@ -234,7 +306,7 @@ static int fetch_commands(void)
 
 			g_hash_table_insert(db->commands_hash_table, &command->c_id, command);
 
-			DEBUG("fetched command: %s [id: %d] [exp: %s] [use_ip: %s]", command->c_text, command->c_id, command->c_expanded_text, bool_p(command->c_use_sender_address));
+			DEBUG("fetched command: %s [id: %d] [exp: %s] [use_ip: %s] [pool: %d]", command->c_text, command->c_id, command->c_expanded_text, bool_p(command->c_use_sender_address), command->c_persistent_pool);
 
 			count++;
 
@@ -318,6 +390,8 @@ static int fetch_hosts(void)
 			expanded_text = command_expand_3(command->c_expanded_text, host->h_host_name, host->h_address, host->h_args, host->h_args_no);
 			if (expanded_text != NULL) {
 				host->h_expanded_text = expanded_text;
+				host->h_expanded_hash = g_str_hash(expanded_text);
+				host->h_argv = spawn_split_args(expanded_text, 1);
 
 				if ((next_by_name = g_hash_table_lookup(db->hosts_by_host_name_hash_table, host->h_host_name)) != NULL) {
 					g_hash_table_steal(db->hosts_by_host_name_hash_table, host->h_host_name);
@@ -400,6 +474,8 @@ static int fetch_svcs(void)
 
 			if (expanded_text != NULL) {
 				svc->svc_expanded_text = expanded_text;
+				svc->svc_expanded_hash = g_str_hash(expanded_text);
+				svc->svc_argv = spawn_split_args(expanded_text, 1);
 
 				if ((next_by_host_name = g_hash_table_lookup(db->svcs_by_host_name_hash_table, svc->svc_host_name)) != NULL) {
 					g_hash_table_steal(db->svcs_by_host_name_hash_table, svc->svc_host_name);
@@ -461,7 +537,8 @@ static int fetch_trap_handlers(void)
 
 	result = store_result();
 
-	db->trap_handlers_hash_table = g_hash_table_new(g_str_hash, g_str_equal);
+	db->trap_handlers_trie = oid_trie_new();
+	db->trap_handlers_hash_table = g_hash_table_new(g_int_hash, g_int_equal);
 
 	while ((row = fetch_row(result))) {
 		cmd_id = atoi(row[1]);
@@ -470,10 +547,16 @@ static int fetch_trap_handlers(void)
 		if (command != NULL) {
 			trap_handler = xmalloc(sizeof *trap_handler);
 			trap_handler->th_oid = xstrdup(row[0]);
+			trap_handler->th_oid_id = OID_NONE;
 			trap_handler->th_trap_command = command;
-			g_hash_table_insert(db->trap_handlers_hash_table, trap_handler->th_oid, trap_handler);
 
-			DEBUG("fetched trap handler: [oid: %s] [cmd_id: %d]", trap_handler->th_oid, cmd_id);
+			/* an OID we cannot make numeric only matches itself */
+			if (!oid_trie_insert(db->trap_handlers_trie, trap_handler->th_oid, trap_handler)) {
+				trap_handler->th_oid_id = oid_intern(row[0], strlen(row[0]));
+				g_hash_table_insert(db->trap_handlers_hash_table, &trap_handler->th_oid_id, trap_handler);
+			}
+
+			DEBUG("fetched trap handler: [oid: %s (%u)] [cmd_id: %d]", trap_handler->th_oid, trap_handler->th_oid_id, cmd_id);
 
 			count++;
 		}
@@ -502,6 +585,8 @@ void db_init(int is_daemon)
 	int count_resources, count_commands, count_hosts, count_svcs, count_trap_handlers;
 
 	db = xmalloc(sizeof *db);
+	db->trap_handlers_trie = NULL;
+	db->trap_handlers_hash_table = NULL;
 
 	if ((db->conn = mysql_init(NULL)) == NULL)
 		log_critical(0, "memory insufficient to instantiate db connection");
@@ -563,15 +648,32 @@ char *db_lookup_resource(const char *key)
 }
 
 
-int db_lookup_cmd_id_by_oid(const char *oid)
+/*
+ * the handler of a trap OID: by its ARCS if it is numeric, by the interned
+ * OID if it is not
+ */
+
+static struct trap_handler_t *lookup_trap_handler(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	if (narcs > 0)
+		return (struct trap_handler_t *) oid_trie_match(db->trap_handlers_trie, arcs, narcs);
+
+	if (oid == OID_NONE)
+		return NULL;
+
+	return (struct trap_handler_t *) g_hash_table_lookup(db->trap_handlers_hash_table, &oid);
+}
+
+
+int db_lookup_cmd_id_by_oid(oid_t oid, const uint32_t *arcs, size_t narcs)
 {
 	struct trap_handler_t *trap_handler;
 	struct command_t *command;
 
-	if (oid == NULL)
+	if (db->trap_handlers_trie == NULL)
 		return -1;
 
-	trap_handler = (struct trap_handler_t *) g_hash_table_lookup(db->trap_handlers_hash_table, oid);
+	trap_handler = lookup_trap_handler(oid, arcs, narcs);
 	if (trap_handler == NULL)
 		return -1;
 	
@@ -583,6 +685,21 @@ int db_lookup_cmd_id_by_oid(const char *oid)
 }
 
 
+/*
+ * cheap pre-check: 0 means that no handler exists for OID, 1 that one does
+ * (or that we cannot tell)
+ */
+
+int db_may_handle_oid(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	/* no handlers (e.g. standalone mode): don't reject anything */
+	if (db == NULL || db->trap_handlers_trie == NULL)
+		return 1;
+
+	return lookup_trap_handler(oid, arcs, narcs) != NULL;
+}
+
+
 struct command_t *db_lookup_command_by_cmd_id(int cmd_id)
 {
 	if (cmd_id == -1)
@@ -616,6 +733,72 @@ int db_lookup_use_sender_address_by_cmd_id(int cmd_id, int *use_sender_address)
 }
 
 
+int db_lookup_persistent_pool_by_cmd_id(int cmd_id)
+{
+	struct command_t *command;
+
+	if ((command = db_lookup_command_by_cmd_id(cmd_id)) == NULL)
+		return 0;
+
+	return command->c_persistent_pool;
+}
+
+
+int db_lookup_timeout_by_cmd_id(int cmd_id)
+{
+	struct command_t *command;
+
+	if ((command = db_lookup_command_by_cmd_id(cmd_id)) == NULL)
+		return -1;
+
+	return command->c_timeout;
+}
+
+
+/*
+ * how the trap is given to the command: DB_DELIVERY_*; with the varbinds
+ * it wants in *VARBINDS (*COUNT of them, 0 for all)
+ */
+
+int db_lookup_delivery_by_cmd_id(int cmd_id, const oid_t **varbinds, size_t *count)
+{
+	struct command_t *command;
+
+	*varbinds = NULL;
+	*count = 0;
+
+	if ((command = db_lookup_command_by_cmd_id(cmd_id)) == NULL)
+		return DB_DELIVERY_ARGV;
+
+	*varbinds = command->c_varbinds;
+	*count = command->c_varbinds_count;
+
+	return command->c_delivery;
+}
+
+
+int db_lookup_contract_by_cmd_id(int cmd_id)
+{
+	struct command_t *command;
+
+	if ((command = db_lookup_command_by_cmd_id(cmd_id)) == NULL)
+		return DB_CONTRACT_V1;
+
+	return command->c_contract;
+}
+
+
+int db_lookup_max_concurrency_by_cmd_id(int cmd_id)
+{
+	struct command_t *command;
+
+	if ((command = db_lookup_command_by_cmd_id(cmd_id)) == NULL)
+		return 0;
+
+	return command->c_max_concurrency;
+}
+
+
 char *db_lookup_expanded_text_by_cmd_id(int cmd_id)
 {
 	struct command_t *command;
@@ -637,6 +820,8 @@ struct host_t *db_lookup_host_by_cmd_id(int cmd_id, struct host_t *host, int fla
 			return host->h_next_by_name;
 		else if (flags & DB_LOOKUP_NEXT_BY_HOST_ADDRESS)
 			return host->h_next_by_address;
+		else if (flags & DB_LOOKUP_NEXT_BY_CMD_ID)
+			return host->h_next_by_cmd_id;
 		else
 			return NULL;
 	} else {
@@ -652,6 +837,8 @@ struct svc_t *db_lookup_svc_by_cmd_id(int cmd_id, struct svc_t *svc, int flags)
 			return svc->svc_next_by_host_name;
 		else if (flags & DB_LOOKUP_NEXT_BY_HOST_ADDRESS)
 			return svc->svc_next_by_host_address;
+		else if (flags & DB_LOOKUP_NEXT_BY_CMD_ID)
+			return svc->svc_next_by_cmd_id;
 		else
 			return NULL;
 		}
@@ -761,3 +948,35 @@ char *db_extract_expanded_text(struct host_t *host, struct svc_t *svc)
 	else
 		return NULL;
 }
+
+
+/*
+ * a hash of the expanded text, to tell quickly hosts and services that run
+ * the very same command (0 for neither)
+ */
+
+unsigned int db_extract_expanded_hash(struct host_t *host, struct svc_t *svc)
+{
+	if (host != NULL)
+		return host->h_expanded_hash;
+	else if (svc != NULL)
+		return svc->svc_expanded_hash;
+	else
+		return 0;
+}
+
+
+/*
+ * the expanded text split into words once and for all (NULL if it needs a
+ * shell)
+ */
+
+char **db_extract_argv(struct host_t *host, struct svc_t *svc)
+{
+	if (host != NULL)
+		return host->h_argv;
+	else if (svc != NULL)
+		return svc->svc_argv;
+	else
+		return NULL;
+}
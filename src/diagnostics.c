@@ -162,6 +162,16 @@ static double diagnostics_get_length_of_free_tasks_queue(void)
 	return (double) worker_get_length_of_free_tasks_queue();
 }
 
+static double diagnostics_get_bulkhead_queued(void)
+{
+	return (double) bulkhead_get_queued();
+}
+
+static double diagnostics_get_bulkhead_overflows(void)
+{
+	return (double) bulkhead_get_overflows();
+}
+
 static double diagnostics_get_malloc_arena(void)
 {
 	struct mallinfo malloc_info = mallinfo();
@@ -178,6 +188,41 @@ static double diagnostics_get_parsed_traps_per_sec(void)
 	return get_rate_per_sec(trap_get_trap_parsed());
 }
 
+static double diagnostics_get_unhandled_traps(void)
+{
+	return (double) trap_get_trap_unhandled();
+}
+
+static double diagnostics_get_unhandled_traps_per_sec(void)
+{
+	return get_rate_per_sec(trap_get_trap_unhandled());
+}
+
+static double diagnostics_get_snmp_datagrams(void)
+{
+	return (double) snmp_get_datagrams();
+}
+
+static double diagnostics_get_snmp_dropped(void)
+{
+	return (double) snmp_get_dropped();
+}
+
+static double diagnostics_get_snmp_informs(void)
+{
+	return (double) snmp_get_informs();
+}
+
+static double diagnostics_get_snmp_batches(void)
+{
+	return (double) snmp_get_batches();
+}
+
+static double diagnostics_get_snmp_kernel_drops(void)
+{
+	return (double) snmp_get_kernel_drops();
+}
+
 static double diagnostics_get_pid(void)
 {
 	return (double) getpid();
@@ -219,10 +264,19 @@ struct diagnostics_table diagnostics[] = {
 	{ "Available Threads", diagnostics_get_num_of_threads, 1, 1 },
 	{ "Tasks Queue Length", diagnostics_get_length_of_tasks_queue, 1, 1 }, 
 	{ "Free Tasks Queue Length", diagnostics_get_length_of_free_tasks_queue, 1, 1 },
+	{ "Command Queues Length", diagnostics_get_bulkhead_queued, 1, 1 },
+	{ "Command Queue Overflows", diagnostics_get_bulkhead_overflows, 1, 1 },
 	{ "Malloc Arena", diagnostics_get_malloc_arena, 1, 1 },
 	{ "Used Memory", diagnostics_get_used_memory, 1, 1 },
 	{ "Parsed Traps", diagnostics_get_parsed_traps, 1, 1},
 	{ "Parsed Traps/sec", diagnostics_get_parsed_traps_per_sec, 1, 0 },
+	{ "Unhandled Traps", diagnostics_get_unhandled_traps, 1, 1 },
+	{ "Unhandled Traps/sec", diagnostics_get_unhandled_traps_per_sec, 1, 0 },
+	{ "SNMP Datagrams", diagnostics_get_snmp_datagrams, 1, 1 },
+	{ "SNMP Dropped Datagrams", diagnostics_get_snmp_dropped, 1, 1 },
+	{ "SNMP Acknowledged Informs", diagnostics_get_snmp_informs, 1, 1 },
+	{ "SNMP Receive Batches", diagnostics_get_snmp_batches, 1, 1 },
+	{ "UDP Kernel Drops", diagnostics_get_snmp_kernel_drops, 1, 1 },
 	{ "Channel Host Written Bytes", diagnostics_get_channel_written_bytes_host, 1, 1 },
 	{ "Channel Svc Written Bytes", diagnostics_get_channel_written_bytes_svc, 1, 1 },
 	{ "Channel Total Written Bytes", diagnostics_get_channel_written_bytes_total, 1, 1 },
@@ -345,7 +399,7 @@ void diagnostics_write(void)
 
 	asprintf(&diagnostics_file, "%s/%d", config_get_option_value(":diagnostics_pool"), getpid());
 
-	if ((diagnostics_handler = fopen(diagnostics_file, "w")) == NULL) {
+	if ((diagnostics_handler = fopen(diagnostics_file, "we")) == NULL) {
 		flockfile(diagnostics_handler);
 		log_error(errno, "cannot open diagnostics file %s", diagnostics_file);
 		return;
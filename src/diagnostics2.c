@@ -150,7 +150,7 @@ static int traverse_diagnostics_pool(const char *fpath, __attribute__((unused))
 	if (flag == FTW_F) {
 
 		/* fpath is a regular file */
-		if ((handler = fopen(fpath, "r")) != NULL) {
+		if ((handler = fopen(fpath, "re")) != NULL) {
 
 			memset(buffer, 0, FILESIZE);
 
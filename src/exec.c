@@ -14,12 +14,14 @@
 
 
 
-#define _GNU_SOURCE /* for getline() */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "nagiostrapd.h"
 
@@ -31,27 +33,50 @@
  ******************************************************************************/
 
 
+/* a host or service a plugin runs for */
+struct exec_target_t {
+	int is_service;
+	struct host_t *host;
+	struct svc_t *svc;
+};
+
 
-static int stack_max_executions = 0;
+struct execitem_t {
+	char *command;
 
+	/* COMMAND split into words at fetch time (belongs to the db), if any */
+	char **argv;
 
-struct buffer_t {
-	char *line;
-	ssize_t len;
-	struct buffer_t *next;
+	/* the hosts and services sharing COMMAND, which is run once for all */
+	struct exec_target_t *targets;
+	int targets_no;
 };
 
 
-struct execitem_t {
-	char *command;
-	int is_service;
-	struct host_t *host;
-	struct svc_t *svc;
+/* the trap as given to a plugin */
+struct exec_input_t {
+	int delivery;
+
+	/* the contents, quoted (and split, if possible), for the command line */
+	char *contents;
+	char **contents_argv;
+
+	/*
+	 * what goes to the standard input, if anything: the varbinds, one per
+	 * line; for a v2 plugin, its candidates (after an empty line, if there
+	 * were varbinds)
+	 */
+	const char *stdin_text;
+	size_t stdin_len;
+
+	/* DB_CONTRACT_V2: whatever the plugin prints is final */
+	int contract;
 };
 
 
 struct exec_result_t {
 	int is_complete;
+	int is_filled;
 	int is_service;
 	int use_sender_address;
 	unsigned int timestamp;
@@ -84,132 +109,140 @@ static void free_execitem(void *ptr)
 	DEBUG("called");
 
 	free(execitem->command);
+	free(execitem->targets);
 	free(execitem);
 
 	DEBUG("done");
 }
 
 
-static struct buffer_t *alloc_buffer(void)
-{
-	DEBUG("called");
-	return xmalloc(sizeof(struct buffer_t));
-}
-
-
-void free_buffer(struct buffer_t *buffer)
-{
-	struct buffer_t *next;
-
-	if (buffer == NULL) {
-		DEBUG("called on NULL pointer");
-		return;
-	}
-
-	DEBUG("called");
-
-	while (buffer != NULL) {
-		DEBUG("freeing buffer line");
-		next = buffer->next;
-		free(buffer->line);
-		free(buffer);
-		buffer = next;
-	}
-
-	DEBUG("done");
-}
-
+/*
+ * join two word vectors (the words are not copied)
+ */
 
-static struct buffer_t *file_read_line_by_line(FILE *stream)
+static char **join_args(char **first, char **second)
 {
-	struct buffer_t *buffer_head = NULL, *buffer = NULL;
-
-	char *line = NULL;
-	size_t len = 0;
-	ssize_t read;
-#ifndef NDEBUG
-	int count_lines = 0;
-#endif
-
-	DEBUG("called");
-
-	while ((read = getline(&line, &len, stream)) != -1) {
-#ifndef NDEBUG
-		count_lines++;
-		DEBUG("read line %d: %s (len: %d)", count_lines, line, read);
-#endif
-
-		/* add a line to the buffer list */
-		if (buffer == NULL) {
-			buffer = alloc_buffer();
-			buffer_head = buffer;
-		} else if (buffer->next == NULL) {
-			buffer->next = alloc_buffer();
-			buffer = buffer->next;
-		} else {
-			log_error(0, "error in %s", __func__);
-			free_buffer(buffer);
-			free(line);
-			return NULL;
-		}
+	char **argv;
+	size_t n1 = 0, n2 = 0;
 
-		buffer->line = line;
-		buffer->len = read;
-		buffer->next = NULL;
-		line = NULL;
-	}
+	while (first[n1] != NULL)
+		n1++;
+	while (second[n2] != NULL)
+		n2++;
 
-	DEBUG("done");
+	argv = xmalloc((n1 + n2 + 1) * sizeof *argv);
+	memcpy(argv, first, n1 * sizeof *argv);
+	memcpy(argv + n1, second, (n2 + 1) * sizeof *argv);
 
-	return buffer_head;
+	return argv;
 }
 
 
 /*
- * exec command and put output into a buffer
+ * start command, its output to be read with proc_read_line(): the command
+ * is spawned directly with its words and the trap contents' (already
+ * split, if possible), and only goes through /bin/sh if it needs one; it
+ * is killed if it runs for more than TIMEOUT seconds (-1 for the default).
+ * With another delivery than DB_DELIVERY_ARGV, the varbinds go to its
+ * standard input, as do the candidates of a v2 plugin
  */
 
-static struct buffer_t *exec_command(const char *command, const char *trap_contents)
+static struct proc_t *exec_command(const char *command, char **command_argv, struct exec_input_t *input, int timeout)
 {
-	FILE *pipe;
-	struct buffer_t *buffer;
 	size_t command_len, trap_contents_len;
-	char *full_command;
+	char *full_command = NULL, **split_argv = NULL, **argv = NULL;
+	char *const *run_argv;
+	char *shell_argv[4];
+	struct proc_t *proc;
+	pid_t pid;
+	int fd, pidfd, report, is_child, in = -1, feed = -1, pipefd[2];
 
 	command_len = xstrlen(command);
-	trap_contents_len = xstrlen(trap_contents);
+	trap_contents_len = xstrlen(input->contents);
 
 	if (!command_len) {
 		DEBUG("called on empty COMMAND");
 		return NULL;
 	}
-	if (!trap_contents_len) {
+	if (!trap_contents_len && input->delivery == DB_DELIVERY_ARGV) {
 		DEBUG("called on empty TRAP_CONTENTS");
 		return NULL;
 	}
 
-	full_command = xmalloc(command_len + trap_contents_len + 2);
-	memcpy(full_command, command, command_len);
-	full_command[command_len] = ' ';
-	memcpy(full_command+command_len+1, trap_contents, trap_contents_len);
-	full_command[command_len + trap_contents_len + 1] = '\0';
+	if (command_argv == NULL)
+		command_argv = split_argv = spawn_split_args(command, 1);
+
+	if (command_argv != NULL && command_argv[0] != NULL && input->delivery != DB_DELIVERY_ARGV) {
+		run_argv = command_argv;
+		DEBUG("spawning %s directly, trap on its standard input", run_argv[0]);
+	} else if (command_argv != NULL && command_argv[0] != NULL && input->contents_argv != NULL) {
+		run_argv = argv = join_args(command_argv, input->contents_argv);
+		DEBUG("spawning %s directly", run_argv[0]);
+	} else {
+		if (input->delivery != DB_DELIVERY_ARGV) {
+			full_command = xstrdup(command);
+		} else {
+			full_command = xmalloc(command_len + trap_contents_len + 2);
+			memcpy(full_command, command, command_len);
+			full_command[command_len] = ' ';
+			memcpy(full_command+command_len+1, input->contents, trap_contents_len);
+			full_command[command_len + trap_contents_len + 1] = '\0';
+		}
 
-	DEBUG("full command: %s", full_command);
+		DEBUG("full command (through the shell): %s", full_command);
 
-	if ((pipe = popen(full_command, "r")) == NULL) {
-		log_error(errno, "cannot open pipe to command %s", full_command);
-		return NULL;
+		shell_argv[0] = "/bin/sh";
+		shell_argv[1] = "-c";
+		shell_argv[2] = full_command;
+		shell_argv[3] = NULL;
+		run_argv = shell_argv;
 	}
 
-	buffer = file_read_line_by_line(pipe);
+	/* a memfd needs no feeding; without one, a pipe will do */
+	if (input->delivery == DB_DELIVERY_MEMFD && (in = spawn_memfd(input->stdin_text, input->stdin_len)) == -1)
+		DEBUG("no memfd, writing the trap to a pipe");
 
-	pclose(pipe);
+	if (input->stdin_text != NULL && in == -1) {
+		if (pipe2(pipefd, O_CLOEXEC) == -1) {
+			log_error(errno, "cannot create pipe for %s", run_argv[0]);
+			free(argv);
+			free(split_argv);
+			free(full_command);
+			return NULL;
+		}
+		in = pipefd[0];
+		feed = pipefd[1];
+	}
 
+	/* wait for a slot, then start it: the zygote reaps what it starts */
+	proc_reserve();
+	is_child = 0;
+	if (zygote_spawn(run_argv, in, &fd, &pid, &pidfd, &report) == -1) {
+		pid = spawn_plugin(run_argv, in, &fd);
+		report = -1;
+		pidfd = spawn_pidfd(pid);
+		is_child = 1;
+	}
+
+	if (in != -1)
+		close(in);
+
+	free(argv);
+	free(split_argv);
 	free(full_command);
 
+	if (is_child && pid == -1) {
+		if (feed != -1)
+			close(feed);
+		proc_release();
+		return NULL;
+	}
+
+	proc = proc_watch(pid, pidfd, is_child, fd, report, feed, feed != -1 ? input->stdin_text : NULL, input->stdin_len, timeout);
+
 	DEBUG("done");
 
-	return buffer;
+	return proc;
 }
 
 
@@ -234,81 +267,15 @@ static void parse_result_field(char **dest, const char *source)
 #endif
 
 
-typedef enum {
-	S_STARTED, S_HOST_ADDRESS, S_HOST_NAME, S_SVC_DESC, S_RET_VALUE, S_OUTPUT, S_PERFDATA, S_SVC_ID
-} parse_result_str_status_t;
+/*
+ * build a result from its fields (copied), filling in what is missing from
+ * HOST or SVC
+ */
 
-static struct exec_result_t *parse_result_str(char *result_str, int is_service, struct host_t *host, struct svc_t *svc, int use_sender_address)
+static struct exec_result_t *new_exec_result(const char *host_address, const char *host_name, const char *svc_desc, const char *ret_value, const char *output, const char *perfdata, const char *svc_id, int is_service, struct host_t *host, struct svc_t *svc, int use_sender_address)
 {
 	struct exec_result_t *result;
 
-	char *host_address = NULL;
-	char *host_name = NULL;
-	char *svc_desc = NULL;
-	char *ret_value = NULL;
-	char *output = NULL;
-	char *perfdata = NULL;
-	char *svc_id = NULL;
-
-	char *token;
-	parse_result_str_status_t status = S_STARTED;
-
-	result_str = remove_chars(result_str, "\n\r");
-
-	if (is_empty(result_str)) {
-		DEBUG("called on empty RESULT_STR");
-		return NULL;
-	}
-
-	DEBUG("called on RESULT_STR: %s", result_str);
-
-	while ((token = strsep(&result_str, "|")) != NULL) {
-
-		DEBUG("token: %s", token);
-
-		switch(status) {
-			case S_STARTED:
-				host_address = token;
-				status = S_HOST_ADDRESS;
-				DEBUG("status: S_HOST_ADDRESS, host_address: %s", host_address);
-				break;
-			case S_HOST_ADDRESS:
-				host_name = token;
-				status = S_HOST_NAME;
-				DEBUG("status: S_HOST_NAME, host_name: %s", host_name);
-				break;
-			case S_HOST_NAME:
-				svc_desc = token;
-				status = S_SVC_DESC;
-				DEBUG("status: S_HOST_ADDRESS, svc_desc: %s", svc_desc);
-				break;
-			case S_SVC_DESC:
-				ret_value = token;
-				status = S_RET_VALUE;
-				DEBUG("status: S_RET_VALUE, ret_value: %s", ret_value);
-				break;
-			case S_RET_VALUE:
-				output = token;
-				status = S_OUTPUT;
-				DEBUG("status: S_OUTPUT, output: %s", output);
-				break;
-			case S_OUTPUT:
-				perfdata = token;
-				status = S_PERFDATA;
-				DEBUG("status: S_PERFDATA, perfdata: %s", perfdata);
-				break;
-			case S_PERFDATA:
-				svc_id = token;
-				status = S_SVC_ID;
-				DEBUG("status: S_SVC_ID, svc_id: %s", svc_id);
-				break;
-			default:
-				break;
-		}
-	}
-
-	DEBUG("parsing completed");
-
 	result = xmalloc(sizeof *result);
 
 	result->host_address = xstrdup(host_address);
@@ -317,14 +284,18 @@ static struct exec_result_t *parse_result_str(char *result_str, int is_service,
 	result->output = xstrdup(output);
 	result->perfdata = xstrdup(perfdata);
 
+	/* a short line leaves the last fields NULL */
 	result->is_complete = is_integer(ret_value);
-	result->ret_value = atoi(ret_value);
+	result->ret_value = result->is_complete ? atoi(ret_value) : 0;
 
 	result->is_valid_svc_id = is_integer(svc_id);
-	result->svc_id = atoi(svc_id);
+	result->svc_id = result->is_valid_svc_id ? atoi(svc_id) : 0;
 
 	result->is_service = is_service;
 
+	/* set below if anything comes from HOST or SVC */
+	result->is_filled = 0;
+
 	if (is_service == -1) {
 		if (!is_empty(result->svc_desc)) {
 			/*
@@ -348,86 +319,206 @@ static struct exec_result_t *parse_result_str(char *result_str, int is_service,
 			if (is_empty(result->host_address)) {
 				if (host != NULL) {
 					char *host_address = db_extract_host_address(host, NULL);
-					if (!is_empty(host_address))
+					if (!is_empty(host_address)) {
 						result->host_address = xstrdup(host_address);
+						result->is_filled = 1;
+					}
 				}
 			}
 			if (is_empty(result->host_name)) {
 				if (host != NULL) {
 					char *host_name = db_extract_host_name(host, NULL);
-					if (!is_empty(host_name))
+					if (!is_empty(host_name)) {
 						result->host_name = xstrdup(host_name);
+						result->is_filled = 1;
+					}
 				}
 			}
 		} else {
 			if (is_empty(result->host_address)) {
 				if (svc != NULL) {
 					char *host_address = db_extract_host_address(NULL, svc);
-					if (!is_empty(host_address))
+					if (!is_empty(host_address)) {
 						result->host_address = xstrdup(host_address);
+						result->is_filled = 1;
+					}
 				}
 			}
 			if (is_empty(result->host_name)) {
 				if (svc != NULL) {
 					char *host_name = db_extract_host_name(NULL, svc);
-					if (!is_empty(host_name))
+					if (!is_empty(host_name)) {
 						result->host_name = xstrdup(host_name);
+						result->is_filled = 1;
+					}
 				}
 			}
 			if (is_empty(svc_desc)) {
 				if (svc != NULL) {
 					char *svc_desc = db_extract_svc_desc(svc);
-					if (!is_empty(svc_desc))
+					if (!is_empty(svc_desc)) {
 						result->svc_desc = xstrdup(svc_desc);
+						result->is_filled = 1;
+					}
 				}
 			}
 		}
 	}
 
+	return result;
+}
+
+
+typedef enum {
+	S_STARTED, S_HOST_ADDRESS, S_HOST_NAME, S_SVC_DESC, S_RET_VALUE, S_OUTPUT, S_PERFDATA, S_SVC_ID
+} parse_result_str_status_t;
+
+static struct exec_result_t *parse_result_str(char *result_str, int is_service, struct host_t *host, struct svc_t *svc, int use_sender_address)
+{
+	struct exec_result_t *result;
+
+	char *host_address = NULL;
+	char *host_name = NULL;
+	char *svc_desc = NULL;
+	char *ret_value = NULL;
+	char *output = NULL;
+	char *perfdata = NULL;
+	char *svc_id = NULL;
+
+	char *token, *p, *q;
+	parse_result_str_status_t status = S_STARTED;
+
+	/* RESULT_STR is the caller's: it's cut into fields in place */
+	for (p = q = result_str; *p != '\0'; p++) {
+		if (*p != '\n' && *p != '\r')
+			*q++ = *p;
+	}
+	*q = '\0';
+
+	if (is_empty(result_str)) {
+		DEBUG("called on empty RESULT_STR");
+		return NULL;
+	}
+
+	DEBUG("called on RESULT_STR: %s", result_str);
 
-	free(result_str);
+	while ((token = strsep(&result_str, "|")) != NULL) {
+
+		DEBUG("token: %s", token);
+
+		switch(status) {
+			case S_STARTED:
+				host_address = token;
+				status = S_HOST_ADDRESS;
+				DEBUG("status: S_HOST_ADDRESS, host_address: %s", host_address);
+				break;
+			case S_HOST_ADDRESS:
+				host_name = token;
+				status = S_HOST_NAME;
+				DEBUG("status: S_HOST_NAME, host_name: %s", host_name);
+				break;
+			case S_HOST_NAME:
+				svc_desc = token;
+				status = S_SVC_DESC;
+				DEBUG("status: S_HOST_ADDRESS, svc_desc: %s", svc_desc);
+				break;
+			case S_SVC_DESC:
+				ret_value = token;
+				status = S_RET_VALUE;
+				DEBUG("status: S_RET_VALUE, ret_value: %s", ret_value);
+				break;
+			case S_RET_VALUE:
+				output = token;
+				status = S_OUTPUT;
+				DEBUG("status: S_OUTPUT, output: %s", output);
+				break;
+			case S_OUTPUT:
+				perfdata = token;
+				status = S_PERFDATA;
+				DEBUG("status: S_PERFDATA, perfdata: %s", perfdata);
+				break;
+			case S_PERFDATA:
+				svc_id = token;
+				status = S_SVC_ID;
+				DEBUG("status: S_SVC_ID, svc_id: %s", svc_id);
+				break;
+			default:
+				break;
+		}
+	}
+
+	DEBUG("parsing completed");
+
+	result = new_exec_result(host_address, host_name, svc_desc, ret_value, output, perfdata, svc_id, is_service, host, svc, use_sender_address);
 
 	return result;
 }
 
 
 /*
- * push execitem and execlist
+ * push execitem and execlist: a run that PLAN has already is left out
  */
 
-static int push_execitem(struct stack_t *stack, const char *command, int is_service, struct host_t *host, struct svc_t *svc)
+static int push_execitem(struct plan_t *plan, const char *command, struct exec_target_t *targets, int targets_no)
 {
 	struct execitem_t *item;
+	const char *host_name, *svc_desc;
+	size_t key_len;
+	char *key, *p;
+	int i;
 
-	if (stack == NULL || command == NULL)
+	if (plan == NULL || command == NULL) {
+		free(targets);
 		return 1;
+	}
 	
 	item = xmalloc(sizeof *item);
 
 	item->command = xstrdup(command);
 
-	item->is_service = is_service;
+	/* a host's (or service's) command was split when it was fetched */
+	item->argv = db_extract_argv(targets[0].host, targets[0].svc);
 
-	item->host = host;
-	
-	item->svc = svc;
+	item->targets = targets;
+	item->targets_no = targets_no;
+
+	/* what the plugin is run with, and for */
+	key_len = strlen(command) + 3;
+	for (i = 0; i < targets_no; i++)
+		key_len += xstrlen(db_extract_host_name(targets[i].host, targets[i].svc)) + xstrlen(db_extract_svc_desc(targets[i].svc)) + 16;
+
+	p = key = xmalloc(key_len);
+	p += sprintf(p, "%s [", command);
+	for (i = 0; i < targets_no; i++) {
+		host_name = db_extract_host_name(targets[i].host, targets[i].svc);
+		svc_desc = db_extract_svc_desc(targets[i].svc);
+		p += sprintf(p, "%s%s%s%s%s", i > 0 ? ", " : "", targets[i].is_service == 1 ? "service " : targets[i].is_service == 0 ? "host " : "", host_name != NULL ? host_name : "-", svc_desc != NULL ? "/" : "", svc_desc != NULL ? svc_desc : "");
+	}
+	strcpy(p, "]");
+
+	plan_add(plan, key, item);
+	free(key);
 
-	return stack_push(stack, item);
+	return 1;
 }
 
 
-static int push_execlist(struct stack_t *stack, struct execlist_t *execlist)
+/*
+ * each item of EXECLIST is run once for the hosts and services in its
+ * fan-out as well
+ */
+
+static int push_execlist(struct plan_t *plan, struct execlist_t *execlist)
 {
-	struct execlist_t *execlist_current = NULL;
+	struct execlist_t *execlist_current = NULL, *fanout;
 
-	if (stack == NULL)
+	if (plan == NULL)
 		return 1;
 	
 	while ((execlist_current = execlist_getnext(execlist, execlist_current)) != NULL) {
 		char *command;
-		int is_service;
-		struct host_t *host;
-		struct svc_t *svc;
+		struct exec_target_t *targets;
+		int targets_no;
 
 		command = execlist_extract_command(execlist_current);
 		if (command == NULL) {
@@ -435,79 +526,38 @@ static int push_execlist(struct stack_t *stack, struct execlist_t *execlist)
 			return 0;
 		}
 
-		host = execlist_extract_host(execlist_current);
-		if (host == NULL)
-			DEBUG("cannot extract host from execlist");
-
-		svc = execlist_extract_svc(execlist_current);
-		if (svc == NULL)
-			DEBUG("cannot extract svc from execlist");
-
-		if (!execlist_extract_is_service(execlist_current, &is_service)) {
-			DEBUG("cannot extract \"is_service\" from execlist");
-			return 0;
-		}
-
-		if (!push_execitem(stack, command, is_service, host, svc)) {
-			DEBUG("cannot push item onto stack");
-			return 0;
-		}
-	}
+		targets_no = 0;
+		for (fanout = execlist_current; fanout != NULL; fanout = execlist_extract_fanout(fanout))
+			targets_no++;
 
-	return 1;
-}
+		targets = xmalloc(targets_no * sizeof *targets);
 
+		for (fanout = execlist_current, targets_no = 0; fanout != NULL; fanout = execlist_extract_fanout(fanout), targets_no++) {
+			targets[targets_no].host = execlist_extract_host(fanout);
+			if (targets[targets_no].host == NULL)
+				DEBUG("cannot extract host from execlist");
 
-/*
- * stack run
- */
+			targets[targets_no].svc = execlist_extract_svc(fanout);
+			if (targets[targets_no].svc == NULL)
+				DEBUG("cannot extract svc from execlist");
 
-static struct exec_result_t *stack_run(struct stack_t *stack, const char *command, int cmd_id, int use_sender_address, const char *sender_address, const char *trap_contents, unsigned int trap_timestamp)
-{
-	struct stack_item_t *stack_item;
-	struct exec_result_t *exec_result = NULL;
-	struct execitem_t *execitem;
-	struct execlist_t *execlist = NULL;
-	struct buffer_t *buffer;
-	int return_null = 0;
-
-	if (stack_count_executions(stack) > stack_max_executions)
-		return NULL;
-
-	stack_increment_executions(stack);
-
-	stack_item = stack_pop(stack);
-	execitem = (struct execitem_t *) stack_get_data(stack_item);
-	
-	buffer = exec_command(execitem->command, trap_contents);
-
-	while (buffer != NULL) {
-		exec_result = parse_result_str(buffer->line, execitem->is_service, execitem->host, execitem->svc, use_sender_address);
-		if (exec_result->is_complete) {
-			break;
-		} else {
-			if ((execlist = execlist_build(command, cmd_id, use_sender_address, sender_address, exec_result->host_address, exec_result->host_name)) == NULL) {
-				return_null = 1;
-				break;
-			} else {
-				if (!push_execlist(stack, execlist)) {
-					return_null = 1;
-					break;
-				}
+			if (!execlist_extract_is_service(fanout, &targets[targets_no].is_service)) {
+				DEBUG("cannot extract \"is_service\" from execlist");
+				free(targets);
+				return 0;
 			}
 		}
 
-		buffer = buffer->next;
-	}
-
-	free_execitem(execitem);
-	free_buffer(buffer);
-	execlist_destroy(execlist);
+		if (targets_no > 1)
+			DEBUG("%s run once for %d hosts and services", command, targets_no);
 
-	if (exec_result)
-		exec_result->timestamp = trap_timestamp;
+		if (!push_execitem(plan, command, targets, targets_no)) {
+			DEBUG("cannot push item onto plan");
+			return 0;
+		}
+	}
 
-	return (return_null ? NULL : exec_result);
+	return 1;
 }
 
 
@@ -617,6 +667,170 @@ static int do_output(struct exec_result_t *exec_result)
 
 
 
+/*
+ * handle a line of output of EXECITEM: a result goes to the channel right
+ * away, for each host or service the plugin ran for (once, if the plugin
+ * named it), a host to be looked up pushes its commands onto PLAN (unless
+ * the plugin answers by CONTRACT v2, and had the hosts already); returns 0
+ * if the trap must be given up
+ */
+
+static int handle_result_line(struct plan_t *plan, struct execitem_t *execitem, char *line, const char *command, int cmd_id, int use_sender_address, const char *sender_address, int contract, unsigned int trap_timestamp)
+{
+	struct exec_target_t *target = execitem->targets;
+	struct exec_result_t *exec_result = NULL;
+	struct execlist_t *execlist;
+	char *fanout_line = NULL;
+	int i, is_filled, pushed;
+
+	/* the line is parsed in place, and again for each other target */
+	if (execitem->targets_no > 1)
+		fanout_line = xstrdup(line);
+
+	for (i = 0; i < execitem->targets_no; i++, target++) {
+		if (i > 0)
+			strcpy(line, fanout_line);
+
+		if ((exec_result = parse_result_str(line, target->is_service, target->host, target->svc, use_sender_address)) == NULL)
+			break;
+
+		/*
+		 * no return value: a host to look up, which only the first target
+		 * can tell (the line is the same for all, and the first ones have
+		 * their result already)
+		 */
+		if (!exec_result->is_complete) {
+			if (i == 0)
+				break;
+			log_warning(0, "line of %s incomplete for target %d of %d only, dropped", execitem->command, i + 1, execitem->targets_no);
+			free_exec_result(exec_result);
+			exec_result = NULL;
+			break;
+		}
+
+		exec_result->timestamp = trap_timestamp;
+		is_filled = exec_result->is_filled;
+
+		/* do_output() only frees what it writes */
+		if (prepare_for_output(exec_result) == NULL || !do_output(exec_result))
+			free_exec_result(exec_result);
+		exec_result = NULL;
+
+		/* what took nothing from the target is the same for all of them */
+		if (!is_filled)
+			break;
+	}
+
+	free(fanout_line);
+
+	if (exec_result == NULL)
+		return 1;
+
+	if (contract == DB_CONTRACT_V2) {
+		DEBUG("no return value from a v2 plugin, result dropped");
+		free_exec_result(exec_result);
+		return 1;
+	}
+
+	execlist = execlist_build(command, cmd_id, use_sender_address, sender_address, exec_result->host_address, exec_result->host_name);
+	free_exec_result(exec_result);
+
+	if (execlist == NULL)
+		return 0;
+
+	pushed = push_execlist(plan, execlist);
+	execlist_destroy(execlist);
+
+	return pushed;
+}
+
+
+/*
+ * run EXECITEM, the next run of PLAN, and handle its output a line at a
+ * time, as it comes; returns 0 if the trap must be given up
+ */
+
+static int run_execitem(struct plan_t *plan, struct execitem_t *execitem, const char *command, int cmd_id, int use_sender_address, const char *sender_address, struct exec_input_t *input, int persistent_pool, int timeout, unsigned int trap_timestamp)
+{
+	struct proc_t *proc;
+	char *answer, *rest, *line;
+	long cpu_ms = 0;
+	int handled = 0, ok = 1, left;
+
+	/* no run outlives the trap's time budget */
+	if ((left = plan_time_left(plan)) > 0) {
+		timeout = proc_get_timeout(timeout);
+		if (timeout == 0 || timeout > left)
+			timeout = left;
+	}
+
+	if (persistent_pool > 0) {
+		/* a persistent handler gets the contents on its standard input */
+		if (is_empty(input->contents)) {
+			DEBUG("called on empty TRAP_CONTENTS");
+		} else if ((answer = coproc_request(execitem->command, execitem->argv, persistent_pool, input->contents, left, &cpu_ms)) != NULL) {
+			rest = answer;
+			while (ok && (line = strsep(&rest, "\n")) != NULL) {
+				if (rest == NULL && *line == '\0')
+					break;
+				ok = handle_result_line(plan, execitem, line, command, cmd_id, use_sender_address, sender_address, input->contract, trap_timestamp);
+				handled = 1;
+			}
+			free(answer);
+		}
+	} else if ((proc = exec_command(execitem->command, execitem->argv, input, timeout)) != NULL) {
+		while (ok && (line = proc_read_line(proc)) != NULL) {
+			ok = handle_result_line(plan, execitem, line, command, cmd_id, use_sender_address, sender_address, input->contract, trap_timestamp);
+			handled = 1;
+			free(line);
+		}
+		if (!proc_finish(proc, &cpu_ms))
+			log_error(0, "command %s killed", execitem->command);
+	}
+
+	plan_charge(plan, cpu_ms);
+
+	return handled && ok;
+}
+
+
+
+/*
+ * a result made of FIELDS (RULE_FIELDS of them, freed here) straight from
+ * the varbinds of TRAP, with no plugin to run
+ */
+
+static int exec_fields(struct trap_t *trap, char **fields)
+{
+	struct exec_result_t *exec_result;
+	int i, executed = 0;
+
+	/*
+	 * like a plugin, the fields say whether it's about a service; those a
+	 * rule leaves unset are NULL, and a result without a return value is
+	 * only incomplete (new_exec_result() doesn't atoi() it)
+	 */
+	exec_result = new_exec_result(fields[RULE_HOST_ADDRESS], fields[RULE_HOST_NAME], fields[RULE_SVC_DESC], fields[RULE_RET_VALUE], fields[RULE_OUTPUT], fields[RULE_PERFDATA], NULL, -1, NULL, NULL, 0);
+
+	for (i = 0; i < RULE_FIELDS; i++)
+		free(fields[i]);
+
+	if (exec_result->is_complete) {
+		exec_result->timestamp = trap_get_timestamp(trap);
+		executed = do_output(exec_result);
+	} else {
+		DEBUG("no return value (%s), dropped", exec_result->host_name != NULL ? exec_result->host_name : "no host name");
+	}
+
+	/* do_output() only frees what it writes */
+	if (!executed)
+		free_exec_result(exec_result);
+
+	return executed;
+}
+
+
+
 /*
  *     Public methods
  *
@@ -626,15 +840,27 @@ static int do_output(struct exec_result_t *exec_result)
 int exec_trap(struct trap_t *trap, const char *oid, const char *command)
 {
 	char *trap_oid = NULL;
+	const uint32_t *trap_arcs;
+	size_t trap_narcs;
 	int cmd_id = 0;
 	struct execlist_t *execlist = NULL;
-	struct exec_result_t *exec_result;
-	struct stack_t *stack;
-	char *trap_contents;
+	struct rule_t *rule;
+	char *fields[RULE_FIELDS];
+	struct plan_t *plan = NULL;
+	struct execitem_t *execitem;
+	struct exec_target_t *targets;
+	struct exec_input_t input;
+	const oid_t *varbinds = NULL;
+	size_t count_varbinds = 0;
+	char *candidates, *stdin_text = NULL, *p;
+	size_t candidates_len;
 	unsigned int trap_timestamp;
 	char *filename;
 	int should_free_filename = 0;
 	int use_sender_address;
+	int persistent_pool = 0;
+	int timeout = -1;
+	int executed = 0;
 	char *sender_address;
 
 	if (trap == NULL) {
@@ -648,15 +874,33 @@ int exec_trap(struct trap_t *trap, const char *oid, const char *command)
 		return 0;
 	}
 
-	if (oid != NULL && strcmp(oid, trap_oid)) {
+	/* the user may have spelt the OID in another form */
+	if (oid != NULL && oid_intern(oid, strlen(oid)) != oid_intern(trap_oid, strlen(trap_oid))) {
 		DEBUG("trap OID does not match OID passed by user");
 		return 0;
 	}
 
+	/* Nagios-to-Nagios traps and rules come first, and spare us a plugin */
+	if (command == NULL) {
+		if (notify_decode(trap, fields))
+			return exec_fields(trap, fields);
+
+		trap_arcs = trap_get_oid_arcs(trap, &trap_narcs);
+		if ((rule = rule_lookup(trap_get_oid_id(trap), trap_arcs, trap_narcs)) != NULL) {
+			DEBUG("trap oid %s handled by a rule", trap_oid);
+			if (!rule_evaluate(rule, trap, fields)) {
+				DEBUG("no field of the rule matched");
+				return 0;
+			}
+			return exec_fields(trap, fields);
+		}
+	}
+
 	if (command == NULL) {
 		DEBUG("command is NULL, will lookup stuff from hash tables");
 
-		if ((cmd_id = db_lookup_cmd_id_by_oid(trap_oid)) == -1) {
+		trap_arcs = trap_get_oid_arcs(trap, &trap_narcs);
+		if ((cmd_id = db_lookup_cmd_id_by_oid(trap_get_oid_id(trap), trap_arcs, trap_narcs)) == -1) {
 			DEBUG("cannot lookup command by trap_oid: %s", trap_oid);
 			return 0;
 		} else {
@@ -678,6 +922,13 @@ int exec_trap(struct trap_t *trap, const char *oid, const char *command)
 				(use_sender_address ? "NEED" : "DO NOT need"), trap_oid);
 		}
 
+		persistent_pool = db_lookup_persistent_pool_by_cmd_id(cmd_id);
+		timeout = db_lookup_timeout_by_cmd_id(cmd_id);
+		input.delivery = db_lookup_delivery_by_cmd_id(cmd_id, &varbinds, &count_varbinds);
+
+		/* a persistent handler answers for one trap line at a time */
+		input.contract = persistent_pool == 0 ? db_lookup_contract_by_cmd_id(cmd_id) : DB_CONTRACT_V1;
+
 	} else {
 		DEBUG("command is not NULL");
 
@@ -688,84 +939,117 @@ int exec_trap(struct trap_t *trap, const char *oid, const char *command)
 
 		should_free_filename = 1;
 		use_sender_address = 0;
+		input.delivery = DB_DELIVERY_ARGV;
+		input.contract = DB_CONTRACT_V1;
 	}
 
+	/* from here on, the trap's own state goes away at the end */
+	input.contents = NULL;
+	input.contents_argv = NULL;
+	input.stdin_text = NULL;
+	input.stdin_len = 0;
+
 	if (!set_permissions(filename)) {
 		DEBUG("cannot set exec permissions on file %s", filename);
-		return 0;
+		goto done;
 	}
 
-	if ((trap_contents = trap_get_contents(trap)) == NULL) {
+	/* quoting the contents for a command line is spared to the others */
+	if (input.delivery != DB_DELIVERY_ARGV && persistent_pool == 0) {
+		input.stdin_text = trap_get_varbinds(trap, varbinds, count_varbinds, &input.stdin_len);
+		DEBUG("trap varbinds for the standard input: %s", input.stdin_text);
+	} else if ((input.contents = trap_get_contents(trap)) == NULL) {
 		DEBUG("cannot extract trap contents from trap");
-		return 0;
+		goto done;
 	} else {
-		DEBUG("successfully extracted trap contents from trap: %s", trap_contents);
+		DEBUG("successfully extracted trap contents from trap: %s", input.contents);
 	}
 
 	if ((trap_timestamp = trap_get_timestamp(trap)) == 0) {
 		DEBUG("cannot extract trap timestamp from trap");
-		return 0;
+		goto done;
 	} else {
 		DEBUG("successfully extracted trap timestamp from trap: %u", trap_timestamp);
 	}
 
 	if ((sender_address = trap_get_sender_address(trap)) == NULL) {
 		DEBUG("cannot extract sender address from trap");
-		return 0;
+		goto done;
 	} else {
 		DEBUG("successfully extracted sender address %s from trap", sender_address);
 	}
 
-	if ((stack = stack_init(free_execitem)) == NULL) {
-		log_error(0, "cannot init stack");
-		return 0;
-	} else {
-		DEBUG("stack successfully initialized");
+	/* a v2 plugin is told up front which hosts and services it may answer for */
+	if (input.contract == DB_CONTRACT_V2) {
+		candidates = execlist_candidates(cmd_id, use_sender_address, sender_address, NULL, NULL, &candidates_len);
+		if (candidates_len == 0) {
+			DEBUG("no hosts nor services for trap oid %s", trap_oid);
+			free(candidates);
+			goto done;
+		}
+
+		p = stdin_text = xmalloc(input.stdin_len + candidates_len + 2);
+		if (input.stdin_text != NULL) {
+			memcpy(p, input.stdin_text, input.stdin_len);
+			p += input.stdin_len;
+			*p++ = '\n';
+		}
+		memcpy(p, candidates, candidates_len + 1);
+		free(candidates);
+
+		input.stdin_text = stdin_text;
+		input.stdin_len = p - stdin_text + candidates_len;
 	}
 
+	plan = plan_new(free_execitem);
+
 	if (command == NULL) {
 		DEBUG("command is NULL");
 
-		if ((execlist = execlist_build(NULL, cmd_id, use_sender_address, sender_address, NULL, NULL)) == NULL) {
+		/* a v2 plugin runs once, like a collector's, whatever the sender */
+		if ((execlist = execlist_build(NULL, cmd_id, input.contract == DB_CONTRACT_V2 ? 0 : use_sender_address, sender_address, NULL, NULL)) == NULL) {
 			DEBUG("built empty execlist...");
-			return 0;
+			goto done;
 		} else {
-			if (!push_execlist(stack, execlist)) {
-				DEBUG("cannot push execlist onto stack");
-				return 0;
+			if (!push_execlist(plan, execlist)) {
+				DEBUG("cannot push execlist onto plan");
+				goto done;
 			}
 		}
 	} else {
 		DEBUG("command is not NULL");
 
-		if (!push_execitem(stack, command, 0, NULL, NULL)) {
-			DEBUG("cannot push execitem onto stack");
-			return 0;
+		targets = xcalloc(1, sizeof *targets);
+		if (!push_execitem(plan, command, targets, 1)) {
+			DEBUG("cannot push execitem onto plan");
+			goto done;
 		}
 	}
 
-	while (stack_get_depth(stack) > 0) {
+	/* the contents are split once for every plugin run */
+	if (input.contents != NULL)
+		input.contents_argv = spawn_split_args(input.contents, 0);
 
-		exec_result = stack_run(stack, command, cmd_id, use_sender_address, sender_address, trap_contents, trap_timestamp);
-		if (exec_result == NULL)
-			return 0;
-
-		if (!prepare_for_output(exec_result))
-			return 0;
-
-		do_output(exec_result);
+	/* runs already made for the trap are not made again */
+	while ((execitem = plan_next(plan)) != NULL) {
+		if (!run_execitem(plan, execitem, command, cmd_id, use_sender_address, sender_address, &input, persistent_pool, timeout, trap_timestamp))
+			goto done;
 	}
 
+	executed = !plan_exhausted(plan);
+
+done:
 	/*
-	 * free everything
+	 * free everything (the contents belong to the trap)
 	 */
-	free(trap_contents);
+	free(input.contents_argv);
+	free(stdin_text);
 	execlist_destroy(execlist);
-	stack_free(stack);
+	plan_free(plan);
 	if (should_free_filename)
 		free(filename);
 
-	return 1;
+	return executed;
 }
 
 
@@ -778,5 +1062,7 @@ int exec_trap(struct trap_t *trap, const char *oid, const char *command)
 
 void exec_init(void)
 {
-	stack_max_executions = atoi(config_get_option_value(":plugins_max_executions"));
+	coproc_init();
+	plan_init();
+	proc_init();
 }
@@ -14,10 +14,12 @@
 
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <glib.h>
 
 #include "nagiostrapd.h"
 
@@ -38,9 +40,19 @@ struct execlist_t {
 	struct host_t *host;
 	struct svc_t *svc;
 	struct execlist_t *next;
+
+	/* the other hosts and services running the very same command */
+	struct execlist_t *fanout;
 };
 
 
+/* a field of a candidate (see execlist_candidates()) */
+#define CANDIDATE_FIELD(s) ((s) != NULL ? (s) : "")
+
+/* what a candidate field cannot hold */
+#define CANDIDATE_SEPARATORS "|\n"
+
+
 /*
  * diagnostics counters
  */
@@ -58,18 +70,63 @@ static pthread_mutex_t execlist_counter_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 /*
- * append an item to an execlist
+ * items of an execlist being built, by command: the hash worked out when
+ * the hosts and services were fetched, then the expanded text
+ */
+
+static guint command_hash(gconstpointer key)
+{
+	const struct execlist_t *item = key;
+
+	return db_extract_expanded_hash(item->host, item->svc);
+}
+
+
+static gboolean command_equal(gconstpointer a, gconstpointer b)
+{
+	const struct execlist_t *item_a = a, *item_b = b;
+
+	return db_extract_expanded_hash(item_a->host, item_a->svc) == db_extract_expanded_hash(item_b->host, item_b->svc)
+		&& !strcmp(item_a->command, item_b->command);
+}
+
+
+/*
+ * the item in COMMANDS that runs the same command as HOST or SVC, which
+ * would run COMMAND, if any
+ */
+
+static struct execlist_t *execlist_lookup_command(GHashTable *commands, const char *command, struct host_t *host, struct svc_t *svc)
+{
+	struct execlist_t key;
+
+	if ((host == NULL && svc == NULL) || command == NULL)
+		return NULL;
+
+	key.command = (char *) command;
+	key.host = host;
+	key.svc = svc;
+
+	return g_hash_table_lookup(commands, &key);
+}
+
+
+/*
+ * append an item to an execlist: a host or service whose command is some
+ * other item's already goes in that item's fan-out instead, so that the
+ * command is run only once (returns the last item, in any case)
  */
 
-static struct execlist_t *execlist_append(struct execlist_t *execlist, struct execlist_t **head, const char *command, int is_service, struct host_t *host, struct svc_t *svc)
+static struct execlist_t *execlist_append(struct execlist_t *execlist, struct execlist_t **head, GHashTable *commands, const char *command, int is_service, struct host_t *host, struct svc_t *svc)
 {
-	struct execlist_t *new;
+	struct execlist_t *new, *same;
 
 	DEBUG("called");
 
 	new = xmalloc(sizeof *new);
 	new->is_service = is_service;
 	new->next = NULL;
+	new->fanout = NULL;
 
 	DEBUG("command: %s", is_empty(command) ? "NULL" : command);
 
@@ -78,10 +135,22 @@ static struct execlist_t *execlist_append(struct execlist_t *execlist, struct ex
 	if (svc == NULL)
 		DEBUG("svc is NULL");
 
-	new->command = xstrdup(command);
 	new->host = host;
 	new->svc = svc;
 
+	if ((same = execlist_lookup_command(commands, command, host, svc)) != NULL) {
+		DEBUG("same command as %s, fanned out", db_extract_host_name(same->host, same->svc));
+		new->command = NULL;
+		new->fanout = same->fanout;
+		same->fanout = new;
+		return execlist;
+	}
+
+	new->command = xstrdup(command);
+
+	if ((host != NULL || svc != NULL) && new->command != NULL)
+		g_hash_table_insert(commands, new, new);
+
 	if (execlist == NULL) {
 		DEBUG("this is the first item");
 		*head = new;
@@ -112,17 +181,12 @@ static void increase_destroyed_counter(void)
 	pthread_mutex_unlock(&execlist_counter_mutex);
 }
 
-/*
- *     Public methods
- *
- ******************************************************************************/
-
 
 /*
- * build an execlist
+ * build an execlist, COMMANDS holding its items by command
  */
 
-struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sender_address, const char *sender_address, const char *host_address, const char *host_name)
+static struct execlist_t *build(GHashTable *commands, const char *command, int cmd_id, int use_sender_address, const char *sender_address, const char *host_address, const char *host_name)
 {
 	struct execlist_t *execlist_head = NULL, *execlist_current = NULL;
 
@@ -137,7 +201,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 		DEBUG("expanded text: %s", is_empty(expanded_text) ? "NULL" : expanded_text);
 
-		execlist_current = execlist_append(execlist_current, &execlist_head, expanded_text, 0, NULL, NULL);
+		execlist_current = execlist_append(execlist_current, &execlist_head, commands, expanded_text, 0, NULL, NULL);
 
 		free(expanded_text);
 		increase_created_counter();
@@ -165,7 +229,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 			if (strcmp(host_address, db_extract_host_address(host, NULL)) == 0) {
 				DEBUG("host matches!!! :-D");
-				execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(host, NULL), 0, host, NULL);
+				execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(host, NULL), 0, host, NULL);
 			}
 			host = db_lookup_host_by_cmd_id(cmd_id, host, DB_LOOKUP_NEXT_BY_HOST_ADDRESS);
 		}
@@ -177,7 +241,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 			if (strcmp(host_address, db_extract_host_address(NULL, svc)) == 0) {
 				DEBUG("svc matches!!! :-D");
-				execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
+				execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
 			}
 			svc = db_lookup_svc_by_cmd_id(cmd_id, svc, DB_LOOKUP_NEXT_BY_HOST_ADDRESS);
 		}
@@ -202,7 +266,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 			if (strcmp(host_name, db_extract_host_name(host, NULL)) == 0) {
 				DEBUG("host matches!!! :-D");
-				execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(host, NULL), 0, host, NULL);
+				execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(host, NULL), 0, host, NULL);
 			}
 			host = db_lookup_host_by_cmd_id(cmd_id, host, DB_LOOKUP_NEXT_BY_HOST_NAME);
 		}
@@ -214,7 +278,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 			if (strcmp(host_name, db_extract_host_name(NULL, svc)) == 0) {
 				DEBUG("svc matches!!! :-D");
-				execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
+				execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
 			}
 			svc = db_lookup_svc_by_cmd_id(cmd_id, svc, DB_LOOKUP_NEXT_BY_HOST_NAME);
 		}
@@ -243,7 +307,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 				if (strcmp(sender_address, db_extract_host_address(host, NULL)) == 0) {
 					DEBUG("host matches!!! :-D");
-					execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(host, NULL), 0, host, NULL);
+					execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(host, NULL), 0, host, NULL);
 				}
 				host = db_lookup_host_by_cmd_id(cmd_id, host, DB_LOOKUP_NEXT_BY_HOST_ADDRESS);
 			}
@@ -255,7 +319,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 
 				if (strcmp(sender_address, db_extract_host_address(NULL, svc)) == 0) {
 					DEBUG("svc matches!!! :-D");
-					execlist_current = execlist_append(execlist_current, &execlist_head, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
+					execlist_current = execlist_append(execlist_current, &execlist_head, commands, db_extract_expanded_text(NULL, svc), 1, NULL, svc);
 				}
 				svc = db_lookup_svc_by_cmd_id(cmd_id, svc, DB_LOOKUP_NEXT_BY_HOST_ADDRESS);
 			}
@@ -266,7 +330,7 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 			DEBUG("NOT using sender address");
 
 			expanded_text = command_expand_2(db_lookup_expanded_text_by_cmd_id(cmd_id), NULL, sender_address);
-			execlist_current = execlist_append(execlist_current, &execlist_head, expanded_text, -1, NULL, NULL);
+			execlist_current = execlist_append(execlist_current, &execlist_head, commands, expanded_text, -1, NULL, NULL);
 			free(expanded_text);
 		}
 
@@ -278,6 +342,127 @@ struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sende
 }
 
 
+/*
+ * would build() pick the host or service at ADDRESS named NAME?  The same
+ * order of precedence: HOST_ADDRESS, then HOST_NAME, then SENDER_ADDRESS
+ * when USE_SENDER_ADDRESS; all of them if none is given
+ */
+
+static int is_candidate(const char *address, const char *name, int use_sender_address, const char *sender_address, const char *host_address, const char *host_name)
+{
+	if (!is_empty(host_address))
+		return strcmp(host_address, address) == 0;
+
+	if (!is_empty(host_name))
+		return strcmp(host_name, name) == 0;
+
+	if (use_sender_address && !is_empty(sender_address))
+		return strcmp(sender_address, address) == 0;
+
+	return 1;
+}
+
+
+/*
+ * a field with a separator in it would shift the others: the candidate is
+ * left out (and said so once, on the first pass)
+ */
+
+static int has_separator(const char *field, int cmd_id, int pass)
+{
+	if (field[strcspn(field, CANDIDATE_SEPARATORS)] == '\0')
+		return 0;
+
+	if (!pass)
+		log_warning(0, "host or service \"%s\" of command %d has '|' or a newline in its name, not passed to the plugin", field, cmd_id);
+
+	return 1;
+}
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * build an execlist
+ */
+
+struct execlist_t *execlist_build(const char *command, int cmd_id, int use_sender_address, const char *sender_address, const char *host_address, const char *host_name)
+{
+	struct execlist_t *execlist;
+	GHashTable *commands;
+
+	/* hosts and services sharing a command are found at once, not by a scan */
+	commands = g_hash_table_new(command_hash, command_equal);
+	execlist = build(commands, command, cmd_id, use_sender_address, sender_address, host_address, host_name);
+	g_hash_table_destroy(commands);
+
+	return execlist;
+}
+
+
+/*
+ * the hosts and services of command CMD_ID that execlist_build() would
+ * pick with the same arguments, for a v2 plugin, one per line:
+ *
+ *     host_address|host_name|svc_desc
+ *
+ * (svc_desc empty for a host), *LEN bytes long; to be freed.  Those with
+ * '|' or a newline in a field are left out
+ */
+
+char *execlist_candidates(int cmd_id, int use_sender_address, const char *sender_address, const char *host_address, const char *host_name, size_t *len)
+{
+	struct host_t *host;
+	struct svc_t *svc;
+	const char *address, *name, *desc;
+	char *text = NULL, *p = NULL;
+	int pass;
+
+	/* the first pass only counts */
+	for (pass = 0; pass < 2; pass++) {
+		*len = 0;
+
+		for (host = db_lookup_host_by_cmd_id(cmd_id, NULL, 0); host != NULL; host = db_lookup_host_by_cmd_id(cmd_id, host, DB_LOOKUP_NEXT_BY_CMD_ID)) {
+			address = CANDIDATE_FIELD(db_extract_host_address(host, NULL));
+			name = CANDIDATE_FIELD(db_extract_host_name(host, NULL));
+			if (!is_candidate(address, name, use_sender_address, sender_address, host_address, host_name))
+				continue;
+			if (has_separator(address, cmd_id, pass) || has_separator(name, cmd_id, pass))
+				continue;
+			*len += strlen(address) + strlen(name) + 3;
+			if (pass)
+				p += sprintf(p, "%s|%s|\n", address, name);
+		}
+
+		for (svc = db_lookup_svc_by_cmd_id(cmd_id, NULL, 0); svc != NULL; svc = db_lookup_svc_by_cmd_id(cmd_id, svc, DB_LOOKUP_NEXT_BY_CMD_ID)) {
+			address = CANDIDATE_FIELD(db_extract_host_address(NULL, svc));
+			name = CANDIDATE_FIELD(db_extract_host_name(NULL, svc));
+			desc = CANDIDATE_FIELD(db_extract_svc_desc(svc));
+			if (!is_candidate(address, name, use_sender_address, sender_address, host_address, host_name))
+				continue;
+			if (has_separator(address, cmd_id, pass) || has_separator(name, cmd_id, pass) || has_separator(desc, cmd_id, pass))
+				continue;
+			*len += strlen(address) + strlen(name) + strlen(desc) + 3;
+			if (pass)
+				p += sprintf(p, "%s|%s|%s\n", address, name, desc);
+		}
+
+		if (!pass)
+			p = text = xmalloc(*len + 1);
+	}
+
+	*p = '\0';
+
+	DEBUG("%lu bytes of candidates for command %d", (unsigned long) *len, cmd_id);
+
+	return text;
+}
+
+
 struct execlist_t *execlist_getnext(struct execlist_t *execlist_head, struct execlist_t *execlist_current)
 {
 	if (execlist_head == NULL)
@@ -299,6 +484,20 @@ char *execlist_extract_command(struct execlist_t *execlist_current)
 }
 
 
+/*
+ * the next host or service that runs the command of EXECLIST_CURRENT (and
+ * whose own command is NULL), NULL if none
+ */
+
+struct execlist_t *execlist_extract_fanout(struct execlist_t *execlist_current)
+{
+	if (execlist_current == NULL)
+		return NULL;
+
+	return execlist_current->fanout;
+}
+
+
 int execlist_extract_is_service(struct execlist_t *execlist_current, int *is_service)
 {
 	if (execlist_current == NULL)
@@ -329,13 +528,17 @@ struct svc_t *execlist_extract_svc(struct execlist_t *execlist_current)
 
 void execlist_destroy(struct execlist_t *execlist)
 {
-	struct execlist_t *next;
+	struct execlist_t *next, *fanout, *next_fanout;
 
 	if (execlist == NULL)
 		return;
 	
 	while (execlist != NULL) {
 		next = execlist->next;
+		for (fanout = execlist->fanout; fanout != NULL; fanout = next_fanout) {
+			next_fanout = fanout->fanout;
+			free(fanout);
+		}
 		free(execlist->command);
 		free(execlist);
 		execlist = next;
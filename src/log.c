@@ -352,14 +352,14 @@ void log_init(int is_daemon, int verbose)
 		else
 			log_verbosity = LOG_VERBOSITY_WARNING;
 
-		if ((log_error_handler = fopen(config_get_option_value(":error_log"), "a")) == NULL) {
+		if ((log_error_handler = fopen(config_get_option_value(":error_log"), "ae")) == NULL) {
 			perror("cannot open error log for writing");
 			exit(EXIT_FAILURE);
 		}
 
 #ifndef NDEBUG
 		if (log_verbosity == LOG_VERBOSITY_DEBUG
-			&& (log_debug_handler = fopen(config_get_option_value(":debug_log"), "a")) == NULL) {
+			&& (log_debug_handler = fopen(config_get_option_value(":debug_log"), "ae")) == NULL) {
 			perror("cannot open debug log");
 			exit(EXIT_FAILURE);
 		}
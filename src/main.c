@@ -255,15 +255,31 @@ int main(int argc, char **argv)
 	interface_print_debug();
 #endif
 
+	/* fork the plugin launcher while we are still small */
+	if (is_daemon)
+		zygote_init(uid, gid);
+
 	/* open channel */
 	channel_init(is_daemon);
 
 	/* read queries */
 	query_init();
 
+	/* OIDs are interned as handlers are fetched */
+	oid_init();
+
 	/* fetch data from db */
 	db_init(is_daemon);
 
+	/* load trap rules */
+	rule_init();
+
+	/* decode Nagios-to-Nagios traps natively */
+	notify_init();
+
+	/* pick the fastest byte scanner for this CPU */
+	scan_init();
+
 	/* init trap parsing machine */
 	trap_init();
 
@@ -273,6 +289,9 @@ int main(int argc, char **argv)
 	/* init exec subsystem */
 	exec_init();
 
+	/* init native SNMP reception */
+	snmp_init();
+
 
 	/*
 	 * MAIN LOOP
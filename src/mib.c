@@ -0,0 +1,309 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     mib.c --- compiled OID name table
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * The table is compiled from the MIBs by script/generate-oid-table and
+ * read whole, as is: a section of "OID MODULE::descriptor" lines sorted by
+ * OID, an empty line, and a section of "descriptor OID" lines sorted by
+ * descriptor.  Both are binary searched in place; the table is read before
+ * the workers are forked, so its pages are shared by all of them.
+ *
+ * It is not mapped: a mapping of a file rewritten in place (e.g. truncated
+ * by a shell redirection) would raise SIGBUS.  The file is only read at
+ * startup; it should still be replaced by rename(), so that a restart never
+ * catches it half written.
+ *
+ * With the table, symbolic OIDs in handlers and rules are understood
+ * whatever form snmptrapd sends.  Numeric OIDs are translated for plugins
+ * and the trap log only with :oid_name_translation on, when the contents of
+ * a trap are rendered: then snmptrapd need not resolve MIBs at all (-On).
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* the whole file */
+static const char *table = NULL;
+static size_t table_len = 0;
+
+/* by-OID and by-descriptor sections */
+static const char *by_oid = NULL, *by_oid_end = NULL;
+static const char *by_name = NULL, *by_name_end = NULL;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static const char *line_start(const char *lo, const char *p)
+{
+	while (p > lo && p[-1] != '\n')
+		p--;
+
+	return p;
+}
+
+
+static const char *line_end(const char *p, const char *hi)
+{
+	const char *end;
+
+	if ((end = memchr(p, '\n', hi - p)) == NULL)
+		end = hi;
+
+	return end;
+}
+
+
+static const char *next_line(const char *p, const char *hi)
+{
+	const char *end = line_end(p, hi);
+
+	return end < hi ? end + 1 : hi;
+}
+
+
+/*
+ * compare the OID at the start of LINE with ARCS
+ */
+
+static int compare_oid(const char *line, const char *hi, const uint32_t *arcs, size_t narcs)
+{
+	const char *p = line;
+	uint64_t arc;
+	size_t i = 0;
+
+	while (p < hi && *p == '.') {
+		for (p++, arc = 0; p < hi && *p >= '0' && *p <= '9'; p++)
+			arc = arc * 10 + (*p - '0');
+
+		if (i == narcs)
+			return 1;
+		if (arc != arcs[i])
+			return arc < arcs[i] ? -1 : 1;
+		i++;
+	}
+
+	return i < narcs ? -1 : 0;
+}
+
+
+/*
+ * compare the descriptor at the start of LINE with NAME (LEN bytes)
+ */
+
+static int compare_name(const char *line, const char *hi, const char *name, size_t len)
+{
+	size_t word;
+	int res;
+
+	word = scan_any3(line, hi - line, ' ', '\n', '\n');
+
+	if ((res = memcmp(line, name, word < len ? word : len)) != 0)
+		return res;
+
+	return word < len ? -1 : (word > len ? 1 : 0);
+}
+
+
+/*
+ * the line of the by-OID section for exactly ARCS, NULL if there is none
+ */
+
+static const char *find_oid(const uint32_t *arcs, size_t narcs)
+{
+	const char *lo = by_oid, *hi = by_oid_end, *line;
+	int res;
+
+	while (lo < hi) {
+		line = line_start(lo, lo + (hi - lo) / 2);
+		if ((res = compare_oid(line, hi, arcs, narcs)) == 0)
+			return line;
+		if (res < 0)
+			lo = next_line(line, hi);
+		else
+			hi = line;
+	}
+
+	return NULL;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * the numeric OID (*LEN bytes, not zero-terminated) a descriptor stands
+ * for, NULL if unknown
+ */
+
+const char *mib_lookup_descriptor(const char *name, size_t len, size_t *oid_len)
+{
+	const char *lo = by_name, *hi = by_name_end, *line, *oid;
+	int res;
+
+	while (lo < hi) {
+		line = line_start(lo, lo + (hi - lo) / 2);
+		if ((res = compare_name(line, hi, name, len)) == 0) {
+			oid = line + len + 1;
+			*oid_len = line_end(oid, hi) - oid;
+			return oid;
+		}
+		if (res < 0)
+			lo = next_line(line, hi);
+		else
+			hi = line;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * the symbolic form (MODULE::descriptor.suffix) of the OID in ARCS,
+ * allocated from ARENA: the longest prefix found in the table is
+ * translated.  NULL if no prefix is known
+ */
+
+char *mib_translate(struct arena_t *arena, const uint32_t *arcs, size_t narcs)
+{
+	const char *line = NULL, *name, *end;
+	size_t prefix, i, len;
+	char *result, *p;
+
+	if (table == NULL)
+		return NULL;
+
+	for (prefix = narcs; prefix > 0; prefix--) {
+		if ((line = find_oid(arcs, prefix)) != NULL)
+			break;
+	}
+
+	if (line == NULL)
+		return NULL;
+
+	name = line + scan_any3(line, by_oid_end - line, ' ', '\n', '\n') + 1;
+	end = line_end(name, by_oid_end);
+	len = end - name;
+
+	/* up to 10 digits and a dot for each arc left */
+	result = p = arena_alloc(arena, len + (narcs - prefix) * 11 + 1);
+	memcpy(p, name, len);
+	p += len;
+
+	for (i = prefix; i < narcs; i++)
+		p += sprintf(p, ".%u", arcs[i]);
+
+	*p = '\0';
+
+	return result;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void mib_init(void)
+{
+	const char *filename, *p, *end;
+	struct stat st;
+	char *buffer;
+	size_t len;
+	ssize_t n;
+	int fd;
+
+	filename = config_get_option_value(":oid_name_table");
+	if (is_empty(filename)) {
+		DEBUG("no OID name table");
+		return;
+	}
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1) {
+		log_warning(errno, "cannot open OID name table %s: OIDs won't be translated", filename);
+		return;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		log_warning(errno, "cannot use OID name table %s: OIDs won't be translated", filename);
+		close(fd);
+		return;
+	}
+
+	buffer = xmalloc(st.st_size);
+
+	for (len = 0; len < (size_t) st.st_size; len += n) {
+		if ((n = read(fd, buffer + len, st.st_size - len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			break;
+		}
+	}
+
+	/* it shrank under us: whatever was read may end mid-line */
+	if (len < (size_t) st.st_size) {
+		log_warning(n < 0 ? errno : 0, "cannot read OID name table %s: OIDs won't be translated", filename);
+		free(buffer);
+		close(fd);
+		return;
+	}
+
+	close(fd);
+
+	table = buffer;
+	table_len = len;
+	end = table + table_len;
+
+	/* skip comments */
+	for (p = table; p < end && *p == '#'; p = next_line(p, end))
+		;
+
+	by_oid = p;
+	for (by_oid_end = p; by_oid_end < end && *by_oid_end != '\n'; by_oid_end = next_line(by_oid_end, end))
+		;
+
+	by_name = by_oid_end < end ? by_oid_end + 1 : end;
+	by_name_end = end;
+
+	DEBUG("OID name table %s loaded (%d bytes)", filename, (int) table_len);
+}
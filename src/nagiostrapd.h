@@ -12,6 +12,7 @@
 #define _NAGIOSTRAPD_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <pcre.h>
@@ -42,16 +43,40 @@
 
 #define MAX_WORKERS 32
 
-struct stack_t;
-struct stack_item_t;
+struct connection_t;
 struct execlist_t;
 struct trap_t;
+struct trap_parser_t;
 struct pdu_t;
+struct plan_t;
+struct proc_t;
+struct rule_t;
 struct threadpool;
 
 typedef enum { LOG_VERBOSITY_DEBUG, LOG_VERBOSITY_WARNING, LOG_VERBOSITY_ERROR, LOG_VERBOSITY_CRITICAL, LOG_VERBOSITY_NONE } log_verbosity_t;
 
+/* interned object identifier (see oid.c) */
+typedef uint32_t oid_t;
+
 	
+/* arena.c */
+struct arena_t;
+extern struct arena_t *arena_new(void);
+extern void *arena_alloc(struct arena_t *, size_t);
+extern void *arena_realloc(struct arena_t *, void *, size_t, size_t);
+extern char *arena_strndup(struct arena_t *, const char *, size_t);
+extern char *arena_strdup(struct arena_t *, const char *);
+extern void arena_free(struct arena_t *);
+
+/* bulkhead.c */
+struct bulkhead_ticket_t;
+typedef void (*bulkhead_handler_t)(struct pdu_t *);
+extern struct bulkhead_ticket_t *bulkhead_reserve(struct pdu_t *);
+extern void bulkhead_submit(struct bulkhead_ticket_t *, bulkhead_handler_t);
+extern unsigned int bulkhead_get_queued(void);
+extern unsigned long bulkhead_get_overflows(void);
+extern void bulkhead_init(struct threadpool *);
+
 /* channel.c */
 extern void channel_init(int);
 extern void channel_write(unsigned int, const char *, const char *, int, const char *, const char *, int);
@@ -71,20 +96,54 @@ extern void config_load(char *, const char *);
 extern char *config_get_option_value(const char *);
 extern void config_dump(void);
 
+/* connection.c */
+#define CONNECTION_WAIT           0
+#define CONNECTION_DISPATCH       1
+#define CONNECTION_DISPATCH_DONE  2
+#define CONNECTION_DONE           3
+typedef void (*connection_frame_handler_t)(struct connection_t *, struct pdu_t *);
+extern struct connection_t *connection_new(int, int, int);
+extern int connection_read(struct connection_t *);
+extern void connection_process(struct connection_t *, connection_frame_handler_t);
+extern void connection_destroy(struct connection_t *);
+extern int connection_next_timeout(void);
+extern void connection_expire(void);
+extern int connection_get_fd(struct connection_t *);
+extern int connection_is_private(struct connection_t *);
+extern void connection_init(void);
+
+/* coproc.c */
+extern void coproc_init(void);
+extern char *coproc_request(const char *, char **, int, const char *, int, long *);
+
 /* daemon.c */
 extern void daemon_init(uid_t uid, gid_t gid);
 extern unsigned int daemon_get_socket(void);
 extern void daemon_close_socket(void);
+extern int daemon_get_snmp_socket(void);
+extern void daemon_close_snmp_socket(void);
 
 /* db.c */
 #define DB_LOOKUP_NEXT_BY_HOST_NAME     0x1
 #define DB_LOOKUP_NEXT_BY_HOST_ADDRESS  0x2
+#define DB_LOOKUP_NEXT_BY_CMD_ID        0x4
+#define DB_DELIVERY_ARGV   0
+#define DB_DELIVERY_STDIN  1
+#define DB_DELIVERY_MEMFD  2
+#define DB_CONTRACT_V1  0
+#define DB_CONTRACT_V2  1
 extern void db_init(int);
 extern char *db_lookup_resource(const char *);
-extern int db_lookup_cmd_id_by_oid(const char *);
+extern int db_lookup_cmd_id_by_oid(oid_t, const uint32_t *, size_t);
+extern int db_may_handle_oid(oid_t, const uint32_t *, size_t);
 extern struct command_t *db_lookup_command_by_cmd_id(int);
 extern char *db_lookup_filename_by_cmd_id(int);
 extern int db_lookup_use_sender_address_by_cmd_id(int, int *);
+extern int db_lookup_persistent_pool_by_cmd_id(int);
+extern int db_lookup_timeout_by_cmd_id(int);
+extern int db_lookup_max_concurrency_by_cmd_id(int);
+extern int db_lookup_delivery_by_cmd_id(int, const oid_t **, size_t *);
+extern int db_lookup_contract_by_cmd_id(int);
 extern char *db_lookup_expanded_text_by_cmd_id(int);
 extern struct host_t *db_lookup_host_by_cmd_id(int, struct host_t *, int);
 extern struct svc_t *db_lookup_svc_by_cmd_id(int, struct svc_t *, int);
@@ -96,6 +155,8 @@ extern char *db_extract_host_address(struct host_t *, struct svc_t *);
 extern char *db_extract_host_name(struct host_t *, struct svc_t *);
 extern char *db_extract_svc_desc(struct svc_t *);
 extern char *db_extract_expanded_text(struct host_t *, struct svc_t *);
+extern unsigned int db_extract_expanded_hash(struct host_t *, struct svc_t *);
+extern char **db_extract_argv(struct host_t *, struct svc_t *);
 
 /* diagnostics.c */
 extern void diagnostics_init(void);
@@ -118,7 +179,9 @@ extern int exec_trap(struct trap_t *, const char *, const char *);
 extern struct execlist_t *execlist_build(const char *, int, int, const char *, const char *, const char *);
 extern struct execlist_t *execlist_getnext(struct execlist_t *, struct execlist_t *);
 extern void execlist_destroy(struct execlist_t *);
+extern char *execlist_candidates(int, int, const char *, const char *, const char *, size_t *);
 extern char *execlist_extract_command(struct execlist_t *);
+extern struct execlist_t *execlist_extract_fanout(struct execlist_t *);
 extern int execlist_extract_is_service(struct execlist_t *, int *);
 extern struct host_t *execlist_extract_host(struct execlist_t *);
 extern struct svc_t *execlist_extract_svc(struct execlist_t *);
@@ -143,17 +206,61 @@ extern void log_critical(int, const char *, ...);
 extern size_t log_get_log_error_size(void);
 extern size_t log_get_log_debug_size(void);
 
+/* mib.c */
+extern const char *mib_lookup_descriptor(const char *, size_t, size_t *);
+extern char *mib_translate(struct arena_t *, const uint32_t *, size_t);
+extern void mib_init(void);
+
 /* monitor.c */
 extern void monitor_init(void);
 extern void monitor_start_main_loop(void);
 extern void monitor_register_pid(pid_t, int);
 extern void monitor_kill_children(void);
 
+/* notify.c */
+extern void notify_init(void);
+extern int notify_may_handle(oid_t, const uint32_t *, size_t);
+extern int notify_decode(struct trap_t *, char **);
+
+/* oid.c */
+#define OID_NONE 0
+#define OID_MAX_ARCS 128
+struct oid_trie_t;
+extern oid_t oid_intern(const char *, size_t);
+extern oid_t oid_lookup(const char *, size_t);
+extern const uint32_t *oid_get_arcs(oid_t, size_t *);
+extern size_t oid_parse(const char *, size_t, uint32_t *);
+extern struct oid_trie_t *oid_trie_new(void);
+extern int oid_trie_insert(struct oid_trie_t *, const char *, void *);
+extern void *oid_trie_match(struct oid_trie_t *, const uint32_t *, size_t);
+extern int oid_is_snmpTrapOID(oid_t);
+extern void oid_init(void);
+
 /* pidfile.c */
 extern void pidfile_write(void);
 extern pid_t pidfile_read(void);
 extern void pidfile_erase(void);
 
+/* plan.c */
+typedef void (*plan_data_destructor_t)(void *);
+extern struct plan_t *plan_new(plan_data_destructor_t);
+extern int plan_add(struct plan_t *, const char *, void *);
+extern void *plan_next(struct plan_t *);
+extern void plan_charge(struct plan_t *, long);
+extern int plan_time_left(struct plan_t *);
+extern int plan_exhausted(struct plan_t *);
+extern void plan_free(struct plan_t *);
+extern void plan_init(void);
+
+/* proc.c */
+extern void proc_reserve(void);
+extern void proc_release(void);
+extern struct proc_t *proc_watch(pid_t, int, int, int, int, int, const char *, size_t, int);
+extern char *proc_read_line(struct proc_t *);
+extern int proc_finish(struct proc_t *, long *);
+extern int proc_get_timeout(int);
+extern void proc_init(void);
+
 /* query.c */
 extern void query_init(void);
 extern char *query_fetch(const char *);
@@ -163,24 +270,56 @@ extern void query_list(void);
 
 /* regex.c */
 extern pcre* regex_compile(const char *);
-extern int regex_execute(const pcre *, const char *, int *, int);
+extern pcre_extra *regex_study(const pcre *);
+extern int regex_execute(const pcre *, const pcre_extra *, const char *, int *, int);
+
+/* rule.c */
+#define RULE_HOST_ADDRESS  0
+#define RULE_HOST_NAME     1
+#define RULE_SVC_DESC      2
+#define RULE_RET_VALUE     3
+#define RULE_OUTPUT        4
+#define RULE_PERFDATA      5
+#define RULE_FIELDS        6
+extern void rule_init(void);
+extern int rule_may_handle(oid_t, const uint32_t *, size_t);
+extern struct rule_t *rule_lookup(oid_t, const uint32_t *, size_t);
+extern int rule_evaluate(struct rule_t *, struct trap_t *, char **);
+
+/* scan.c */
+extern void scan_init(void);
+extern size_t scan_any3(const char *, size_t, char, char, char);
+
+/* snmp.c */
+#define SNMP_BATCH_SIZE 64
+struct sockaddr_in;
+extern void snmp_init(void);
+extern int snmp_receive_batch(int, struct pdu_t **, int *);
+extern struct pdu_t *snmp_process_datagram(int, const unsigned char *, size_t, const struct sockaddr_in *);
+extern long snmp_get_datagrams(void);
+extern long snmp_get_dropped(void);
+extern long snmp_get_informs(void);
+extern long snmp_get_batches(void);
+extern long snmp_get_kernel_drops(void);
 
 /* socket.c */
-extern unsigned int socket_create(int, int, int);
+extern unsigned int socket_create(int, int, int, int);
+extern unsigned int socket_create_udp(int, int);
 extern unsigned int socket_create_unix(char *);
 extern void socket_set_nonblocking(int);
-extern char *socket_read_pdu(int);
-
-/* stack.c */
-typedef void (*stack_data_destructor_t)(void *);
-extern struct stack_t *stack_init(stack_data_destructor_t destructor);
-extern void stack_free(struct stack_t *);
-extern int stack_get_depth(struct stack_t *);
-extern int stack_push(struct stack_t *, void *);
-extern struct stack_item_t *stack_pop(struct stack_t *);
-extern void *stack_get_data(struct stack_item_t *);
-extern void stack_increment_executions(struct stack_t *);
-extern int stack_count_executions(struct stack_t *);
+extern void socket_force_nonblocking(int);
+extern int socket_send(int, const char *, size_t);
+
+/* spawn.c */
+extern char **spawn_split_args(const char *, int);
+extern pid_t spawn_plugin(char *const *, int, int *);
+extern pid_t spawn_plugin_to(char *const *, int, int);
+extern pid_t spawn_coprocess(char *const *, int *, int *);
+extern int spawn_memfd(const char *, size_t);
+extern int spawn_pidfd(pid_t);
+extern int spawn_signal(int, pid_t, int);
+extern long spawn_cpu_ms(pid_t);
+extern int spawn_wait(pid_t);
 
 /* startup.c */
 extern void startup_set_completed(int);
@@ -196,18 +335,32 @@ extern unsigned int threadpool_get_length_of_tasks_queue(struct threadpool *);
 extern unsigned int threadpool_get_length_of_free_tasks_queue(struct threadpool *);
 
 /* trap.c */
-extern struct pdu_t *trap_pdu_process(char *, int);
+extern struct trap_parser_t *trap_parser_new(int);
+extern void trap_parser_feed(struct trap_parser_t *, const char *, size_t);
+extern struct pdu_t *trap_parser_finish(struct trap_parser_t *);
+extern void trap_parser_free(struct trap_parser_t *);
+extern struct pdu_t *trap_pdu_process(const char *, int);
+extern struct pdu_t *trap_pdu_new_trap(const char *, const char *);
+extern void *trap_pdu_alloc(struct pdu_t *, size_t);
+extern void trap_pdu_add_object(struct pdu_t *, const char *, const char *);
+extern int trap_pdu_finalize(struct pdu_t *);
 extern char *trap_get_sender_address(struct trap_t *);
 extern char *trap_get_hostname(struct trap_t *);
 extern char *trap_get_oid(struct trap_t *);
+extern oid_t trap_get_oid_id(struct trap_t *);
+extern const uint32_t *trap_get_oid_arcs(struct trap_t *, size_t *);
+extern const char *trap_get_value(struct trap_t *, oid_t);
 extern char *trap_get_contents(struct trap_t *);
+extern char *trap_get_varbinds(struct trap_t *, const oid_t *, size_t, size_t *);
 extern unsigned int trap_get_timestamp(struct trap_t *);
 extern void trap_init(void);
 extern char *trap_serialize(struct trap_t *, int, const char *);
 extern void trap_log(struct trap_t *, int);
-extern char *trap_pdu_get_response(struct pdu_t *);
+extern const char *trap_pdu_get_response(struct pdu_t *);
 extern struct trap_t *trap_is_trap(struct pdu_t *);
+extern struct trap_t *trap_pdu_get_unhandled(struct pdu_t *);
 extern long trap_get_trap_parsed(void);
+extern long trap_get_trap_unhandled(void);
 extern void trap_free_pdu(struct pdu_t *);
 extern size_t trap_get_trap_log_size(void);
 
@@ -244,4 +397,8 @@ extern unsigned int worker_get_length_of_tasks_queue(void);
 extern unsigned int worker_get_length_of_free_tasks_queue(void);
 extern int worker_get_id(void);
 
+/* zygote.c */
+extern void zygote_init(uid_t, gid_t);
+extern int zygote_spawn(char *const *, int, int *, pid_t *, int *, int *);
+
 #endif /* _NAGIOSTRAPD_H_ */
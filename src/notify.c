@@ -0,0 +1,256 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     notify.c --- native decoder of Nagios-to-Nagios traps
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * The sHostEvent and sSvcEvent traps of NAGIOS-NOTIFY-MIB, sent by remote
+ * Nagios instances (see notifications/), carry a check result as is: they
+ * are decoded here, with no plugin run, the same way as
+ * plugins/nagios-event-host.awk and nagios-event-service.awk would.  So are
+ * the stock nHostEvent and nSvcEvent, which snmptrapd without the MIBs (or
+ * with -On) passes on numerically, under .1.3.6.1.4.1.20006.1.
+ *
+ * A trap_handler or a rule for one of these OIDs is never run while
+ * :nagios_notify_native is on; that is logged at startup.
+ *
+ * The state is understood either as a label (snmptrapd with the MIBs) or as
+ * a number (snmptrapd -On); host states follow NAGIOS-ROOT-MIB.diff, i.e.
+ * unreachable is 2.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* sHostEvent, sSvcEvent, nHostEvent and nSvcEvent */
+#define NOTIFY_EVENTS     4
+
+/* the varbinds of an event */
+#define NOTIFY_HOSTNAME   0
+#define NOTIFY_SVC_DESC   1
+#define NOTIFY_STATE_ID   2
+#define NOTIFY_OUTPUT     3
+#define NOTIFY_VARBINDS   4
+
+struct notify_event_t {
+	const char *trap_oid;
+	const char *varbinds[NOTIFY_VARBINDS];
+
+	/* states by value */
+	const char *states[4];
+
+	/* the trap OID, numeric if it can be made so, interned otherwise */
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t narcs;
+	oid_t oid_id;
+
+	oid_t varbind_ids[NOTIFY_VARBINDS];
+};
+
+
+static struct notify_event_t events[NOTIFY_EVENTS] = {
+	{
+		"NAGIOS-NOTIFY-MIB::sHostEvent",
+		{ "NAGIOS-NOTIFY-MIB::sHostname", NULL, "NAGIOS-NOTIFY-MIB::sHostStateID", "NAGIOS-NOTIFY-MIB::sHostOutput" },
+		{ "up", "down", "unreachable", NULL },
+		{ 0 }, 0, OID_NONE, { OID_NONE }
+	},
+	{
+		"NAGIOS-NOTIFY-MIB::sSvcEvent",
+		{ "NAGIOS-NOTIFY-MIB::sSvcHostname", "NAGIOS-NOTIFY-MIB::sSvcDesc", "NAGIOS-NOTIFY-MIB::sSvcStateID", "NAGIOS-NOTIFY-MIB::sSvcOutput" },
+		{ "ok", "warning", "critical", "unknown" },
+		{ 0 }, 0, OID_NONE, { OID_NONE }
+	},
+	{
+		/* NAGIOS-NOTIFY-MIB::nHostEvent, nHostname, nHostStateID, nHostOutput */
+		".1.3.6.1.4.1.20006.1.5",
+		{ ".1.3.6.1.4.1.20006.1.1.1.2", NULL, ".1.3.6.1.4.1.20006.1.1.1.4", ".1.3.6.1.4.1.20006.1.1.1.14" },
+		{ "up", "down", "unreachable", NULL },
+		{ 0 }, 0, OID_NONE, { OID_NONE }
+	},
+	{
+		/* NAGIOS-NOTIFY-MIB::nSvcEvent, nSvcHostname, nSvcDesc, nSvcStateID, nSvcOutput */
+		".1.3.6.1.4.1.20006.1.7",
+		{ ".1.3.6.1.4.1.20006.1.2.1.2", ".1.3.6.1.4.1.20006.1.2.1.6", ".1.3.6.1.4.1.20006.1.2.1.7", ".1.3.6.1.4.1.20006.1.2.1.17" },
+		{ "ok", "warning", "critical", "unknown" },
+		{ 0 }, 0, OID_NONE, { OID_NONE }
+	}
+};
+
+
+static int enabled = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static struct notify_event_t *lookup_event(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	struct notify_event_t *event;
+	int i;
+
+	if (!enabled)
+		return NULL;
+
+	for (i = 0; i < NOTIFY_EVENTS; i++) {
+		event = &events[i];
+		if (narcs > 0) {
+			if (event->narcs == narcs && !memcmp(event->arcs, arcs, narcs * sizeof *arcs))
+				return event;
+		} else if (oid != OID_NONE && event->oid_id == oid) {
+			return event;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * the return value for a state: "down", "down(1)" or "1"; UNKNOWN (3) if
+ * it cannot be told
+ */
+
+static int decode_state(struct notify_event_t *event, const char *value)
+{
+	const char *paren;
+	int i;
+
+	if (value == NULL)
+		return 3;
+
+	if (is_integer(value)) {
+		i = atoi(value);
+		return i >= 0 && i <= 3 ? i : 3;
+	}
+
+	if ((paren = strchr(value, '(')) != NULL && is_integer(paren + 1))
+		return decode_state(event, paren + 1);
+
+	for (i = 0; i < 4; i++) {
+		if (event->states[i] != NULL && !strncmp(value, event->states[i], strlen(event->states[i]))
+			&& (value[strlen(event->states[i])] == '\0' || value[strlen(event->states[i])] == '('))
+			return i;
+	}
+
+	return 3;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * cheap pre-check: is the trap OID one of those decoded natively?
+ */
+
+int notify_may_handle(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	return lookup_event(oid, arcs, narcs) != NULL;
+}
+
+
+/*
+ * decode TRAP, if it is a Nagios-to-Nagios one, into FIELDS (RULE_FIELDS
+ * of them, to be freed by the caller); returns 0 if it is not
+ */
+
+int notify_decode(struct trap_t *trap, char **fields)
+{
+	struct notify_event_t *event;
+	const uint32_t *arcs;
+	const char *value;
+	size_t narcs;
+	char state[2];
+
+	memset(fields, 0, RULE_FIELDS * sizeof *fields);
+
+	arcs = trap_get_oid_arcs(trap, &narcs);
+	if ((event = lookup_event(trap_get_oid_id(trap), arcs, narcs)) == NULL)
+		return 0;
+
+	DEBUG("decoding %s natively", event->trap_oid);
+
+	fields[RULE_HOST_NAME] = xstrdup(trap_get_value(trap, event->varbind_ids[NOTIFY_HOSTNAME]));
+	if (event->varbinds[NOTIFY_SVC_DESC] != NULL)
+		fields[RULE_SVC_DESC] = xstrdup(trap_get_value(trap, event->varbind_ids[NOTIFY_SVC_DESC]));
+	fields[RULE_OUTPUT] = xstrdup(trap_get_value(trap, event->varbind_ids[NOTIFY_OUTPUT]));
+
+	value = trap_get_value(trap, event->varbind_ids[NOTIFY_STATE_ID]);
+	state[0] = '0' + decode_state(event, value);
+	state[1] = '\0';
+	fields[RULE_RET_VALUE] = xstrdup(state);
+
+	return 1;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void notify_init(void)
+{
+	struct notify_event_t *event;
+	int i, j;
+
+	if (strcmp(config_get_option_value(":nagios_notify_native"), "true")) {
+		DEBUG("Nagios-to-Nagios traps are left to their handlers");
+		return;
+	}
+
+	for (i = 0; i < NOTIFY_EVENTS; i++) {
+		event = &events[i];
+
+		event->narcs = oid_parse(event->trap_oid, strlen(event->trap_oid), event->arcs);
+		if (event->narcs == 0)
+			event->oid_id = oid_intern(event->trap_oid, strlen(event->trap_oid));
+
+		for (j = 0; j < NOTIFY_VARBINDS; j++) {
+			if (event->varbinds[j] != NULL)
+				event->varbind_ids[j] = oid_intern(event->varbinds[j], strlen(event->varbinds[j]));
+		}
+
+		/* decoding comes first: whatever else is configured is never run */
+		if (db_may_handle_oid(event->oid_id, event->arcs, event->narcs))
+			log_warning(0, "trap_handler for %s overridden by the native decoder (nagios_notify_native = false to run it)", event->trap_oid);
+		if (rule_may_handle(event->oid_id, event->arcs, event->narcs))
+			log_warning(0, "rule for %s overridden by the native decoder (nagios_notify_native = false to run it)", event->trap_oid);
+	}
+
+	enabled = 1;
+
+	DEBUG("Nagios-to-Nagios traps decoded natively");
+}
@@ -0,0 +1,658 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     oid.c --- interned object identifiers
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * snmptrapd prints the same OID in several ways, according to its output
+ * options: ".1.3.6.1.6.3.1.1.4.1.0", ".iso.3.6.1.6.3.1.1.4.1.0",
+ * "SNMPv2-MIB::snmpTrapOID.0", ".iso.org.dod.internet.snmpV2...".  Every
+ * form is parsed into its numeric arcs (descriptors are resolved through a
+ * table of well-known names, then through the compiled MIBs, see mib.c)
+ * and interned: equal OIDs get the same oid_t, so that comparing them is
+ * comparing two integers.
+ *
+ * An OID with a descriptor we don't know cannot be turned into arcs: it is
+ * interned by its text, and only matches the very same text.
+ *
+ * OIDs are interned when the handlers are loaded; received traps only look
+ * theirs up, so that the table cannot be grown from the network.
+ *
+ * An OID trie maps OID patterns to values (e.g. trap handlers): a pattern
+ * is an OID where "*" stands for any one arc, and a trailing "*" for any
+ * (non-empty) sequence of arcs.  Matching returns the most specific
+ * pattern: longest prefix first, literal arcs before wildcards.  Its cost
+ * depends on the depth of the OID and on the patterns sharing its prefix,
+ * not on the number of patterns.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* initial slots of the hash table (a power of two) */
+#define OID_TABLE_MIN_SIZE 256
+
+
+struct oid_entry_t {
+	uint32_t hash;
+
+	/* numeric OID... */
+	size_t narcs;
+	uint32_t *arcs;
+
+	/* ...or text of an unresolvable one */
+	char *symbol;
+};
+
+
+/* OID trie node: children are sorted by arc */
+struct oid_trie_t {
+	uint32_t arc;
+
+	/* values of the OID ending here, and of anything below it ("*") */
+	void *exact;
+	void *subtree;
+
+	struct oid_trie_t **children;
+	size_t children_count;
+
+	/* "*" in the middle of a pattern */
+	struct oid_trie_t *any;
+};
+
+
+/* a node reached by trie_match(), and what it yields */
+struct trie_step_t {
+	struct oid_trie_t *node;
+	size_t parent;
+	void *value;
+};
+
+/* steps of trie_match() kept on the stack */
+#define TRIE_MATCH_STEPS 64
+
+
+/* a descriptor and the numeric OID it stands for */
+struct oid_descriptor_t {
+	const char *name;
+	const char *oid;
+};
+
+
+static const struct oid_descriptor_t descriptors[] = {
+	{ "iso", "1" },
+	{ "org", "1.3" },
+	{ "dod", "1.3.6" },
+	{ "internet", "1.3.6.1" },
+	{ "directory", "1.3.6.1.1" },
+	{ "mgmt", "1.3.6.1.2" },
+	{ "mib-2", "1.3.6.1.2.1" },
+	{ "system", "1.3.6.1.2.1.1" },
+	{ "sysUpTime", "1.3.6.1.2.1.1.3" },
+	{ "sysUpTimeInstance", "1.3.6.1.2.1.1.3.0" },
+	{ "experimental", "1.3.6.1.3" },
+	{ "private", "1.3.6.1.4" },
+	{ "enterprises", "1.3.6.1.4.1" },
+	{ "nagios", "1.3.6.1.4.1.20006" },
+	{ "nagiosNotify", "1.3.6.1.4.1.20006.1" },
+	{ "security", "1.3.6.1.5" },
+	{ "snmpV2", "1.3.6.1.6" },
+	{ "snmpModules", "1.3.6.1.6.3" },
+	{ "snmpMIB", "1.3.6.1.6.3.1" },
+	{ "snmpMIBObjects", "1.3.6.1.6.3.1.1" },
+	{ "snmpTrap", "1.3.6.1.6.3.1.1.4" },
+	{ "snmpTrapOID", "1.3.6.1.6.3.1.1.4.1" },
+	{ "snmpTrapEnterprise", "1.3.6.1.6.3.1.1.4.3" },
+	{ "snmpTraps", "1.3.6.1.6.3.1.1.5" },
+	{ "coldStart", "1.3.6.1.6.3.1.1.5.1" },
+	{ "warmStart", "1.3.6.1.6.3.1.1.5.2" },
+	{ "linkDown", "1.3.6.1.6.3.1.1.5.3" },
+	{ "linkUp", "1.3.6.1.6.3.1.1.5.4" },
+	{ "authenticationFailure", "1.3.6.1.6.3.1.1.5.5" },
+	{ "snmpCommunityMIB", "1.3.6.1.6.3.18" },
+	{ "snmpTrapAddress", "1.3.6.1.6.3.18.1.3" },
+	{ "snmpTrapCommunity", "1.3.6.1.6.3.18.1.4" },
+	{ NULL, NULL }
+};
+
+
+/* interned OIDs (entry 0 is OID_NONE) and hash table thereof */
+static struct oid_entry_t *entries = NULL;
+static size_t entries_count = 0, entries_size = 0;
+
+static oid_t *table = NULL;
+static size_t table_mask = 0;
+
+static pthread_rwlock_t oid_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* snmpTrapOID.0, which every trap carries */
+static oid_t oid_snmpTrapOID = OID_NONE;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static uint32_t hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+
+static int append_arcs(const char *s, size_t len, uint32_t *arcs, int *wild, size_t *narcs);
+
+
+static int resolve_descriptor(const char *name, size_t len, uint32_t *arcs, int *wild, size_t *narcs)
+{
+	const struct oid_descriptor_t *d;
+
+	const char *oid;
+	size_t oid_len;
+
+	for (d = descriptors; d->name != NULL; d++) {
+		if (strlen(d->name) == len && memcmp(d->name, name, len) == 0) {
+			*narcs = 0;
+			return append_arcs(d->oid, strlen(d->oid), arcs, wild, narcs);
+		}
+	}
+
+	/* the compiled MIBs, if any */
+	if ((oid = mib_lookup_descriptor(name, len, &oid_len)) != NULL) {
+		*narcs = 0;
+		return append_arcs(oid, oid_len, arcs, wild, narcs);
+	}
+
+	return 0;
+}
+
+
+/*
+ * append the arcs of S to ARCS; a descriptor replaces the arcs read so far
+ * with the OID it stands for.  "*" arcs are allowed (and flagged in WILD)
+ * only for patterns.  Returns 0 if S cannot be made numeric
+ */
+
+static int append_arcs(const char *s, size_t len, uint32_t *arcs, int *wild, size_t *narcs)
+{
+	const char *end = s + len, *next;
+	uint64_t arc;
+
+	if (s < end && *s == '.')
+		s++;
+
+	while (s < end) {
+		if ((next = memchr(s, '.', end - s)) == NULL)
+			next = end;
+
+		if (next == s || *narcs == OID_MAX_ARCS)
+			return 0;
+
+		if (*s >= '0' && *s <= '9') {
+			for (arc = 0; s < next; s++) {
+				if (*s < '0' || *s > '9' || (arc = arc * 10 + (*s - '0')) > UINT32_MAX)
+					return 0;
+			}
+			if (wild != NULL)
+				wild[*narcs] = 0;
+			arcs[(*narcs)++] = (uint32_t) arc;
+		} else if (*s == '*' && next == s + 1 && wild != NULL) {
+			wild[*narcs] = 1;
+			arcs[(*narcs)++] = 0;
+		} else if (!resolve_descriptor(s, next - s, arcs, wild, narcs)) {
+			return 0;
+		}
+
+		s = next < end ? next + 1 : end;
+	}
+
+	return *narcs > 0;
+}
+
+
+/*
+ * parse S (LEN bytes) into ARCS; returns 0 if it is not numeric (and
+ * cannot be made so)
+ */
+
+static int parse(const char *s, size_t len, uint32_t *arcs, int *wild, size_t *narcs)
+{
+	const char *module;
+
+	*narcs = 0;
+
+	/* MODULE::descriptor.suffix: descriptors are looked up by name only */
+	for (module = s; module + 1 < s + len; module++) {
+		if (module[0] == ':' && module[1] == ':') {
+			len -= module + 2 - s;
+			s = module + 2;
+			break;
+		}
+	}
+
+	return append_arcs(s, len, arcs, wild, narcs);
+}
+
+
+static int entry_matches(const struct oid_entry_t *entry, uint32_t hash, const uint32_t *arcs, size_t narcs, const char *symbol, size_t len)
+{
+	if (entry->hash != hash)
+		return 0;
+
+	if (symbol != NULL)
+		return entry->symbol != NULL && strlen(entry->symbol) == len && memcmp(entry->symbol, symbol, len) == 0;
+
+	return entry->symbol == NULL && entry->narcs == narcs && memcmp(entry->arcs, arcs, narcs * sizeof *arcs) == 0;
+}
+
+
+/*
+ * slot of the table where the OID is (or would be); caller holds the lock
+ */
+
+static size_t find_slot(uint32_t hash, const uint32_t *arcs, size_t narcs, const char *symbol, size_t len)
+{
+	size_t slot;
+
+	for (slot = hash & table_mask; table[slot] != OID_NONE; slot = (slot + 1) & table_mask) {
+		if (entry_matches(&entries[table[slot]], hash, arcs, narcs, symbol, len))
+			break;
+	}
+
+	return slot;
+}
+
+
+static void grow_table(void)
+{
+	size_t size = (table_mask + 1) * 2, slot;
+	oid_t id;
+
+	free(table);
+	table = xcalloc(size, sizeof *table);
+	table_mask = size - 1;
+
+	for (id = 1; id < entries_count; id++) {
+		for (slot = entries[id].hash & table_mask; table[slot] != OID_NONE; slot = (slot + 1) & table_mask)
+			;
+		table[slot] = id;
+	}
+}
+
+
+static oid_t find(const char *s, size_t len, int create)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t narcs, slot;
+	const char *symbol = NULL;
+	struct oid_entry_t *entry;
+	uint32_t hash;
+	oid_t id;
+
+	if (s == NULL || len == 0)
+		return OID_NONE;
+
+	if (parse(s, len, arcs, NULL, &narcs)) {
+		hash = hash_bytes(arcs, narcs * sizeof *arcs);
+	} else {
+		symbol = s;
+		hash = hash_bytes(s, len);
+	}
+
+	pthread_rwlock_rdlock(&oid_lock);
+	id = table[find_slot(hash, arcs, narcs, symbol, len)];
+	pthread_rwlock_unlock(&oid_lock);
+
+	if (id != OID_NONE || !create)
+		return id;
+
+	pthread_rwlock_wrlock(&oid_lock);
+
+	/* someone may have been quicker */
+	slot = find_slot(hash, arcs, narcs, symbol, len);
+	if ((id = table[slot]) != OID_NONE) {
+		pthread_rwlock_unlock(&oid_lock);
+		return id;
+	}
+
+	if (entries_count == entries_size) {
+		entries_size *= 2;
+		entries = xrealloc(entries, entries_size * sizeof *entries);
+	}
+
+	id = entries_count++;
+	entry = &entries[id];
+	entry->hash = hash;
+	if (symbol != NULL) {
+		entry->narcs = 0;
+		entry->arcs = NULL;
+		entry->symbol = xmalloc(len + 1);
+		memcpy(entry->symbol, symbol, len);
+		entry->symbol[len] = '\0';
+		DEBUG("interned symbolic OID %s as %u", entry->symbol, id);
+	} else {
+		entry->narcs = narcs;
+		entry->arcs = xmalloc(narcs * sizeof *arcs);
+		memcpy(entry->arcs, arcs, narcs * sizeof *arcs);
+		entry->symbol = NULL;
+		DEBUG("interned OID %.*s as %u", (int) len, s, id);
+	}
+	table[slot] = id;
+
+	/* keep the load factor under 1/2 */
+	if (entries_count * 2 > table_mask + 1)
+		grow_table();
+
+	pthread_rwlock_unlock(&oid_lock);
+
+	return id;
+}
+
+
+
+static struct oid_trie_t *trie_node_new(uint32_t arc)
+{
+	struct oid_trie_t *node;
+
+	node = xcalloc(1, sizeof *node);
+	node->arc = arc;
+
+	return node;
+}
+
+
+/*
+ * index of the child for ARC in NODE, or where it would be inserted
+ */
+
+static size_t trie_child_index(const struct oid_trie_t *node, uint32_t arc)
+{
+	size_t lo = 0, hi = node->children_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (node->children[mid]->arc < arc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+static struct oid_trie_t *trie_child(struct oid_trie_t *node, uint32_t arc, int create)
+{
+	size_t i;
+
+	i = trie_child_index(node, arc);
+	if (i < node->children_count && node->children[i]->arc == arc)
+		return node->children[i];
+
+	if (!create)
+		return NULL;
+
+	node->children = xrealloc(node->children, (node->children_count + 1) * sizeof *node->children);
+	memmove(node->children + i + 1, node->children + i, (node->children_count - i) * sizeof *node->children);
+	node->children[i] = trie_node_new(arc);
+	node->children_count++;
+
+	return node->children[i];
+}
+
+
+/*
+ * a walk level by level, in the order a depth-first search would take
+ * (literal arc before "*"): every node matching a prefix of ARCS is
+ * visited once, and the first one to yield a value, children before the
+ * node itself, wins; there is no backtracking nor recursion, and the cost
+ * is bounded by the nodes matching a prefix however many "*" there are
+ */
+
+static void *trie_match(struct oid_trie_t *root, const uint32_t *arcs, size_t narcs)
+{
+	struct trie_step_t buffer[TRIE_MATCH_STEPS], *steps = buffer;
+	struct oid_trie_t *child;
+	size_t size = TRIE_MATCH_STEPS, count = 1, first = 0, last = 1, depth, i;
+	void *value;
+
+	steps[0].node = root;
+
+	/* forward: the nodes at each depth, children of a node next to each other */
+	for (depth = 0; depth < narcs && first < last; depth++) {
+		for (i = first; i < last; i++) {
+			if (count + 2 > size) {
+				size *= 2;
+				if (steps == buffer) {
+					steps = xmalloc(size * sizeof *steps);
+					memcpy(steps, buffer, sizeof buffer);
+				} else {
+					steps = xrealloc(steps, size * sizeof *steps);
+				}
+			}
+
+			if ((child = trie_child(steps[i].node, arcs[depth], 0)) != NULL) {
+				steps[count].node = child;
+				steps[count++].parent = i;
+			}
+			if ((child = steps[i].node->any) != NULL) {
+				steps[count].node = child;
+				steps[count++].parent = i;
+			}
+		}
+
+		first = last;
+		last = count;
+	}
+
+	for (i = 0; i < count; i++)
+		steps[i].value = NULL;
+
+	/*
+	 * backward: a node yields the value of its first child that has one,
+	 * else its own; a whole OID only takes an exact match, a prefix of it
+	 * a subtree one
+	 */
+	for (i = count; i-- > 0;) {
+		if (steps[i].value == NULL)
+			steps[i].value = (depth == narcs && i >= first) ? steps[i].node->exact : steps[i].node->subtree;
+		if (i > 0 && steps[i].value != NULL)
+			steps[steps[i].parent].value = steps[i].value;
+	}
+
+	value = steps[0].value;
+
+	if (steps != buffer)
+		free(steps);
+
+	return value;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * the interned OID for S (LEN bytes, need not be zero-terminated), which is
+ * created if needed
+ */
+
+oid_t oid_intern(const char *s, size_t len)
+{
+	return find(s, len, 1);
+}
+
+
+/*
+ * the interned OID for S, or OID_NONE if it was never interned
+ */
+
+oid_t oid_lookup(const char *s, size_t len)
+{
+	return find(s, len, 0);
+}
+
+
+/*
+ * the numeric arcs of OID (NULL if it is symbolic)
+ */
+
+const uint32_t *oid_get_arcs(oid_t oid, size_t *narcs)
+{
+	const uint32_t *arcs;
+
+	pthread_rwlock_rdlock(&oid_lock);
+	if (oid == OID_NONE || oid >= entries_count) {
+		*narcs = 0;
+		arcs = NULL;
+	} else {
+		*narcs = entries[oid].narcs;
+		arcs = entries[oid].arcs;
+	}
+	pthread_rwlock_unlock(&oid_lock);
+
+	return arcs;
+}
+
+
+/*
+ * parse S (LEN bytes) into ARCS (OID_MAX_ARCS long), without interning it;
+ * returns the number of arcs, 0 if S is not numeric (and cannot be made so)
+ */
+
+size_t oid_parse(const char *s, size_t len, uint32_t *arcs)
+{
+	size_t narcs;
+
+	if (s == NULL || len == 0 || !parse(s, len, arcs, NULL, &narcs))
+		return 0;
+
+	return narcs;
+}
+
+
+struct oid_trie_t *oid_trie_new(void)
+{
+	return trie_node_new(0);
+}
+
+
+/*
+ * map PATTERN to VALUE in TRIE (an existing mapping is replaced); returns
+ * 0 if PATTERN is not numeric
+ */
+
+int oid_trie_insert(struct oid_trie_t *trie, const char *pattern, void *value)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	int wild[OID_MAX_ARCS];
+	struct oid_trie_t *node = trie;
+	size_t narcs, i;
+	int subtree;
+
+	if (is_empty(pattern) || !parse(pattern, strlen(pattern), arcs, wild, &narcs))
+		return 0;
+
+	/* a trailing "*" covers the whole subtree */
+	if ((subtree = wild[narcs - 1]) != 0 && --narcs == 0)
+		return 0;
+
+	for (i = 0; i < narcs; i++) {
+		if (wild[i]) {
+			if (node->any == NULL)
+				node->any = trie_node_new(0);
+			node = node->any;
+		} else {
+			node = trie_child(node, arcs[i], 1);
+		}
+	}
+
+	if (subtree)
+		node->subtree = value;
+	else
+		node->exact = value;
+
+	return 1;
+}
+
+
+/*
+ * the value of the most specific pattern matching the OID in ARCS, NULL if
+ * none does
+ */
+
+void *oid_trie_match(struct oid_trie_t *trie, const uint32_t *arcs, size_t narcs)
+{
+	if (trie == NULL || arcs == NULL || narcs == 0)
+		return NULL;
+
+	return trie_match(trie, arcs, narcs);
+}
+
+
+int oid_is_snmpTrapOID(oid_t oid)
+{
+	return oid != OID_NONE && oid == oid_snmpTrapOID;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void oid_init(void)
+{
+	/* descriptors of the handlers' OIDs are resolved through it */
+	mib_init();
+
+	entries_size = OID_TABLE_MIN_SIZE;
+	entries = xmalloc(entries_size * sizeof *entries);
+	entries_count = 1;
+	memset(&entries[OID_NONE], 0, sizeof *entries);
+
+	table = xcalloc(OID_TABLE_MIN_SIZE, sizeof *table);
+	table_mask = OID_TABLE_MIN_SIZE - 1;
+
+	oid_snmpTrapOID = oid_intern(".1.3.6.1.6.3.1.1.4.1.0", strlen(".1.3.6.1.6.3.1.1.4.1.0"));
+}
@@ -76,7 +76,7 @@ void pidfile_write(void)
 
 	get_pidfile();
 
-	if ((pidfile = fopen(pidfile_path, "w")) == NULL)
+	if ((pidfile = fopen(pidfile_path, "we")) == NULL)
 		log_critical(errno, "cannot open pid file");
 
 	if (fprintf(pidfile, "%d\n", mypid) < 0)
@@ -102,7 +102,7 @@ pid_t pidfile_read(void)
 
 	get_pidfile();
 
-	if ((pidfile = fopen(pidfile_path, "r")) == NULL) {
+	if ((pidfile = fopen(pidfile_path, "re")) == NULL) {
 		fprintf(stderr, "cannot open pidfile %s: %s\n", pidfile_path, strerror(errno));
 		fprintf(stderr, "maybe the daemon is not running!\n");
 		exit(EXIT_FAILURE);
@@ -0,0 +1,285 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     plan.c --- what is left to run for a trap
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A plan holds the runs a trap leads to, the first ones and those its
+ * plugins' output adds, each under a key saying what it is: a run already
+ * planned for the trap is not planned again (if the run that asks for it
+ * descends from it, the plugins go round in circles, and that is logged).
+ * Runs come out last in, first out.  Once the trap has taken
+ * :trap_time_budget seconds, or :trap_cpu_budget seconds of CPU between
+ * the worker thread and its plugins (persistent handlers included), no
+ * more runs come out; and no run may take longer than the time left.
+ *
+ * Everything the plan was given is freed along with it.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+struct plan_item_t {
+	char *key;
+	void *data;
+
+	/* the run whose output planned this one, NULL for the first ones */
+	struct plan_item_t *parent;
+
+	struct plan_item_t *next_todo;
+	struct plan_item_t *next;
+};
+
+
+struct plan_t {
+	plan_data_destructor_t destructor;
+
+	/* items by key; those left to run; all of them */
+	GHashTable *planned;
+	struct plan_item_t *todo;
+	struct plan_item_t *items;
+
+	/* the one running */
+	struct plan_item_t *current;
+
+	/* when it started; the worker's CPU then (ms); plugins' CPU (ms) */
+	time_t started;
+	long started_cpu;
+	long plugins_cpu;
+
+	int runs;
+	int exhausted;
+};
+
+
+/* seconds, 0 for no limit */
+static int time_budget = 0;
+static int cpu_budget = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static time_t monotonic_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+
+/*
+ * CPU time of the calling thread, in milliseconds
+ */
+
+static long thread_cpu(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * has PLAN used up its budget?  Logged once
+ */
+
+static int over_budget(struct plan_t *plan)
+{
+	time_t elapsed;
+	long cpu;
+
+	if (plan->exhausted)
+		return 1;
+
+	elapsed = monotonic_now() - plan->started;
+	cpu = thread_cpu() - plan->started_cpu + plan->plugins_cpu;
+
+	if (time_budget > 0 && elapsed >= time_budget)
+		log_warning(0, "trap took %ld seconds in %d runs, dropping the rest", (long) elapsed, plan->runs);
+	else if (cpu_budget > 0 && cpu >= cpu_budget * 1000L)
+		log_warning(0, "trap took %ld ms of CPU in %d runs, dropping the rest", cpu, plan->runs);
+	else
+		return 0;
+
+	plan->exhausted = 1;
+
+	return 1;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+struct plan_t *plan_new(plan_data_destructor_t destructor)
+{
+	struct plan_t *plan;
+
+	plan = xcalloc(1, sizeof *plan);
+	plan->destructor = destructor;
+	plan->planned = g_hash_table_new(g_str_hash, g_str_equal);
+	plan->started = monotonic_now();
+	plan->started_cpu = thread_cpu();
+
+	return plan;
+}
+
+
+/*
+ * plan a run of DATA (which goes to PLAN in any case), known as KEY;
+ * returns 0 if it was planned already
+ */
+
+int plan_add(struct plan_t *plan, const char *key, void *data)
+{
+	struct plan_item_t *item, *ancestor;
+
+	if ((item = g_hash_table_lookup(plan->planned, key)) != NULL) {
+		for (ancestor = plan->current; ancestor != NULL && ancestor != item; ancestor = ancestor->parent)
+			;
+		if (ancestor != NULL)
+			log_warning(0, "plugin output leads back to %s, not run again", key);
+		else
+			DEBUG("%s planned already", key);
+
+		plan->destructor(data);
+		return 0;
+	}
+
+	item = xmalloc(sizeof *item);
+	item->key = xstrdup(key);
+	item->data = data;
+	item->parent = plan->current;
+
+	item->next_todo = plan->todo;
+	plan->todo = item;
+	item->next = plan->items;
+	plan->items = item;
+
+	g_hash_table_insert(plan->planned, item->key, item);
+
+	return 1;
+}
+
+
+/*
+ * the data of the next run, NULL if there is none, or no budget left for
+ * it (see plan_exhausted())
+ */
+
+void *plan_next(struct plan_t *plan)
+{
+	struct plan_item_t *item;
+
+	if ((item = plan->todo) == NULL || over_budget(plan))
+		return NULL;
+
+	plan->todo = item->next_todo;
+	plan->current = item;
+	plan->runs++;
+
+	return item->data;
+}
+
+
+/*
+ * add the CPU_MS milliseconds a plugin of PLAN took
+ */
+
+void plan_charge(struct plan_t *plan, long cpu_ms)
+{
+	plan->plugins_cpu += cpu_ms;
+}
+
+
+/*
+ * seconds left to PLAN (at least 1), -1 if there is no limit: what the
+ * next run may take at most
+ */
+
+int plan_time_left(struct plan_t *plan)
+{
+	time_t left;
+
+	if (time_budget <= 0)
+		return -1;
+
+	left = plan->started + time_budget - monotonic_now();
+
+	return left > 0 ? (int) left : 1;
+}
+
+
+int plan_exhausted(struct plan_t *plan)
+{
+	return plan->exhausted;
+}
+
+
+void plan_free(struct plan_t *plan)
+{
+	struct plan_item_t *item, *next;
+
+	if (plan == NULL)
+		return;
+
+	for (item = plan->items; item != NULL; item = next) {
+		next = item->next;
+		plan->destructor(item->data);
+		free(item->key);
+		free(item);
+	}
+
+	g_hash_table_destroy(plan->planned);
+	free(plan);
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void plan_init(void)
+{
+	time_budget = atoi(config_get_option_value(":trap_time_budget"));
+	cpu_budget = atoi(config_get_option_value(":trap_cpu_budget"));
+}
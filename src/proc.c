@@ -0,0 +1,753 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     proc.c --- plugin supervision
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * Plugins are watched by a single reactor thread per worker: their output
+ * is drained from non-blocking pipes, and their exit is noticed through a
+ * pidfd, with epoll; the trap, for those that read it on their standard
+ * input, is fed to them the same way.  The thread that ran a plugin takes
+ * the output a line at a time, as it comes, from a buffer of PROC_BUFFER
+ * bytes: when it's full, the plugin is not read from until the thread
+ * catches up (a longer line is cut there).  Beyond :plugin_max_output
+ * bytes, the output is read, but dropped.
+ *
+ * A plugin still running at its deadline gets SIGTERM, then SIGKILL
+ * PROC_GRACE seconds later; PROC_GRACE seconds after that its output is
+ * given up on (a grandchild may still hold the pipe).  Signals go through
+ * the plugin's pidfd when there is one: the zygote reaps its plugins, and
+ * their pid may have been reused by then.  The zygote tells the CPU time
+ * they took when it does, and a plugin is not over before it has.  No more
+ * than :plugins_max_children plugins run at once in a worker.
+ *
+ * The thread that ran a plugin still waits for it, so a worker runs no more
+ * plugins at once than it has pool threads: what the reactor spares is the
+ * blocking reads, and a hung plugin holds its thread only until its
+ * deadline.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* seconds between SIGTERM, SIGKILL and giving up */
+#define PROC_GRACE 2
+
+/* output not taken yet (and longest line) */
+#define PROC_BUFFER 65536
+
+/* milliseconds between checks for a child not reaped yet, without pidfd */
+#define PROC_REAP_INTERVAL 100
+
+#define PROC_MAX_EVENTS 64
+
+
+
+/* what a watched fd is */
+#define PROC_WATCH_OUTPUT 0
+#define PROC_WATCH_PIDFD  1
+#define PROC_WATCH_INPUT  2
+#define PROC_WATCH_REPORT 3
+
+struct proc_watch_t {
+	struct proc_t *proc;
+	int what;
+};
+
+
+struct proc_t {
+	pid_t pid;
+
+	/* our child (to be reaped), or the zygote's */
+	int is_child;
+
+	/* stdout, and the pidfd if the kernel has them (-1 when closed) */
+	int fd;
+	int pidfd;
+	struct proc_watch_t fd_watch, pidfd_watch;
+
+	/* where the zygote tells its CPU time, until it has (-1 when closed) */
+	int report;
+	struct proc_watch_t report_watch;
+
+	/* stdin, while there is INPUT left to write to it */
+	int in;
+	const char *input;
+	size_t input_len;
+	struct proc_watch_t in_watch;
+
+	/* output not taken yet is from START to LEN, out of TOTAL bytes read */
+	char *output;
+	size_t start, len, total;
+
+	/* not read from until taken; not kept any more; in a line too long */
+	int paused;
+	int discard;
+	int skip_line;
+
+	int eof;
+	int exited;
+
+	/* CPU time it took (ms), if we or the zygote reaped it */
+	long cpu_ms;
+
+	/* 0 when there is none; then, how far we went in killing it */
+	time_t deadline;
+	int kill_stage;
+
+	/* the waiting thread has its answer, and has taken it */
+	int done;
+	int collected;
+	int timed_out;
+	pthread_cond_t cond;
+
+	struct proc_t *next;
+};
+
+
+static pthread_mutex_t proc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* plugins watched by the reactor */
+static struct proc_t *procs = NULL;
+
+/* the reactor, started by the first plugin of the process */
+static pthread_once_t reactor_once = PTHREAD_ONCE_INIT;
+static int epfd = -1;
+static int wakeup_fd = -1;
+
+/* bounded concurrency */
+static pthread_cond_t slot_cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+static int max_children = 0;
+
+/* default timeout (seconds, 0 for none) */
+static int default_timeout = 0;
+
+/* bytes of output kept per plugin */
+static size_t max_output = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static void unwatch(int *fd)
+{
+	if (*fd == -1)
+		return;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, *fd, NULL);
+	close(*fd);
+	*fd = -1;
+}
+
+
+/*
+ * stop (or go back to) reading the output of PROC; out of the epoll set
+ * altogether, as a hangup would be reported anyway
+ */
+
+static void set_paused(struct proc_t *proc, int paused)
+{
+	struct epoll_event ev;
+
+	if (proc->paused == paused || proc->fd == -1)
+		return;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &proc->fd_watch;
+	epoll_ctl(epfd, paused ? EPOLL_CTL_DEL : EPOLL_CTL_ADD, proc->fd, &ev);
+
+	proc->paused = paused;
+}
+
+
+/*
+ * drain the output of PROC (up to EOF, until the pipe is empty, or until
+ * the buffer is full)
+ */
+
+static void drain(struct proc_t *proc)
+{
+	char scratch[4096];
+	ssize_t res;
+	size_t keep;
+
+	while (1) {
+		if (proc->start > 0) {
+			memmove(proc->output, proc->output + proc->start, proc->len - proc->start);
+			proc->len -= proc->start;
+			proc->start = 0;
+		}
+
+		if (proc->len == PROC_BUFFER && !proc->discard) {
+			set_paused(proc, 1);
+			return;
+		}
+
+		if (proc->discard)
+			res = read(proc->fd, scratch, sizeof scratch);
+		else
+			res = read(proc->fd, proc->output + proc->len, PROC_BUFFER - proc->len);
+
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			log_error(errno, "cannot read output of pid %d", (int) proc->pid);
+			res = 0;
+		}
+
+		if (res == 0) {
+			proc->eof = 1;
+			unwatch(&proc->fd);
+			pthread_cond_signal(&proc->cond);
+			return;
+		}
+
+		if (proc->discard)
+			continue;
+
+		/* past the limit, it only counts */
+		keep = res;
+		if (max_output > 0) {
+			keep = proc->total < max_output ? max_output - proc->total : 0;
+			if (keep > (size_t) res)
+				keep = res;
+			if (proc->total <= max_output && proc->total + res > max_output)
+				log_warning(0, "output of pid %d over %lu bytes, dropping the rest", (int) proc->pid, (unsigned long) max_output);
+		}
+		proc->total += res;
+		proc->len += keep;
+
+		if (keep > 0)
+			pthread_cond_signal(&proc->cond);
+	}
+}
+
+
+/*
+ * write to PROC as much of its input as its pipe takes
+ */
+
+static void feed(struct proc_t *proc)
+{
+	ssize_t res;
+
+	while (proc->input_len > 0) {
+		if ((res = write(proc->in, proc->input, proc->input_len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			/* EPIPE: it doesn't want the rest */
+			DEBUG("cannot write to pid %d: %s", (int) proc->pid, strerror(errno));
+			break;
+		}
+		proc->input += res;
+		proc->input_len -= res;
+	}
+
+	unwatch(&proc->in);
+}
+
+
+/*
+ * the zygote reaped PROC, and says how much CPU it took (or went away)
+ */
+
+static void read_report(struct proc_t *proc)
+{
+	long cpu_ms;
+	ssize_t res;
+
+	while ((res = recv(proc->report, &cpu_ms, sizeof cpu_ms, MSG_DONTWAIT)) == -1 && errno == EINTR)
+		;
+
+	if (res == -1 && errno == EAGAIN)
+		return;
+
+	if (res == sizeof cpu_ms)
+		proc->cpu_ms = cpu_ms;
+
+	unwatch(&proc->report);
+}
+
+
+/*
+ * has PROC exited (HAS_EXITED: its pidfd says so)?  Our children are reaped
+ * here
+ */
+
+static void check_exit(struct proc_t *proc, int has_exited)
+{
+	struct rusage usage;
+	pid_t pid;
+	int status;
+
+	if (proc->exited)
+		return;
+
+	if (proc->pid <= 0) {
+		proc->exited = 1;
+	} else if (proc->is_child) {
+		/* -1: reaped by someone else, and USAGE says nothing */
+		if ((pid = wait4(proc->pid, &status, WNOHANG, &usage)) != 0) {
+			proc->exited = 1;
+			if (pid == proc->pid)
+				proc->cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000L + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+			else
+				proc->cpu_ms = 0;
+		}
+	} else if (proc->pidfd != -1) {
+		proc->exited = has_exited;
+	} else {
+		/* the zygote reaps it: its output is all we can wait for */
+		proc->exited = proc->eof;
+	}
+
+	if (proc->exited)
+		unwatch(&proc->pidfd);
+}
+
+
+static void escalate(struct proc_t *proc, time_t now)
+{
+	switch (proc->kill_stage++) {
+		case 0:
+			log_error(0, "plugin (pid %d) timed out, sending SIGTERM", (int) proc->pid);
+			if (!proc->exited)
+				spawn_signal(proc->pidfd, proc->pid, SIGTERM);
+			break;
+		case 1:
+			log_error(0, "plugin (pid %d) still running, sending SIGKILL", (int) proc->pid);
+			if (!proc->exited)
+				spawn_signal(proc->pidfd, proc->pid, SIGKILL);
+			break;
+		default:
+			/* somebody else holds the pipe: let it be */
+			proc->timed_out = 1;
+			proc->eof = 1;
+			unwatch(&proc->fd);
+			proc->deadline = 0;
+			return;
+	}
+
+	proc->deadline = now + PROC_GRACE;
+}
+
+
+/*
+ * wake up the waiting thread; returns whether PROC may be forgotten (it's
+ * reaped, and its output taken); with PROC_MUTEX held
+ */
+
+static int settle(struct proc_t *proc)
+{
+	if (proc->eof && !proc->done && ((proc->exited && proc->report == -1) || proc->timed_out)) {
+		proc->done = 1;
+		proc->deadline = 0;
+		unwatch(&proc->in);
+		unwatch(&proc->report);
+		if (proc->kill_stage > 0)
+			proc->timed_out = 1;
+		running--;
+		pthread_cond_signal(&slot_cond);
+		pthread_cond_signal(&proc->cond);
+	}
+
+	return proc->collected && proc->exited;
+}
+
+
+static void free_proc(struct proc_t *proc)
+{
+	pthread_cond_destroy(&proc->cond);
+	free(proc->output);
+	free(proc);
+}
+
+
+static void *reactor(void *arg)
+{
+	struct epoll_event events[PROC_MAX_EVENTS];
+	struct proc_watch_t *watch;
+	struct proc_t *proc, **pp;
+	time_t now, next;
+	uint64_t counter;
+	int i, n, timeout, pending;
+
+	while (1) {
+		/* sleep until the next deadline, or a little if a child is to be reaped */
+		pthread_mutex_lock(&proc_mutex);
+		now = time(NULL);
+		next = 0;
+		pending = 0;
+		for (proc = procs; proc != NULL; proc = proc->next) {
+			if (proc->deadline && (!next || proc->deadline < next))
+				next = proc->deadline;
+			if (proc->eof && !proc->exited && proc->pidfd == -1)
+				pending = 1;
+		}
+		pthread_mutex_unlock(&proc_mutex);
+
+		timeout = next ? (next > now ? (next - now) * 1000 : 0) : -1;
+		if (pending && (timeout == -1 || timeout > PROC_REAP_INTERVAL))
+			timeout = PROC_REAP_INTERVAL;
+
+		if ((n = epoll_wait(epfd, events, PROC_MAX_EVENTS, timeout)) == -1) {
+			if (errno != EINTR)
+				log_error(errno, "epoll_wait() on plugins failed");
+			n = 0;
+		}
+
+		pthread_mutex_lock(&proc_mutex);
+
+		for (i = 0; i < n; i++) {
+			if ((watch = events[i].data.ptr) == NULL) {
+				/* a new plugin: its deadline may be the next one */
+				if (read(wakeup_fd, &counter, sizeof counter) == -1)
+					DEBUG("spurious wakeup");
+				continue;
+			}
+
+			proc = watch->proc;
+			if (watch->what == PROC_WATCH_PIDFD)
+				check_exit(proc, 1);
+			else if (watch->what == PROC_WATCH_INPUT && proc->in != -1)
+				feed(proc);
+			else if (watch->what == PROC_WATCH_OUTPUT && proc->fd != -1)
+				drain(proc);
+			else if (watch->what == PROC_WATCH_REPORT && proc->report != -1)
+				read_report(proc);
+		}
+
+		now = time(NULL);
+
+		for (pp = &procs; (proc = *pp) != NULL; ) {
+			if (proc->eof)
+				check_exit(proc, 0);
+			if (proc->deadline && now >= proc->deadline && !(proc->eof && proc->exited))
+				escalate(proc, now);
+
+			if (settle(proc)) {
+				*pp = proc->next;
+				free_proc(proc);
+			} else {
+				pp = &proc->next;
+			}
+		}
+
+		pthread_mutex_unlock(&proc_mutex);
+	}
+
+	return arg;
+}
+
+
+static void start_reactor(void)
+{
+	struct epoll_event ev;
+	sigset_t sigpipe, oldset;
+	pthread_t thread;
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		log_critical(errno, "cannot create epoll instance for plugins");
+
+	if ((wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		log_critical(errno, "cannot create eventfd for plugins");
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+
+	/* the reactor inherits it: a plugin that exits early is EPIPE, not a signal */
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &oldset);
+
+	if (pthread_create(&thread, NULL, reactor, NULL) != 0)
+		log_critical(0, "cannot create plugin reactor thread");
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	pthread_detach(thread);
+
+	DEBUG("plugin reactor started");
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * wait for a free slot before starting a plugin; if it cannot be started
+ * after all, give the slot back with proc_release()
+ */
+
+void proc_reserve(void)
+{
+	pthread_mutex_lock(&proc_mutex);
+	while (max_children > 0 && running >= max_children)
+		pthread_cond_wait(&slot_cond, &proc_mutex);
+	running++;
+	pthread_mutex_unlock(&proc_mutex);
+}
+
+
+void proc_release(void)
+{
+	pthread_mutex_lock(&proc_mutex);
+	running--;
+	pthread_cond_signal(&slot_cond);
+	pthread_mutex_unlock(&proc_mutex);
+}
+
+
+/*
+ * hand the plugin PID (our child if IS_CHILD; -1 if unknown), and its PIDFD
+ * (-1 if none), writing to FD to the reactor, and kill it if it runs for
+ * more than TIMEOUT seconds (-1 for the default, 0 for ever); INPUT (LEN
+ * bytes, unless NULL) is written to IN, its standard input, meanwhile, and
+ * the CPU time it took is read from REPORT (see zygote_spawn()), unless
+ * it's -1.  FD, PIDFD, IN and REPORT are closed by the reactor; the output
+ * is to be read with proc_read_line(), and PROC let go with proc_finish()
+ */
+
+struct proc_t *proc_watch(pid_t pid, int pidfd, int is_child, int fd, int report, int in, const char *input, size_t len, int timeout)
+{
+	struct proc_t *proc;
+	struct epoll_event ev;
+	uint64_t one = 1;
+
+	pthread_once(&reactor_once, start_reactor);
+
+	if (timeout < 0)
+		timeout = default_timeout;
+
+	proc = xcalloc(1, sizeof *proc);
+	proc->pid = pid;
+	proc->is_child = is_child;
+	proc->fd = fd;
+	proc->pidfd = pidfd;
+	proc->report = report;
+	proc->in = in;
+	proc->input = input;
+	proc->input_len = input != NULL ? len : 0;
+	proc->output = xmalloc(PROC_BUFFER);
+	proc->deadline = timeout > 0 ? time(NULL) + timeout : 0;
+	pthread_cond_init(&proc->cond, NULL);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (in != -1)
+		fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+
+	pthread_mutex_lock(&proc_mutex);
+
+	proc->next = procs;
+	procs = proc;
+
+	proc->fd_watch.proc = proc;
+	proc->fd_watch.what = PROC_WATCH_OUTPUT;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &proc->fd_watch;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+	if (proc->pidfd != -1) {
+		proc->pidfd_watch.proc = proc;
+		proc->pidfd_watch.what = PROC_WATCH_PIDFD;
+		ev.data.ptr = &proc->pidfd_watch;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, proc->pidfd, &ev);
+	}
+
+	if (proc->report != -1) {
+		proc->report_watch.proc = proc;
+		proc->report_watch.what = PROC_WATCH_REPORT;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &proc->report_watch;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, proc->report, &ev);
+	}
+
+	if (proc->in != -1) {
+		proc->in_watch.proc = proc;
+		proc->in_watch.what = PROC_WATCH_INPUT;
+		ev.events = EPOLLOUT;
+		ev.data.ptr = &proc->in_watch;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, proc->in, &ev);
+	}
+
+	pthread_mutex_unlock(&proc_mutex);
+
+	if (write(wakeup_fd, &one, sizeof one) == -1)
+		DEBUG("cannot wake up the reactor");
+
+	return proc;
+}
+
+
+/*
+ * the next line of output of PROC (without its newline), to be freed, as
+ * soon as it's there; NULL once there is no more
+ */
+
+char *proc_read_line(struct proc_t *proc)
+{
+	char *line, *newline;
+	size_t len;
+
+	pthread_mutex_lock(&proc_mutex);
+
+	while (1) {
+		newline = memchr(proc->output + proc->start, '\n', proc->len - proc->start);
+		len = newline != NULL ? (size_t) (newline - proc->output) - proc->start : proc->len - proc->start;
+
+		/* the rest of a line that didn't fit */
+		if (proc->skip_line && (len > 0 || newline != NULL)) {
+			proc->start += len;
+			if (newline != NULL) {
+				proc->start++;
+				proc->skip_line = 0;
+			}
+			set_paused(proc, 0);
+			continue;
+		}
+
+		/* a line; a piece of one that doesn't fit; or the last one */
+		if (newline != NULL || len == PROC_BUFFER || (proc->eof && len > 0)) {
+			line = xmalloc(len + 1);
+			memcpy(line, proc->output + proc->start, len);
+			line[len] = '\0';
+
+			proc->start += len;
+			if (newline != NULL) {
+				proc->start++;
+			} else if (!proc->eof) {
+				log_warning(0, "line of output of pid %d longer than %d bytes, cut", (int) proc->pid, PROC_BUFFER);
+				proc->skip_line = 1;
+			}
+
+			set_paused(proc, 0);
+			pthread_mutex_unlock(&proc_mutex);
+
+			return line;
+		}
+
+		if (proc->eof)
+			break;
+
+		pthread_cond_wait(&proc->cond, &proc_mutex);
+	}
+
+	pthread_mutex_unlock(&proc_mutex);
+
+	return NULL;
+}
+
+
+/*
+ * what a TIMEOUT given to proc_watch() comes to, in seconds (0 for none)
+ */
+
+int proc_get_timeout(int timeout)
+{
+	return timeout < 0 ? default_timeout : timeout;
+}
+
+
+/*
+ * drop what is left of the output of PROC, and wait for it to be over;
+ * returns 0 if the plugin had to be killed.  The CPU time it took goes
+ * into *CPU_MS (0 if unknown).  Releases the slot taken with
+ * proc_reserve()
+ */
+
+int proc_finish(struct proc_t *proc, long *cpu_ms)
+{
+	struct proc_t **pp;
+	int timed_out;
+
+	pthread_mutex_lock(&proc_mutex);
+
+	proc->discard = 1;
+	proc->start = proc->len = 0;
+	set_paused(proc, 0);
+
+	while (!proc->done)
+		pthread_cond_wait(&proc->cond, &proc_mutex);
+
+	timed_out = proc->timed_out;
+	*cpu_ms = proc->cpu_ms;
+
+	/* the reactor may still have to reap it */
+	proc->collected = 1;
+	if (proc->exited) {
+		for (pp = &procs; *pp != NULL; pp = &(*pp)->next) {
+			if (*pp == proc) {
+				*pp = proc->next;
+				break;
+			}
+		}
+		free_proc(proc);
+	}
+
+	pthread_mutex_unlock(&proc_mutex);
+
+	return !timed_out;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void proc_init(void)
+{
+	default_timeout = atoi(config_get_option_value(":plugin_timeout"));
+	max_children = atoi(config_get_option_value(":plugins_max_children"));
+	max_output = strtoul(config_get_option_value(":plugin_max_output"), NULL, 10);
+}
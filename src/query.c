@@ -104,7 +104,7 @@ static int query_parse(const char *query_source_file)
 	query_begin_marker_re = regex_compile(query_begin_marker);
 	query_end_marker_re = regex_compile(query_end_marker);
 
-	if ((query_source_h = fopen(query_source_file, "r")) != NULL) {
+	if ((query_source_h = fopen(query_source_file, "re")) != NULL) {
 
 		char buffer[TMPBUFLEN];
 		char *line;
@@ -124,14 +124,14 @@ static int query_parse(const char *query_source_file)
 			if (line != NULL && (len = strlen(line)) > 0) {
 				switch(status) {
 					case Q_OUTSIDE_QUERY:
-						if ((rc = regex_execute(query_begin_marker_re, line, ovector, OVECSIZE)) >= 0) {
+						if ((rc = regex_execute(query_begin_marker_re, NULL, line, ovector, OVECSIZE)) >= 0) {
 							pcre_copy_substring(line, ovector, rc, 1, q_name, Q_NAME_SIZE); 
 
 							status = Q_INSIDE_QUERY;
 						}
 						break;
 					case Q_INSIDE_QUERY:
-						if (regex_execute(query_end_marker_re, line, ovector, OVECSIZE) >= 0) {
+						if (regex_execute(query_end_marker_re, NULL, line, ovector, OVECSIZE) >= 0) {
 							if (q_found > 0) {
 								query_store(q_name, remove_spaces(q_body));
 								if (q_body_len > 0)
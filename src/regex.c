@@ -45,7 +45,35 @@ pcre* regex_compile(const char *pattern)
 }
 
 
-int regex_execute(const pcre *re, const char *input, int *ovector, int ovecsize)
+/*
+ * study RE, JIT-compiling it where PCRE can; NULL is fine to execute with
+ */
+
+pcre_extra *regex_study(const pcre *re)
+{
+	pcre_extra *extra;
+	const char *error = NULL;
+	int options = 0;
+
+	if (re == NULL) {
+		DEBUG("called on NULL regex");
+		return NULL;
+	}
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+	options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+
+	extra = pcre_study(re, options, &error);
+
+	if (error != NULL)
+		log_warning(0, "PCRE study failed: %s", error);
+
+	return extra;
+}
+
+
+int regex_execute(const pcre *re, const pcre_extra *extra, const char *input, int *ovector, int ovecsize)
 {
 	int rc;
 
@@ -59,7 +87,7 @@ int regex_execute(const pcre *re, const char *input, int *ovector, int ovecsize)
 		return -255;
 	}
 
-	rc = pcre_exec(re, NULL, input, strlen(input), 0, 0, ovector, ovecsize);
+	rc = pcre_exec(re, extra, input, strlen(input), 0, 0, ovector, ovecsize);
 
 	if (rc < 0) {
 		switch (rc) {
@@ -0,0 +1,414 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     rule.c --- declarative trap rules
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * Traps whose handler would only pick a few varbinds out of the contents
+ * are better described by a rule, evaluated in-process, than by a plugin:
+ *
+ *    rule NAGIOS-NOTIFY-MIB::sHostEvent
+ *        host_name  NAGIOS-NOTIFY-MIB::sHostname      ^(.+)$
+ *        ret_value  NAGIOS-NOTIFY-MIB::sHostStateID   ^up$     0
+ *        ret_value  NAGIOS-NOTIFY-MIB::sHostStateID   ^down$   1
+ *        ret_value  = 3
+ *        output     NAGIOS-NOTIFY-MIB::sHostOutput    ^(.*)$
+ *
+ * A rule starts with the trap OID it handles (numeric ones may use the
+ * wildcards of trap_handler.trap_oid) and goes on with a line per result
+ * field: host_address, host_name, svc_desc, ret_value, output or perfdata.
+ * The regex is matched against the value of the varbind (without quotes;
+ * use \s for blanks), and the rest of the line ($0-$9 standing for the
+ * match and its groups, $$ for a dollar) becomes the field; with no rest,
+ * the field is $1, or $0 if there are no groups.  "field = text" sets a
+ * field to a constant.  The first line that matches sets a field.
+ *
+ * The regexes are compiled (JIT, where PCRE can) when the file is loaded.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+#define OVECSIZE 30
+
+struct rule_line_t {
+	int field;
+
+	/* the varbind, and its regex; or a constant (re is NULL) */
+	oid_t oid;
+	pcre *re;
+	pcre_extra *extra;
+	char *replacement;
+
+	struct rule_line_t *next;
+};
+
+
+struct rule_t {
+	char *trap_oid;
+
+	/* interned trap OID, for symbolic ones */
+	oid_t oid_id;
+
+	struct rule_line_t *lines;
+	struct rule_line_t **tail;
+
+	struct rule_t *next;
+};
+
+
+static const char *field_names[RULE_FIELDS] = {
+	"host_address", "host_name", "svc_desc", "ret_value", "output", "perfdata"
+};
+
+
+/* rules by numeric trap OID (wildcards allowed) */
+static struct oid_trie_t *rules_trie = NULL;
+
+/* every rule, and those by symbolic trap OID among them */
+static struct rule_t *rules = NULL;
+
+static int count_rules = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static char *skip_blanks(char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+
+	return s;
+}
+
+
+/*
+ * the next word of *S (zero-terminated in place), or NULL
+ */
+
+static char *next_word(char **s)
+{
+	char *word, *p;
+
+	word = skip_blanks(*s);
+	if (*word == '\0')
+		return NULL;
+
+	for (p = word; *p != '\0' && *p != ' ' && *p != '\t'; p++)
+		;
+
+	if (*p != '\0')
+		*p++ = '\0';
+
+	*s = p;
+
+	return word;
+}
+
+
+static void trim_right(char *s)
+{
+	size_t len = strlen(s);
+
+	while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t' || s[len - 1] == '\n' || s[len - 1] == '\r'))
+		s[--len] = '\0';
+}
+
+
+static int lookup_field(const char *name)
+{
+	int i;
+
+	for (i = 0; i < RULE_FIELDS; i++) {
+		if (!strcmp(field_names[i], name))
+			return i;
+	}
+
+	return -1;
+}
+
+
+static struct rule_t *new_rule(const char *trap_oid)
+{
+	struct rule_t *rule;
+
+	rule = xcalloc(1, sizeof *rule);
+	rule->trap_oid = xstrdup(trap_oid);
+	rule->tail = &rule->lines;
+
+	/* numeric OIDs go into the trie, symbolic ones are interned */
+	if (!oid_trie_insert(rules_trie, trap_oid, rule))
+		rule->oid_id = oid_intern(trap_oid, strlen(trap_oid));
+
+	rule->next = rules;
+	rules = rule;
+	count_rules++;
+
+	DEBUG("new rule for %s", trap_oid);
+
+	return rule;
+}
+
+
+/*
+ * parse "field varbind regex [replacement]" or "field = text"
+ */
+
+static struct rule_line_t *new_rule_line(const char *filename, int lineno, char *s)
+{
+	struct rule_line_t *line;
+	char *field, *oid, *pattern;
+
+	line = xcalloc(1, sizeof *line);
+
+	field = next_word(&s);
+	if ((line->field = lookup_field(field)) == -1)
+		log_critical(0, "%s:%d: unknown field %s", filename, lineno, field);
+
+	if ((oid = next_word(&s)) == NULL)
+		log_critical(0, "%s:%d: missing varbind OID", filename, lineno);
+
+	if (!strcmp(oid, "=")) {
+		line->replacement = xstrdup(skip_blanks(s));
+		return line;
+	}
+
+	if ((pattern = next_word(&s)) == NULL)
+		log_critical(0, "%s:%d: missing regex", filename, lineno);
+
+	line->oid = oid_intern(oid, strlen(oid));
+	line->re = regex_compile(pattern);
+	line->extra = regex_study(line->re);
+
+	s = skip_blanks(s);
+	if (*s != '\0')
+		line->replacement = xstrdup(s);
+
+	return line;
+}
+
+
+/*
+ * REPLACEMENT with $0-$9 expanded from the groups matched in VALUE
+ */
+
+static char *expand(const char *replacement, const char *value, const int *ovector, int groups)
+{
+	const char *s;
+	char *result, *p;
+	size_t len = 0;
+	int n, pass;
+
+	if (replacement == NULL)
+		replacement = groups > 1 ? "$1" : "$0";
+
+	/* measure first, then copy */
+	for (pass = 0, result = p = NULL; pass < 2; pass++) {
+		for (s = replacement; *s != '\0'; s++) {
+			if (*s == '$' && s[1] >= '0' && s[1] <= '9') {
+				n = *++s - '0';
+				if (n < groups && ovector[2 * n] >= 0) {
+					if (pass)
+						p = mempcpy(p, value + ovector[2 * n], ovector[2 * n + 1] - ovector[2 * n]);
+					else
+						len += ovector[2 * n + 1] - ovector[2 * n];
+				}
+			} else {
+				if (*s == '$' && s[1] == '$')
+					s++;
+				if (pass)
+					*p++ = *s;
+				else
+					len++;
+			}
+		}
+
+		if (!pass)
+			result = p = xmalloc(len + 1);
+	}
+
+	*p = '\0';
+
+	return result;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * cheap pre-check: is there a rule for the trap OID?
+ */
+
+int rule_may_handle(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	return rule_lookup(oid, arcs, narcs) != NULL;
+}
+
+
+/*
+ * the rule for a trap OID: by its ARCS if it is numeric, by the interned
+ * OID if it is not
+ */
+
+struct rule_t *rule_lookup(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	struct rule_t *rule;
+
+	if (count_rules == 0)
+		return NULL;
+
+	if (narcs > 0)
+		return (struct rule_t *) oid_trie_match(rules_trie, arcs, narcs);
+
+	if (oid == OID_NONE)
+		return NULL;
+
+	for (rule = rules; rule != NULL; rule = rule->next) {
+		if (rule->oid_id == oid)
+			return rule;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * evaluate RULE on TRAP: FIELDS (RULE_FIELDS of them) get the results,
+ * to be freed by the caller, or NULL; returns 0 if nothing matched
+ */
+
+int rule_evaluate(struct rule_t *rule, struct trap_t *trap, char **fields)
+{
+	struct rule_line_t *line;
+	int ovector[OVECSIZE];
+	const char *value;
+	int rc, matched = 0;
+
+	memset(fields, 0, RULE_FIELDS * sizeof *fields);
+
+	if (rule == NULL || trap == NULL)
+		return 0;
+
+	for (line = rule->lines; line != NULL; line = line->next) {
+		if (fields[line->field] != NULL)
+			continue;
+
+		if (line->re == NULL) {
+			fields[line->field] = xstrdup(line->replacement);
+			matched = 1;
+			continue;
+		}
+
+		if ((value = trap_get_value(trap, line->oid)) == NULL)
+			continue;
+
+		if ((rc = regex_execute(line->re, line->extra, value, ovector, OVECSIZE)) < 0)
+			continue;
+
+		/* ovector too small: what fits is there */
+		if (rc == 0)
+			rc = OVECSIZE / 3;
+
+		fields[line->field] = expand(line->replacement, value, ovector, rc);
+		matched = 1;
+
+		DEBUG("rule %s: %s = %s", rule->trap_oid, field_names[line->field], fields[line->field]);
+	}
+
+	return matched;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void rule_init(void)
+{
+	const char *filename;
+	struct rule_t *rule = NULL;
+	struct rule_line_t *rule_line;
+	char *line = NULL, *s, *word;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	rules_trie = oid_trie_new();
+
+	filename = config_get_option_value(":trap_rules_file");
+	if (is_empty(filename)) {
+		DEBUG("no trap rules");
+		return;
+	}
+
+	if ((fp = fopen(filename, "re")) == NULL) {
+		log_warning(errno, "cannot open trap rules file %s: no rules loaded", filename);
+		return;
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		lineno++;
+
+		trim_right(line);
+		s = skip_blanks(line);
+		if (*s == '\0' || *s == '#')
+			continue;
+
+		if (!strncmp(s, "rule", 4) && (s[4] == ' ' || s[4] == '\t')) {
+			s += 4;
+			if ((word = next_word(&s)) == NULL)
+				log_critical(0, "%s:%d: missing trap OID", filename, lineno);
+			rule = new_rule(word);
+			continue;
+		}
+
+		if (rule == NULL)
+			log_critical(0, "%s:%d: field outside of a rule", filename, lineno);
+
+		rule_line = new_rule_line(filename, lineno, s);
+		*rule->tail = rule_line;
+		rule->tail = &rule_line->next;
+	}
+
+	free(line);
+	fclose(fp);
+
+	DEBUG("=== loaded %d trap rule(s) from %s ===", count_rules, filename);
+}
@@ -0,0 +1,162 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     scan.c --- vectorized byte scanning
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * The parser and the connection spend most of their time looking for a
+ * handful of structural bytes (word and line delimiters).  On x86 this is
+ * done 16 (SSE2) or 32 (AVX2) bytes at a time; the implementation is picked
+ * at run time, according to the CPU, by scan_init().
+ */
+
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define SCAN_X86
+# include <immintrin.h>
+#endif
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+typedef size_t (*scan_any3_t)(const char *, size_t, char, char, char);
+
+static size_t any3_scalar(const char *, size_t, char, char, char);
+
+/* chosen implementation (scalar until scan_init()) */
+static scan_any3_t scan_any3_impl = any3_scalar;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static size_t any3_scalar(const char *buffer, size_t len, char a, char b, char c)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buffer[i] == a || buffer[i] == b || buffer[i] == c)
+			break;
+	}
+
+	return i;
+}
+
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static size_t any3_sse2(const char *buffer, size_t len, char a, char b, char c)
+{
+	__m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+	__m128i chunk, hits;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		chunk = _mm_loadu_si128((const __m128i *) (buffer + i));
+		hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)), _mm_cmpeq_epi8(chunk, vc));
+		if ((mask = _mm_movemask_epi8(hits)) != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + any3_scalar(buffer + i, len - i, a, b, c);
+}
+
+
+__attribute__((target("avx2")))
+static size_t any3_avx2(const char *buffer, size_t len, char a, char b, char c)
+{
+	__m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c);
+	__m256i chunk, hits;
+	__m128i chunk16, hits16;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		chunk = _mm256_loadu_si256((const __m256i *) (buffer + i));
+		hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)), _mm256_cmpeq_epi8(chunk, vc));
+		if ((mask = (unsigned int) _mm256_movemask_epi8(hits)) != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	/*
+	 * the tail is done here rather than by any3_sse2(): calling legacy SSE
+	 * code with the upper halves of the ymm registers dirty costs more than
+	 * the scan itself on the short words of a trap
+	 */
+	if (i + 16 <= len) {
+		chunk16 = _mm_loadu_si128((const __m128i *) (buffer + i));
+		hits16 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk16, _mm256_castsi256_si128(va)), _mm_cmpeq_epi8(chunk16, _mm256_castsi256_si128(vb))), _mm_cmpeq_epi8(chunk16, _mm256_castsi256_si128(vc)));
+		if ((mask = _mm_movemask_epi8(hits16)) != 0)
+			return i + __builtin_ctz(mask);
+		i += 16;
+	}
+
+	return i + any3_scalar(buffer + i, len - i, a, b, c);
+}
+
+#endif
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * index of the first of A, B or C in BUFFER (LEN if none)
+ */
+
+size_t scan_any3(const char *buffer, size_t len, char a, char b, char c)
+{
+	return scan_any3_impl(buffer, len, a, b, c);
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void scan_init(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		DEBUG("using AVX2 scanner");
+		scan_any3_impl = any3_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		DEBUG("using SSE2 scanner");
+		scan_any3_impl = any3_sse2;
+	}
+#endif
+}
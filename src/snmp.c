@@ -0,0 +1,693 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     snmp.c --- native SNMPv1/v2c trap reception (BER decoding)
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * Traps received on the UDP port are decoded here and turned into the same
+ * trap objects the text protocol produces, with values rendered the way
+ * snmptrapd would hand them to a traphandler (numeric OIDs).  SNMPv1
+ * Trap-PDUs are translated to the SNMPv2 form as described in RFC 3584,
+ * section 3.1, and InformRequests are acknowledged with a Response-PDU.
+ */
+
+
+#define _GNU_SOURCE /* for recvmmsg() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* BER tags */
+#define BER_INTEGER            0x02
+#define BER_OCTET_STRING       0x04
+#define BER_NULL               0x05
+#define BER_OID                0x06
+#define BER_SEQUENCE           0x30
+#define BER_IPADDRESS          0x40
+#define BER_COUNTER32          0x41
+#define BER_GAUGE32            0x42
+#define BER_TIMETICKS          0x43
+#define BER_OPAQUE             0x44
+#define BER_COUNTER64          0x46
+#define BER_NO_SUCH_OBJECT     0x80
+#define BER_NO_SUCH_INSTANCE   0x81
+#define BER_END_OF_MIB_VIEW    0x82
+
+/* PDU tags */
+#define PDU_RESPONSE           0xa2
+#define PDU_V1_TRAP            0xa4
+#define PDU_INFORM             0xa6
+#define PDU_V2_TRAP            0xa7
+
+#define SNMP_VERSION_1         0
+#define SNMP_VERSION_2C        1
+
+/* longest rendered OID */
+#define OID_STRING_LEN 1408
+
+/* well-known OIDs used by the RFC 3584 translation */
+#define OID_SYSUPTIME          ".1.3.6.1.2.1.1.3.0"
+#define OID_SNMPTRAPOID        ".1.3.6.1.6.3.1.1.4.1.0"
+#define OID_SNMPTRAPS          ".1.3.6.1.6.3.1.1.5"
+#define OID_SNMPTRAPADDRESS    ".1.3.6.1.6.3.18.1.3.0"
+#define OID_SNMPTRAPCOMMUNITY  ".1.3.6.1.6.3.18.1.4.0"
+#define OID_SNMPTRAPENTERPRISE ".1.3.6.1.6.3.1.1.4.3.0"
+
+
+/* largest UDP payload */
+#define MAX_DATAGRAM_SIZE 65535
+
+/* room for the SO_RXQ_OVFL control message */
+#define CMSG_SPACE_OVFL CMSG_SPACE(sizeof(uint32_t))
+
+
+/* a BER element inside the datagram */
+struct ber_t {
+	unsigned char tag;
+	const unsigned char *value;
+	size_t len;
+};
+
+
+/* accepted community ("" = any) */
+static char *snmp_community = NULL;
+
+/*
+ * diagnostics counters (only the event loop thread writes them)
+ */
+static long snmp_datagrams = 0;
+static long snmp_dropped = 0;
+static long snmp_informs = 0;
+static long snmp_batches = 0;
+
+/* datagrams dropped by the kernel on our socket (SO_RXQ_OVFL) */
+static uint32_t snmp_kernel_drops = 0;
+
+
+/*
+ * receive ring: the buffers are reused by every recvmmsg(), so datagrams
+ * are decoded before the next batch is read (only the event loop uses it)
+ */
+static unsigned char *ring_buffers = NULL;
+static struct mmsghdr ring_msgs[SNMP_BATCH_SIZE];
+static struct iovec ring_iovecs[SNMP_BATCH_SIZE];
+static struct sockaddr_in ring_addrs[SNMP_BATCH_SIZE];
+static char ring_controls[SNMP_BATCH_SIZE][CMSG_SPACE_OVFL];
+
+
+
+/*
+ *     BER decoding
+ *
+ ******************************************************************************/
+
+
+/*
+ * read the element at *P (not past END), advancing *P past it
+ */
+
+static int ber_read(const unsigned char **p, const unsigned char *end, struct ber_t *ber)
+{
+	const unsigned char *q = *p;
+	size_t len, n;
+
+	if (end - q < 2)
+		return 0;
+
+	ber->tag = *q++;
+
+	if (*q & 0x80) {
+		/* long form */
+		n = *q++ & 0x7f;
+		if (n == 0 || n > 4 || (size_t) (end - q) < n)
+			return 0;
+		for (len = 0; n > 0; n--)
+			len = (len << 8) | *q++;
+	} else {
+		len = *q++;
+	}
+
+	if ((size_t) (end - q) < len)
+		return 0;
+
+	ber->value = q;
+	ber->len = len;
+	*p = q + len;
+
+	return 1;
+}
+
+
+static int ber_expect(const unsigned char **p, const unsigned char *end, unsigned char tag, struct ber_t *ber)
+{
+	return ber_read(p, end, ber) && ber->tag == tag;
+}
+
+
+static int ber_get_integer(const struct ber_t *ber, long *value)
+{
+	size_t i;
+	long v;
+
+	if (ber->len == 0 || ber->len > sizeof(long))
+		return 0;
+
+	/* sign extension */
+	v = (ber->value[0] & 0x80) ? -1 : 0;
+
+	for (i = 0; i < ber->len; i++)
+		v = (long) (((unsigned long) v << 8) | ber->value[i]);
+
+	*value = v;
+	return 1;
+}
+
+
+static int ber_get_unsigned(const struct ber_t *ber, unsigned long long *value)
+{
+	size_t i, len = ber->len;
+	const unsigned char *v = ber->value;
+
+	/* a leading zero octet keeps big values positive */
+	if (len > 1 && v[0] == 0) {
+		v++;
+		len--;
+	}
+
+	if (len == 0 || len > 8)
+		return 0;
+
+	for (*value = 0, i = 0; i < len; i++)
+		*value = (*value << 8) | v[i];
+
+	return 1;
+}
+
+
+/*
+ * render an OID as ".1.3.6.1..."
+ */
+
+static int ber_get_oid(const struct ber_t *ber, char *buffer, size_t buflen)
+{
+	size_t i, used;
+	unsigned long arc = 0;
+	int first = 1, n;
+
+	if (ber->len == 0)
+		return 0;
+
+	buffer[0] = '\0';
+	used = 0;
+
+	for (i = 0; i < ber->len; i++) {
+		arc = (arc << 7) | (ber->value[i] & 0x7f);
+
+		if (arc > 0xffffffffUL)
+			return 0;
+
+		if (ber->value[i] & 0x80)
+			continue;
+
+		if (first) {
+			/* the first subidentifier packs two arcs */
+			unsigned long x = arc < 80 ? arc / 40 : 2;
+			n = snprintf(buffer + used, buflen - used, ".%lu.%lu", x, arc - 40 * x);
+			first = 0;
+		} else {
+			n = snprintf(buffer + used, buflen - used, ".%lu", arc);
+		}
+
+		if (n < 0 || (size_t) n >= buflen - used)
+			return 0;
+
+		used += n;
+		arc = 0;
+	}
+
+	/* truncated subidentifier */
+	return !(ber->value[ber->len-1] & 0x80);
+}
+
+
+static int is_printable(const unsigned char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((s[i] < 0x20 || s[i] > 0x7e) && s[i] != '\t' && s[i] != '\n' && s[i] != '\r')
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * render a varbind value as snmptrapd does for traphandlers (the result
+ * lives as long as PDU)
+ */
+
+static const char *render_value(struct pdu_t *pdu, const struct ber_t *ber)
+{
+	char *buffer;
+	char oidbuf[OID_STRING_LEN];
+	long integer;
+	unsigned long long counter;
+	size_t i;
+
+	switch (ber->tag) {
+		case BER_INTEGER:
+			if (!ber_get_integer(ber, &integer))
+				return NULL;
+			buffer = trap_pdu_alloc(pdu, 32);
+			sprintf(buffer, "%ld", integer);
+			return buffer;
+
+		case BER_OCTET_STRING:
+		case BER_OPAQUE:
+			if (is_printable(ber->value, ber->len)) {
+				buffer = trap_pdu_alloc(pdu, ber->len + 3);
+				buffer[0] = '"';
+				memcpy(buffer + 1, ber->value, ber->len);
+				buffer[ber->len + 1] = '"';
+				buffer[ber->len + 2] = '\0';
+			} else {
+				/* Hex-STRING: bare bytes, like snmptrapd's "00 1A FF" */
+				buffer = trap_pdu_alloc(pdu, ber->len * 3 + 1);
+				for (i = 0; i < ber->len; i++)
+					sprintf(buffer + i * 3, "%02X ", ber->value[i]);
+				buffer[ber->len * 3 - 1] = '\0';
+			}
+			return buffer;
+
+		case BER_OID:
+			if (!ber_get_oid(ber, oidbuf, sizeof oidbuf))
+				return NULL;
+			buffer = trap_pdu_alloc(pdu, strlen(oidbuf) + 1);
+			strcpy(buffer, oidbuf);
+			return buffer;
+
+		case BER_IPADDRESS:
+			if (ber->len != 4)
+				return NULL;
+			buffer = trap_pdu_alloc(pdu, 16);
+			sprintf(buffer, "%u.%u.%u.%u", ber->value[0], ber->value[1], ber->value[2], ber->value[3]);
+			return buffer;
+
+		case BER_COUNTER32:
+		case BER_GAUGE32:
+		case BER_COUNTER64:
+			if (!ber_get_unsigned(ber, &counter))
+				return NULL;
+			buffer = trap_pdu_alloc(pdu, 32);
+			sprintf(buffer, "%llu", counter);
+			return buffer;
+
+		case BER_TIMETICKS:
+			if (!ber_get_unsigned(ber, &counter))
+				return NULL;
+			/* days:hours:minutes:seconds.hundredths */
+			buffer = trap_pdu_alloc(pdu, 48);
+			sprintf(buffer, "%llu:%llu:%02llu:%02llu.%02llu",
+				counter / 8640000, (counter / 360000) % 24, (counter / 6000) % 60,
+				(counter / 100) % 60, counter % 100);
+			return buffer;
+
+		case BER_NULL:
+		case BER_NO_SUCH_OBJECT:
+		case BER_NO_SUCH_INSTANCE:
+		case BER_END_OF_MIB_VIEW:
+			return "\"\"";
+
+		default:
+			DEBUG("unknown value type 0x%02x", ber->tag);
+			return NULL;
+	}
+}
+
+
+/*
+ * decode a VarBindList into PDU
+ */
+
+static int decode_varbinds(const struct ber_t *list, struct pdu_t *pdu)
+{
+	const unsigned char *p = list->value, *end = list->value + list->len;
+	const unsigned char *q, *qend;
+	struct ber_t varbind, name, value;
+	char oidbuf[OID_STRING_LEN];
+	const char *rendered;
+
+	while (p < end) {
+		if (!ber_expect(&p, end, BER_SEQUENCE, &varbind))
+			return 0;
+
+		q = varbind.value;
+		qend = varbind.value + varbind.len;
+
+		if (!ber_expect(&q, qend, BER_OID, &name) || !ber_get_oid(&name, oidbuf, sizeof oidbuf))
+			return 0;
+		if (!ber_read(&q, qend, &value) || (rendered = render_value(pdu, &value)) == NULL)
+			return 0;
+
+		trap_pdu_add_object(pdu, oidbuf, rendered);
+	}
+
+	return 1;
+}
+
+
+/*
+ * RFC 3584, 3.1: SNMPv1 Trap-PDU to SNMPv2 notification
+ */
+
+static int decode_v1_trap(const struct ber_t *body, const struct ber_t *community, struct pdu_t *pdu)
+{
+	const unsigned char *p = body->value, *end = body->value + body->len;
+	struct ber_t enterprise, agent_addr, generic, specific, timestamp, varbinds;
+	char enterprise_oid[OID_STRING_LEN], trap_oid[OID_STRING_LEN + 32];
+	const char *address, *uptime, *quoted;
+	long generic_trap, specific_trap;
+
+	if (!ber_expect(&p, end, BER_OID, &enterprise)
+		|| !ber_expect(&p, end, BER_IPADDRESS, &agent_addr)
+		|| !ber_expect(&p, end, BER_INTEGER, &generic)
+		|| !ber_expect(&p, end, BER_INTEGER, &specific)
+		|| !ber_expect(&p, end, BER_TIMETICKS, &timestamp)
+		|| !ber_expect(&p, end, BER_SEQUENCE, &varbinds))
+	{
+		DEBUG("malformed v1 Trap-PDU");
+		return 0;
+	}
+
+	if (!ber_get_oid(&enterprise, enterprise_oid, sizeof enterprise_oid)
+		|| !ber_get_integer(&generic, &generic_trap)
+		|| !ber_get_integer(&specific, &specific_trap)
+		|| (uptime = render_value(pdu, &timestamp)) == NULL)
+	{
+		return 0;
+	}
+
+	if (generic_trap >= 0 && generic_trap < 6)
+		sprintf(trap_oid, "%s.%ld", OID_SNMPTRAPS, generic_trap + 1);
+	else
+		sprintf(trap_oid, "%s.0.%ld", enterprise_oid, specific_trap);
+
+	trap_pdu_add_object(pdu, OID_SYSUPTIME, uptime);
+	trap_pdu_add_object(pdu, OID_SNMPTRAPOID, trap_oid);
+
+	if (!decode_varbinds(&varbinds, pdu))
+		return 0;
+
+	if ((address = render_value(pdu, &agent_addr)) == NULL || (quoted = render_value(pdu, community)) == NULL)
+		return 0;
+
+	trap_pdu_add_object(pdu, OID_SNMPTRAPADDRESS, address);
+	trap_pdu_add_object(pdu, OID_SNMPTRAPCOMMUNITY, quoted);
+
+	trap_pdu_add_object(pdu, OID_SNMPTRAPENTERPRISE, enterprise_oid);
+
+	return 1;
+}
+
+
+static int decode_v2_trap(const struct ber_t *body, struct pdu_t *pdu)
+{
+	const unsigned char *p = body->value, *end = body->value + body->len;
+	struct ber_t request_id, error_status, error_index, varbinds;
+
+	if (!ber_expect(&p, end, BER_INTEGER, &request_id)
+		|| !ber_expect(&p, end, BER_INTEGER, &error_status)
+		|| !ber_expect(&p, end, BER_INTEGER, &error_index)
+		|| !ber_expect(&p, end, BER_SEQUENCE, &varbinds))
+	{
+		DEBUG("malformed v2 notification");
+		return 0;
+	}
+
+	return decode_varbinds(&varbinds, pdu);
+}
+
+
+/*
+ * an InformRequest is acknowledged by the very same message with the PDU
+ * type changed into Response (same request-id and varbinds, no error)
+ */
+
+static void acknowledge_inform(int sock, const unsigned char *datagram, size_t len, const unsigned char *pdu_tag, const struct sockaddr_in *from)
+{
+	unsigned char *response;
+
+	response = xmalloc(len);
+	memcpy(response, datagram, len);
+	response[pdu_tag - datagram] = PDU_RESPONSE;
+
+	if (sendto(sock, response, len, 0, (const struct sockaddr *) from, sizeof *from) < 0)
+		log_error(errno, "cannot acknowledge inform");
+	else
+		snmp_informs++;
+
+	free(response);
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+static void ring_init(void)
+{
+	int i;
+
+	ring_buffers = xmalloc((size_t) SNMP_BATCH_SIZE * MAX_DATAGRAM_SIZE);
+
+	for (i = 0; i < SNMP_BATCH_SIZE; i++) {
+		ring_iovecs[i].iov_base = ring_buffers + (size_t) i * MAX_DATAGRAM_SIZE;
+		ring_iovecs[i].iov_len = MAX_DATAGRAM_SIZE;
+		ring_msgs[i].msg_hdr.msg_iov = &ring_iovecs[i];
+		ring_msgs[i].msg_hdr.msg_iovlen = 1;
+		ring_msgs[i].msg_hdr.msg_name = &ring_addrs[i];
+		ring_msgs[i].msg_hdr.msg_control = ring_controls[i];
+	}
+}
+
+
+/*
+ * the kernel reports in every datagram how many were dropped so far
+ */
+
+static void update_kernel_drops(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&snmp_kernel_drops, CMSG_DATA(cmsg), sizeof snmp_kernel_drops);
+	}
+}
+
+
+/*
+ * read up to SNMP_BATCH_SIZE datagrams from SOCK with a single recvmmsg()
+ * and decode them; the valid traps are stored in PDUS (*NPDUS of them).
+ * Returns the number of datagrams read, 0 when the socket is drained.
+ */
+
+int snmp_receive_batch(int sock, struct pdu_t **pdus, int *npdus)
+{
+	struct pdu_t *pdu;
+	int i, n;
+
+	*npdus = 0;
+
+	if (ring_buffers == NULL)
+		ring_init();
+
+	for (i = 0; i < SNMP_BATCH_SIZE; i++) {
+		ring_msgs[i].msg_hdr.msg_namelen = sizeof ring_addrs[i];
+		ring_msgs[i].msg_hdr.msg_controllen = sizeof ring_controls[i];
+		ring_msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	do {
+		n = recvmmsg(sock, ring_msgs, SNMP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			log_error(errno, "cannot recvmmsg() on SNMP socket");
+		return 0;
+	}
+
+	snmp_batches++;
+
+	for (i = 0; i < n; i++) {
+		update_kernel_drops(&ring_msgs[i].msg_hdr);
+
+		if (ring_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			DEBUG("truncated datagram");
+			snmp_datagrams++;
+			snmp_dropped++;
+			continue;
+		}
+
+		pdu = snmp_process_datagram(sock, ring_iovecs[i].iov_base, ring_msgs[i].msg_len, &ring_addrs[i]);
+
+		if (pdu != NULL)
+			pdus[(*npdus)++] = pdu;
+	}
+
+	return n;
+}
+
+
+/*
+ * decode a datagram received on SOCK; returns the trap pdu, or NULL if the
+ * datagram must be dropped: a trap without handler comes without trap, but
+ * trap_pdu_get_unhandled() gives it for the trap log
+ */
+
+struct pdu_t *snmp_process_datagram(int sock, const unsigned char *datagram, size_t len, const struct sockaddr_in *from)
+{
+	const unsigned char *p = datagram, *end = datagram + len, *q, *pdu_tag;
+	struct ber_t message, version, community, body;
+	char address[INET_ADDRSTRLEN];
+	struct pdu_t *pdu;
+	long snmp_version;
+	int ok;
+
+	snmp_datagrams++;
+
+	if (inet_ntop(AF_INET, &from->sin_addr, address, sizeof address) == NULL)
+		strcpy(address, "0.0.0.0");
+
+	DEBUG("datagram from %s (len: %d)", address, len);
+
+	if (!ber_expect(&p, end, BER_SEQUENCE, &message))
+		goto drop;
+
+	q = message.value;
+	end = message.value + message.len;
+
+	if (!ber_expect(&q, end, BER_INTEGER, &version) || !ber_get_integer(&version, &snmp_version))
+		goto drop;
+
+	if (snmp_version != SNMP_VERSION_1 && snmp_version != SNMP_VERSION_2C) {
+		DEBUG("unsupported SNMP version %ld", snmp_version);
+		goto drop;
+	}
+
+	if (!ber_expect(&q, end, BER_OCTET_STRING, &community))
+		goto drop;
+
+	if (!is_empty(snmp_community)
+		&& (community.len != strlen(snmp_community) || memcmp(community.value, snmp_community, community.len) != 0))
+	{
+		DEBUG("community mismatch from %s", address);
+		goto drop;
+	}
+
+	pdu_tag = q;
+	if (!ber_read(&q, end, &body))
+		goto drop;
+
+	pdu = trap_pdu_new_trap(address, address);
+
+	if (snmp_version == SNMP_VERSION_1 && body.tag == PDU_V1_TRAP)
+		ok = decode_v1_trap(&body, &community, pdu);
+	else if (snmp_version == SNMP_VERSION_2C && (body.tag == PDU_V2_TRAP || body.tag == PDU_INFORM))
+		ok = decode_v2_trap(&body, pdu);
+	else
+		ok = 0;
+
+	if (!ok || !trap_pdu_finalize(pdu)) {
+		trap_free_pdu(pdu);
+		goto drop;
+	}
+
+	if (body.tag == PDU_INFORM)
+		acknowledge_inform(sock, datagram, len, pdu_tag, from);
+
+	return pdu;
+
+drop:
+	DEBUG("dropping datagram from %s", address);
+	snmp_dropped++;
+	return NULL;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+void snmp_init(void)
+{
+	snmp_community = config_get_option_value(":snmp_community");
+}
+
+
+
+/*
+ *     Callbacks for diagnostics
+ *
+ ******************************************************************************/
+
+
+long snmp_get_datagrams(void)
+{
+	return snmp_datagrams;
+}
+
+long snmp_get_dropped(void)
+{
+	return snmp_dropped;
+}
+
+long snmp_get_informs(void)
+{
+	return snmp_informs;
+}
+
+long snmp_get_batches(void)
+{
+	return snmp_batches;
+}
+
+long snmp_get_kernel_drops(void)
+{
+	return (long) snmp_kernel_drops;
+}
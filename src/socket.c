@@ -23,23 +23,24 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "nagiostrapd.h"
 
 
-/* buffer size when reading from socket */
-#define SCK_BUF_SIZE 1024
+/* how long we wait for the peer to drain its receive buffer (ms) */
+#define SCK_SEND_TIMEOUT 5000
 
 
 
-unsigned int socket_create(int port_number, int reuse_addr, int local_only)
+unsigned int socket_create(int port_number, int reuse_addr, int reuse_port, int local_only)
 {
 	int sock = 0;
 	struct sockaddr_in address;
 
 
 	/* create a new socket */
-	sock = socket(AF_INET, SOCK_STREAM, 0);
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
 	if (sock < 0)
 		log_critical(errno, "cannot create socket");
@@ -47,6 +48,9 @@ unsigned int socket_create(int port_number, int reuse_addr, int local_only)
 	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof reuse_addr) < 0)
 		log_critical(errno, "cannot set socket options");
 
+	if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof reuse_port) < 0)
+		log_critical(errno, "cannot set SO_REUSEPORT (kernel too old?)");
+
 	/* fill-in address information */
 	address.sin_family = AF_INET;
 	address.sin_port = htons(port_number);
@@ -65,6 +69,46 @@ unsigned int socket_create(int port_number, int reuse_addr, int local_only)
 }
 
 
+/*
+ * UDP socket for native SNMP traps (agents send from anywhere, so
+ * :localhost_only does not apply here)
+ */
+
+unsigned int socket_create_udp(int port_number, int reuse_port)
+{
+	int sock = 0;
+	int one = 1;
+	struct sockaddr_in address;
+
+
+	/* create a new socket */
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (sock < 0)
+		log_critical(errno, "cannot create socket");
+
+	if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof reuse_port) < 0)
+		log_critical(errno, "cannot set SO_REUSEPORT (kernel too old?)");
+
+	/* have the kernel report datagrams dropped for lack of buffer space */
+	if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof one) < 0)
+		log_warning(errno, "cannot set SO_RXQ_OVFL, kernel drops will not be counted");
+
+	/* fill-in address information */
+	memset(&address, 0, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port_number);
+
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	/* bind to socket */
+	if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0)
+		log_critical(errno, "cannot bind() on UDP port %d", port_number);
+
+	return (unsigned int) sock;
+}
+
+
 unsigned int socket_create_unix(char *path)
 {
 	int sock = 0;
@@ -72,7 +116,7 @@ unsigned int socket_create_unix(char *path)
 
 
 	/* create a new socket */
-	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
 	if (sock < 0)
 		log_critical(errno, "cannot create socket");
@@ -94,12 +138,22 @@ unsigned int socket_create_unix(char *path)
 
 void socket_set_nonblocking(int sock)
 {
-	long arg;
-
-
 	if (!!strcmp(config_get_option_value(":socket_set_nonblocking"), "true"))
 		return;
 
+	socket_force_nonblocking(sock);
+}
+
+
+/*
+ * the event loop needs non-blocking sockets, whatever the config says
+ */
+
+void socket_force_nonblocking(int sock)
+{
+	long arg;
+
+
 	if((arg = fcntl(sock, F_GETFL, NULL)) < 0)
 		log_critical(errno, "cannot fcntl(..., F_GETFL) on fd %d", sock);
 
@@ -110,61 +164,46 @@ void socket_set_nonblocking(int sock)
 }
 
 
-char *socket_read_pdu(int fd)
-{
-	/* input buffer */
-	char in_buf[SCK_BUF_SIZE];
-
-	/* dynamically allocated buffer */
-	char *buffer;
+/*
+ * send the whole buffer, waiting for room when the socket is non-blocking
+ */
 
-	/* return code */
+int socket_send(int fd, const char *buffer, size_t len)
+{
 	ssize_t retcode;
-
-	size_t alloclen, bufferlen;
-
-
-	DEBUG("called on socket descriptor %d", fd);
-	
-	buffer = xmalloc(SCK_BUF_SIZE);
-	alloclen = SCK_BUF_SIZE;
-	bufferlen = 0;
-
-	while ((retcode = recv(fd, in_buf, SCK_BUF_SIZE, 0)) > 0) {
-		int i, cr_found;
-		/* accept only first line */
-		for (i = 0, cr_found = 0; in_buf[i] != '\0' && i < retcode; i++) {
-			if (in_buf[i] == '\n' || in_buf[i] == '\r') {
-				in_buf[i] = '\0';
-				cr_found = 1;
-				break;
+	struct pollfd pfd;
+
+	while (len > 0) {
+		retcode = send(fd, buffer, len, MSG_NOSIGNAL);
+
+		if (retcode < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				retcode = poll(&pfd, 1, SCK_SEND_TIMEOUT);
+				if (retcode < 0 && errno == EINTR)
+					continue;
+				if (retcode < 0) {
+					log_error(errno, "cannot poll() fd %d for sending", fd);
+					return 0;
+				}
+				if (retcode == 0) {
+					log_error(0, "timeout while sending on fd %d: peer not reading for %d ms", fd, SCK_SEND_TIMEOUT);
+					return 0;
+				}
+				continue;
 			}
+
+			DEBUG("send() error on fd %d: %s", fd, strerror(errno));
+			return 0;
 		}
-		if (bufferlen+retcode > alloclen) {
-			alloclen = bufferlen + retcode + 2*alloclen;
-			buffer = xrealloc(buffer, alloclen);
-		}
-		memcpy(buffer+bufferlen, in_buf, retcode);
-		bufferlen += retcode;
 
-		if (cr_found) break;
+		buffer += retcode;
+		len -= retcode;
 	}
 
-	if (retcode < 0) {
-		/* if error ... */
-		log_error(errno, "recv() error detected, possibly lost pdu...");
-
-		return NULL;
-	} else {
-		/* zero-terminate buffer (make sure!) */
-		buffer[bufferlen] = '\0';
-
-		/* maybe the buffer was already zero-terminated in the cycle above */
-		bufferlen = strlen(buffer);
-
-		/* if pdu successfully received... */
-		DEBUG("raw pdu received (len: %d): %s", bufferlen, buffer);
-		
-		return buffer;
-	}
+	return 1;
 }
@@ -0,0 +1,462 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     spawn.c --- run plugins without a shell
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A plugin command line (and the quoted trap contents appended to it) is
+ * split into words here, following the quoting rules of sh(1), and the
+ * plugin is started with posix_spawn(): glibc implements it with a
+ * vfork()-like clone, so its cost doesn't grow with the size of the daemon,
+ * and no /bin/sh is run to parse the quoting again.
+ *
+ * A command line that really needs a shell (pipes, redirections,
+ * expansions, ...) is still handed to /bin/sh -c.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+extern char **environ;
+
+/* posix_spawn_file_actions_addclosefrom_np() came with glibc 2.34 */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+# define HAVE_CLOSEFROM_NP
+#endif
+
+/* unquoted, these mean the command line needs a real shell */
+#define SHELL_METACHARS "|&;<>()$`*?[]{}~#"
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+#ifndef HAVE_CLOSEFROM_NP
+
+/*
+ * without closefrom: close in the child whatever is open and not marked
+ * close-on-exec (ours all are; the MySQL client's socket is not)
+ */
+
+static void close_inherited(posix_spawn_file_actions_t *actions)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int fd, flags;
+
+	if ((dir = opendir("/proc/self/fd")) == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+			continue;
+
+		fd = atoi(entry->d_name);
+		if (fd <= STDERR_FILENO || fd == dirfd(dir))
+			continue;
+
+		if ((flags = fcntl(fd, F_GETFD)) != -1 && !(flags & FD_CLOEXEC))
+			posix_spawn_file_actions_addclose(actions, fd);
+	}
+
+	closedir(dir);
+}
+
+#endif
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * split LINE into words as sh(1) would (quotes and backslashes); returns a
+ * NULL-terminated vector, to be released with free() alone, or NULL if
+ * LINE needs a shell (or is unbalanced).  If LINE IS_COMMAND, a first word
+ * like VAR=value is an assignment, which needs a shell too
+ */
+
+char **spawn_split_args(const char *line, int is_command)
+{
+	enum { S_BLANK, S_WORD, S_SINGLE, S_DOUBLE } status = S_BLANK;
+	size_t len, words = 0;
+	const char *s;
+	char **argv, *p;
+	char c;
+
+	if (line == NULL)
+		return NULL;
+
+	/* there are at most LEN/2+1 words, no longer than LINE altogether */
+	len = strlen(line);
+	argv = xmalloc((len / 2 + 2) * sizeof *argv + len + 1);
+	p = (char *) (argv + len / 2 + 2);
+
+	for (s = line; (c = *s) != '\0'; s++) {
+		switch (status) {
+			case S_BLANK:
+			case S_WORD:
+				if (c == ' ' || c == '\t' || c == '\n') {
+					if (status == S_WORD) {
+						*p++ = '\0';
+						status = S_BLANK;
+					}
+					continue;
+				}
+
+				if (strchr(SHELL_METACHARS, c) != NULL || (is_command && c == '=' && status == S_WORD && words == 1)) {
+					DEBUG("command line needs a shell: %s", line);
+					free(argv);
+					return NULL;
+				}
+
+				if (status == S_BLANK) {
+					argv[words++] = p;
+					status = S_WORD;
+				}
+
+				if (c == '\'') {
+					status = S_SINGLE;
+				} else if (c == '"') {
+					status = S_DOUBLE;
+				} else if (c == '\\') {
+					if (s[1] == '\n')
+						s++;
+					else if (s[1] != '\0')
+						*p++ = *++s;
+				} else {
+					*p++ = c;
+				}
+				break;
+
+			case S_SINGLE:
+				if (c == '\'')
+					status = S_WORD;
+				else
+					*p++ = c;
+				break;
+
+			case S_DOUBLE:
+				if (c == '"') {
+					status = S_WORD;
+				} else if (c == '\\' && (s[1] == '$' || s[1] == '`' || s[1] == '"' || s[1] == '\\')) {
+					*p++ = *++s;
+				} else if (c == '\\' && s[1] == '\n') {
+					s++;
+				} else if (c == '$' || c == '`') {
+					DEBUG("command line needs a shell: %s", line);
+					free(argv);
+					return NULL;
+				} else {
+					*p++ = c;
+				}
+				break;
+		}
+	}
+
+	if (status == S_SINGLE || status == S_DOUBLE) {
+		DEBUG("unbalanced quotes in command line: %s", line);
+		free(argv);
+		return NULL;
+	}
+
+	if (status == S_WORD)
+		*p = '\0';
+
+	argv[words] = NULL;
+
+	return argv;
+}
+
+
+/*
+ * start ARGV[0] (searched in PATH) with IN as its standard input (unless
+ * it's -1) and OUT as its standard output; returns the pid, or -1
+ */
+
+pid_t spawn_plugin_to(char *const *argv, int in, int out)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int err;
+
+	if (argv == NULL || argv[0] == NULL)
+		return -1;
+
+	posix_spawn_file_actions_init(&actions);
+	if (in != -1)
+		posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+	/* sockets and pipes of the daemon are none of the plugin's business */
+#ifdef HAVE_CLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#else
+	close_inherited(&actions);
+#endif
+
+	err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		log_error(err, "cannot spawn %s", argv[0]);
+		return -1;
+	}
+
+	DEBUG("spawned %s (pid %d)", argv[0], (int) pid);
+
+	return pid;
+}
+
+
+/*
+ * start ARGV[0] (searched in PATH) with IN as its standard input (unless
+ * it's -1) and its standard output on a pipe, whose reading end goes into
+ * *FD; returns the pid, or -1
+ */
+
+pid_t spawn_plugin(char *const *argv, int in, int *fd)
+{
+	int pipefd[2];
+	pid_t pid;
+
+	if (argv == NULL || argv[0] == NULL)
+		return -1;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		log_error(errno, "cannot create pipe for %s", argv[0]);
+		return -1;
+	}
+
+	pid = spawn_plugin_to(argv, in, pipefd[1]);
+	close(pipefd[1]);
+
+	if (pid == -1) {
+		close(pipefd[0]);
+		return -1;
+	}
+
+	*fd = pipefd[0];
+
+	return pid;
+}
+
+
+/*
+ * start ARGV[0] (searched in PATH) with both its standard input and output
+ * on pipes: *IN is for writing to it, *OUT for reading from it; returns the
+ * pid, or -1
+ */
+
+pid_t spawn_coprocess(char *const *argv, int *in, int *out)
+{
+	int inpipe[2], outpipe[2];
+	pid_t pid;
+
+	if (argv == NULL || argv[0] == NULL)
+		return -1;
+
+	if (pipe2(inpipe, O_CLOEXEC) == -1) {
+		log_error(errno, "cannot create pipe for %s", argv[0]);
+		return -1;
+	}
+
+	if (pipe2(outpipe, O_CLOEXEC) == -1) {
+		log_error(errno, "cannot create pipe for %s", argv[0]);
+		close(inpipe[0]);
+		close(inpipe[1]);
+		return -1;
+	}
+
+	pid = spawn_plugin_to(argv, inpipe[0], outpipe[1]);
+	close(inpipe[0]);
+	close(outpipe[1]);
+
+	if (pid == -1) {
+		close(inpipe[1]);
+		close(outpipe[0]);
+		return -1;
+	}
+
+	*in = inpipe[1];
+	*out = outpipe[0];
+
+	return pid;
+}
+
+
+/*
+ * a read-only copy of DATA, to be given to a plugin as its standard input:
+ * a sealed memfd, positioned at the start; -1 if the kernel has none
+ */
+
+int spawn_memfd(const char *data, size_t len)
+{
+#ifdef MFD_ALLOW_SEALING
+	ssize_t res;
+	size_t done = 0;
+	int fd;
+
+	if ((fd = memfd_create("trap", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) {
+		DEBUG("memfd_create() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	while (done < len) {
+		if ((res = write(fd, data + done, len - done)) == -1) {
+			if (errno == EINTR)
+				continue;
+			log_error(errno, "cannot write trap into memfd");
+			close(fd);
+			return -1;
+		}
+		done += res;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1
+		|| lseek(fd, 0, SEEK_SET) == -1) {
+		log_error(errno, "cannot seal memfd");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	(void) data;
+	(void) len;
+	return -1;
+#endif
+}
+
+
+/*
+ * a pidfd for PID, which must not have been reaped yet; -1 if the kernel
+ * has none
+ */
+
+int spawn_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	if (pid > 0)
+		return syscall(SYS_pidfd_open, pid, 0);
+#endif
+	(void) pid;
+	return -1;
+}
+
+
+/*
+ * send SIG to a plugin, through PIDFD if there is one: PID may have been
+ * reaped, and reused, by then
+ */
+
+int spawn_signal(int pidfd, pid_t pid, int sig)
+{
+#ifdef SYS_pidfd_send_signal
+	if (pidfd != -1)
+		return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#endif
+	if (pid <= 0)
+		return -1;
+
+	return kill(pid, sig);
+}
+
+
+/*
+ * CPU time (user and system, ms) PID has taken so far, -1 if unknown: from
+ * /proc, for a process that is alive and ours, or not reaped yet
+ */
+
+long spawn_cpu_ms(pid_t pid)
+{
+	char path[32], buf[1024], *p;
+	unsigned long utime, stime;
+	long ticks;
+	ssize_t len;
+	int fd, i;
+
+	if (pid <= 0 || (ticks = sysconf(_SC_CLK_TCK)) <= 0)
+		return -1;
+
+	snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	len = read(fd, buf, sizeof buf - 1);
+	close(fd);
+
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	/* the command name may hold anything: the fields start after its ')' */
+	if ((p = strrchr(buf, ')')) == NULL)
+		return -1;
+
+	/* utime and stime are the 12th and 13th fields from there */
+	for (i = 0; i < 12 && p != NULL; i++)
+		p = strchr(p + 1, ' ');
+	if (p == NULL || sscanf(p, " %lu %lu", &utime, &stime) != 2)
+		return -1;
+
+	return (long) ((utime + stime) * 1000 / ticks);
+}
+
+
+/*
+ * reap a plugin; returns its exit status, or -1
+ */
+
+int spawn_wait(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			DEBUG("cannot wait for pid %d", (int) pid);
+			return -1;
+		}
+	}
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
@@ -53,7 +53,7 @@ void standalone_start_main_loop(const char *oid, const char *command)
 	struct pdu_t *pdu;
 	char *serialized_trap;
 
-	char *response;
+	const char *response;
 
 	trap_handler = command_expand_1(command);
 
@@ -70,8 +70,6 @@ void standalone_start_main_loop(const char *oid, const char *command)
 			/* send response */
 			printf("%s\n", response);
 
-			free(response);
-
 			/* log & exec trap */
 			if ((trap = trap_is_trap(pdu)) != NULL) {
 				int executed;
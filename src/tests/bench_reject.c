@@ -0,0 +1,177 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     bench_reject.c --- the cost of a trap nobody handles
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A trap is parsed as a connection would get it, first with a handler
+ * for it, then without.  Without one, the parser gives up as soon as it
+ * has found the snmpTrapOID varbind, which snmptrapd puts second: the
+ * rest of the line is only skipped.  The same unhandled trap with its
+ * snmpTrapOID moved last is the worst case: the varbinds before it are
+ * skipped from tokenizer to tokenizer, but not parsed.  With a handler,
+ * that ordering costs one more pass over the line.
+ *
+ * db_may_handle_oid() is stubbed, so the Bloom filter lookup in db.c is
+ * not part of the figures.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../nagiostrapd.h"
+#include "check.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* how long each measure runs for */
+#define BENCH_NS 300000000L
+
+#define NVARBINDS 8
+
+#define HEADER "TRAP :: nagios.example.com :: UDP: [192.168.3.96]:47603->[127.0.0.1] :: "
+#define UPTIME ".1.3.6.1.2.1.1.3.0 5:19:31:34.58"
+#define TRAPOID ".1.3.6.1.6.3.1.1.4.1.0 .1.3.6.1.4.1.20006.1.5"
+
+extern int stubs_db_handles;
+
+/* snmpTrapOID second, as snmptrapd sends it, or last */
+static char early[4096];
+static char late[4096];
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+/*
+ * a service alert: a few short varbinds and a long plugin output
+ */
+
+static size_t varbinds(char *buffer)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 1; i <= NVARBINDS; i++) {
+		len += sprintf(buffer + len, " :: .1.3.6.1.4.1.20006.1.1.1.%d \"%s\"", i,
+			i < NVARBINDS ? "web-frontend-07.dc2.example.com" :
+			"CRITICAL - Socket timeout after 10 seconds; HTTP 503 Service Unavailable "
+			"from /healthz (3 retries), upstream pool 'api' has 0 of 12 members up");
+	}
+
+	return len;
+}
+
+
+static void build_traps(void)
+{
+	size_t len;
+
+	len = sprintf(early, "%s%s :: %s", HEADER, UPTIME, TRAPOID);
+	len += varbinds(early + len);
+	strcpy(early + len, "\n");
+
+	len = sprintf(late, "%s%s", HEADER, UPTIME);
+	len += varbinds(late + len);
+	sprintf(late + len, " :: %s\n", TRAPOID);
+}
+
+
+/*
+ * traps per second through the parser, TRAP is expected to yield no
+ * trap to run when HANDLED is clear
+ */
+
+static double parse(const char *trap, int handled)
+{
+	struct pdu_t *pdu;
+	long start, elapsed, traps = 0, unhandled;
+	int ok = 1;
+
+	stubs_db_handles = handled;
+	unhandled = trap_get_trap_unhandled();
+	start = now_ns();
+
+	do {
+		pdu = trap_pdu_process(trap, 0);
+		ok &= (trap_is_trap(pdu) != NULL) == handled;
+		trap_free_pdu(pdu);
+		traps++;
+	} while ((elapsed = now_ns() - start) < BENCH_NS);
+
+	CHECK(ok);
+	CHECK(trap_get_trap_unhandled() - unhandled == (handled ? 0 : traps));
+
+	return (double) traps / elapsed * 1e9;
+}
+
+
+
+/*
+ *     Main
+ *
+ ******************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+	double handled, handled_late, rejected, rejected_late;
+
+	(void) argc;
+
+	if (check_config("trap_tokenizer = ::\nunhandled_trap_log_sample = 0\n") != 0)
+		return 1;
+
+	log_init(0, 0);
+	oid_init();
+	scan_init();
+	trap_init();
+
+	build_traps();
+
+	handled = parse(early, 1);
+	handled_late = parse(late, 1);
+	rejected = parse(early, 0);
+	rejected_late = parse(late, 0);
+
+	printf("%zu-byte trap, %d varbinds after snmpTrapOID\n", strlen(early), NVARBINDS);
+	printf("%-32s %10.0f/s\n", "handled", handled);
+	printf("%-32s %10.0f/s\n", "handled, snmpTrapOID last", handled_late);
+	printf("%-32s %10.0f/s\n", "unhandled, snmpTrapOID last", rejected_late);
+	printf("%-32s %10.0f/s  (%.1fx)\n", "unhandled, snmpTrapOID second", rejected, rejected / rejected_late);
+
+	return check_report(argv[0]);
+}
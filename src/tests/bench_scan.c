@@ -0,0 +1,222 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     bench_scan.c --- the delimiter scanners, one against the other
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * scan.c is built into this driver, so that each of its implementations
+ * can be forced in turn.  They must all agree on where the first delimiter
+ * is, wherever it falls relative to a vector; then they are timed on what
+ * the daemon asks of them: finding line ends in what a connection reads,
+ * finding word ends in a trap line, and parsing whole traps.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../scan.c"
+#include "check.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* how long each measure runs for */
+#define BENCH_NS 300000000L
+
+#define STREAM_SIZE (1 << 20)
+
+struct impl_t {
+	const char *name;
+	scan_any3_t any3;
+	const char *feature;
+};
+
+static const struct impl_t impls[] = {
+	{ "scalar", any3_scalar, NULL },
+#ifdef SCAN_X86
+	{ "SSE2", any3_sse2, "sse2" },
+	{ "AVX2", any3_avx2, "avx2" },
+#endif
+};
+
+#define NIMPLS (sizeof impls / sizeof *impls)
+
+
+static const char *raw_trap =
+	"TRAP :: localhost.localdomain :: UDP: [192.168.3.96]:47603->[127.0.0.1] :: "
+	".1.3.6.1.2.1.1.3.0 5:19:31:34.58 :: "
+	".1.3.6.1.6.3.1.1.4.1.0 .1.3.6.1.4.1.20006.1.5 :: "
+	".1.3.6.1.4.1.20006.1.1.1.2 \"testhost\" :: "
+	".1.3.6.1.4.1.20006.1.1.1.4 1 :: "
+	".1.3.6.1.4.1.20006.1.1.1.14 \"CRITICAL - Host Unreachable (192.168.3.233)\"\n";
+
+/* what a busy connection reads: trap lines back to back */
+static char *stream;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+static int supported(const struct impl_t *impl)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+
+	if (impl->feature != NULL && strcmp(impl->feature, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (impl->feature != NULL && strcmp(impl->feature, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+
+	return impl->feature == NULL;
+}
+
+
+/*
+ * every implementation finds the delimiter the scalar loop finds, at any
+ * offset, in buffers of any length
+ */
+
+static void check_agreement(const struct impl_t *impl)
+{
+	char buffer[160];
+	size_t len, at, expected;
+	int ok = 1;
+
+	for (len = 0; len <= 130 && ok; len++) {
+		for (at = 0; at <= len && ok; at++) {
+			memset(buffer, 'x', sizeof buffer);
+			if (at < len)
+				buffer[at] = "\n\r "[at % 3];
+			/* a delimiter past LEN must not be seen */
+			buffer[len] = '\n';
+
+			expected = any3_scalar(buffer, len, ' ', '\r', '\n');
+			ok = expected == at && impl->any3(buffer, len, ' ', '\r', '\n') == expected;
+		}
+	}
+
+	CHECK(ok);
+}
+
+
+/*
+ * MB/s scanning the stream for A, B or C, a hit at a time
+ */
+
+static double scan_stream(scan_any3_t any3, char a, char b, char c, long *hits)
+{
+	long start, elapsed, bytes = 0;
+	size_t i, n;
+
+	*hits = 0;
+	start = now_ns();
+
+	do {
+		for (i = 0; i < STREAM_SIZE; i += n + 1) {
+			n = any3(stream + i, STREAM_SIZE - i, a, b, c);
+			(*hits)++;
+		}
+		bytes += STREAM_SIZE;
+	} while ((elapsed = now_ns() - start) < BENCH_NS);
+
+	return (double) bytes / elapsed * 1000;
+}
+
+
+static double parse_traps(void)
+{
+	long start, elapsed, traps = 0;
+
+	start = now_ns();
+
+	do {
+		trap_free_pdu(trap_pdu_process(raw_trap, 0));
+		traps++;
+	} while ((elapsed = now_ns() - start) < BENCH_NS);
+
+	return (double) traps / elapsed * 1e9;
+}
+
+
+
+/*
+ *     Main
+ *
+ ******************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+	size_t i, len;
+	long hits;
+	double lines, words, traps;
+
+	(void) argc;
+
+	if (check_config("trap_tokenizer = ::\n") != 0)
+		return 1;
+
+	log_init(0, 0);
+	oid_init();
+	trap_init();
+
+	len = strlen(raw_trap);
+	stream = malloc(STREAM_SIZE);
+	for (i = 0; i < STREAM_SIZE; i++)
+		stream[i] = raw_trap[i % len];
+
+	printf("%-8s %14s %14s %14s\n", "", "line ends", "word ends", "traps parsed");
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (!supported(&impls[i])) {
+			printf("%-8s (not supported by this CPU)\n", impls[i].name);
+			continue;
+		}
+
+		check_agreement(&impls[i]);
+
+		scan_any3_impl = impls[i].any3;
+		lines = scan_stream(impls[i].any3, '\n', '\n', '\n', &hits);
+		words = scan_stream(impls[i].any3, ' ', '\r', '\n', &hits);
+		traps = parse_traps();
+
+		printf("%-8s %9.0f MB/s %9.0f MB/s %12.0f/s\n", impls[i].name, lines, words, traps);
+	}
+
+	free(stream);
+
+	return check_report(argv[0]);
+}
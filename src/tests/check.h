@@ -0,0 +1,91 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     check.h --- bare-bones assertions for the ``make check'' drivers
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static int check_failures = 0;
+static int check_count = 0;
+
+
+#define CHECK(cond) check_that((cond), #cond, __FILE__, __LINE__)
+
+#define CHECK_STR(got, expected) check_str((got), (expected), #got, __FILE__, __LINE__)
+
+
+static inline void check_that(int ok, const char *what, const char *file, int line)
+{
+	check_count++;
+
+	if (!ok) {
+		check_failures++;
+		fprintf(stderr, "FAIL %s:%d: %s\n", file, line, what);
+	}
+}
+
+
+static inline void check_str(const char *got, const char *expected, const char *what, const char *file, int line)
+{
+	check_count++;
+
+	if (got == NULL || strcmp(got, expected)) {
+		check_failures++;
+		fprintf(stderr, "FAIL %s:%d: %s is \"%s\", not \"%s\"\n", file, line, what, got != NULL ? got : "(null)", expected);
+	}
+}
+
+
+/*
+ * load a configuration made of SETTINGS (ini lines) and no db
+ */
+
+static inline int check_config(const char *settings)
+{
+	char ini[] = "/tmp/nagiostrapd-check.XXXXXX";
+	FILE *f;
+	int fd;
+
+	if ((fd = mkstemp(ini)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+		perror("cannot create config file");
+		return -1;
+	}
+	fprintf(f, "db_host = -\ndb_user = -\ndb_password = -\ndb_name = -\n%s", settings);
+	fclose(f);
+
+	config_load(ini, NULL);
+	unlink(ini);
+
+	return 0;
+}
+
+
+/*
+ * what main() returns
+ */
+
+static inline int check_report(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, check_count, check_failures);
+
+	return check_failures > 0;
+}
+
+#endif /* CHECK_H */
@@ -0,0 +1,239 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     check_alloc.c --- heap allocations made while parsing a trap
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * malloc() and friends are replaced here by counting wrappers around
+ * glibc's own allocator.  Once the arena free-list is warm, parsing a
+ * trap (text, whole or fed a few bytes at a time as a connection would,
+ * and native SNMP) and releasing it must not reach the heap at all.
+ *
+ * Debug builds log every token through strdup()'d descriptions, so the
+ * counts are only held to zero when built with -DNDEBUG (production).
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../nagiostrapd.h"
+#include "check.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+#define WARMUP 16
+#define ROUNDS 1000
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static long allocations = 0;
+
+
+static const char *raw_trap =
+	"TRAP :: localhost.localdomain :: UDP: [192.168.3.96]:47603->[127.0.0.1] :: "
+	".1.3.6.1.2.1.1.3.0 5:19:31:34.58 :: "
+	".1.3.6.1.6.3.1.1.4.1.0 .1.3.6.1.4.1.20006.1.5 :: "
+	".1.3.6.1.4.1.20006.1.1.1.2 \"testhost\" :: "
+	".1.3.6.1.4.1.20006.1.1.1.4 1 :: "
+	".1.3.6.1.4.1.20006.1.1.1.14 \"CRITICAL - Host Unreachable (192.168.3.233)\"\n";
+
+
+/* the same trap as an SNMPv2c datagram, community "public" */
+static const unsigned char datagram[] = {
+	0x30, 0x81, 0xae, 0x02, 0x01, 0x01, 0x04, 0x06, 0x70, 0x75, 0x62, 0x6c,
+	0x69, 0x63, 0xa7, 0x81, 0xa0, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02,
+	0x01, 0x00, 0x30, 0x81, 0x94, 0x30, 0x0e, 0x06, 0x08, 0x2b, 0x06, 0x01,
+	0x02, 0x01, 0x01, 0x03, 0x00, 0x43, 0x02, 0x30, 0x39, 0x30, 0x18, 0x06,
+	0x0a, 0x2b, 0x06, 0x01, 0x06, 0x03, 0x01, 0x01, 0x04, 0x01, 0x00, 0x06,
+	0x0a, 0x2b, 0x06, 0x01, 0x04, 0x01, 0x81, 0x9c, 0x26, 0x01, 0x05, 0x30,
+	0x18, 0x06, 0x0c, 0x2b, 0x06, 0x01, 0x04, 0x01, 0x81, 0x9c, 0x26, 0x01,
+	0x01, 0x01, 0x02, 0x04, 0x08, 0x74, 0x65, 0x73, 0x74, 0x68, 0x6f, 0x73,
+	0x74, 0x30, 0x11, 0x06, 0x0c, 0x2b, 0x06, 0x01, 0x04, 0x01, 0x81, 0x9c,
+	0x26, 0x01, 0x01, 0x01, 0x04, 0x02, 0x01, 0x01, 0x30, 0x3b, 0x06, 0x0c,
+	0x2b, 0x06, 0x01, 0x04, 0x01, 0x81, 0x9c, 0x26, 0x01, 0x01, 0x01, 0x0e,
+	0x04, 0x2b, 0x43, 0x52, 0x49, 0x54, 0x49, 0x43, 0x41, 0x4c, 0x20, 0x2d,
+	0x20, 0x48, 0x6f, 0x73, 0x74, 0x20, 0x55, 0x6e, 0x72, 0x65, 0x61, 0x63,
+	0x68, 0x61, 0x62, 0x6c, 0x65, 0x20, 0x28, 0x31, 0x39, 0x32, 0x2e, 0x31,
+	0x36, 0x38, 0x2e, 0x33, 0x2e, 0x32, 0x33, 0x33, 0x29
+};
+
+static struct sockaddr_in sender;
+
+
+
+/*
+ *     Counting allocator
+ *
+ ******************************************************************************/
+
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static struct pdu_t *parse_whole(void)
+{
+	return trap_pdu_process(raw_trap, 0);
+}
+
+
+/* as a connection would, the bytes trickling in a few at a time */
+static struct pdu_t *parse_pieces(void)
+{
+	struct trap_parser_t *p;
+	size_t len = strlen(raw_trap);
+	size_t i, n;
+
+	p = trap_parser_new(0);
+
+	for (i = 0; i < len; i += n) {
+		n = len - i < 7 ? len - i : 7;
+		trap_parser_feed(p, raw_trap + i, n);
+	}
+
+	return trap_parser_finish(p);
+}
+
+
+static struct pdu_t *decode_datagram(void)
+{
+	return snmp_process_datagram(-1, datagram, sizeof datagram, &sender);
+}
+
+
+/*
+ * allocations per trap made by PARSE, once warm
+ */
+
+static double per_trap(const char *name, struct pdu_t *(*parse)(void))
+{
+	struct pdu_t *pdu;
+	long before;
+	int i, traps = 0;
+	double result;
+
+	for (i = 0; i < WARMUP; i++)
+		trap_free_pdu(parse());
+
+	before = allocations;
+
+	for (i = 0; i < ROUNDS; i++) {
+		pdu = parse();
+		if (pdu != NULL && trap_is_trap(pdu) != NULL && trap_get_value(trap_is_trap(pdu), oid_lookup(".1.3.6.1.4.1.20006.1.1.1.2", 26)) != NULL)
+			traps++;
+		trap_free_pdu(pdu);
+	}
+
+	result = (double) (allocations - before) / ROUNDS;
+
+	printf("%-16s %d/%d traps, %.2f allocations per trap\n", name, traps, ROUNDS, result);
+	CHECK(traps == ROUNDS);
+
+	return result;
+}
+
+
+
+/*
+ *     Main
+ *
+ ******************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+	static const char *watched[] = {
+		".1.3.6.1.2.1.1.3.0", ".1.3.6.1.4.1.20006.1.1.1.2",
+		".1.3.6.1.4.1.20006.1.1.1.4", ".1.3.6.1.4.1.20006.1.1.1.14"
+	};
+	double whole, pieces, native;
+	size_t i;
+
+	(void) argc;
+
+	/* the tokenizer of the raw traps above */
+	if (check_config("snmp_community = public\ntrap_tokenizer = ::\n") != 0)
+		return 1;
+
+	log_init(0, 0);
+	oid_init();
+	scan_init();
+	trap_init();
+	snmp_init();
+
+	for (i = 0; i < sizeof watched / sizeof *watched; i++)
+		oid_intern(watched[i], strlen(watched[i]));
+
+	memset(&sender, 0, sizeof sender);
+	sender.sin_family = AF_INET;
+	sender.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	whole = per_trap("text, whole", parse_whole);
+	pieces = per_trap("text, in pieces", parse_pieces);
+	native = per_trap("SNMPv2c", decode_datagram);
+
+#ifdef NDEBUG
+	CHECK(whole == 0);
+	CHECK(pieces == 0);
+	CHECK(native == 0);
+#else
+	(void) whole;
+	(void) pieces;
+	(void) native;
+#endif
+
+	return check_report(argv[0]);
+}
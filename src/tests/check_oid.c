@@ -0,0 +1,267 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     check_oid.c --- OID pattern matching
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A few handpicked cases, then random sets of patterns matched against
+ * random OIDs and compared with a brute-force reference.  The most
+ * specific pattern is the one whose arcs, read left to right, are literal
+ * for longest (a literal arc before a "*", either before a trailing "*"),
+ * and of course it must match.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../nagiostrapd.h"
+#include "check.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+#define MAX_DEPTH 7
+#define PATTERNS 300
+#define ROUNDS 200
+#define LOOKUPS 500
+
+/* -1 stands for "*" */
+struct pattern_t {
+	int narcs;
+	int arcs[MAX_DEPTH];
+	int subtree;
+	char text[64];
+};
+
+static struct pattern_t patterns[PATTERNS];
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+static void *match(struct oid_trie_t *trie, const char *oid)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t narcs;
+
+	narcs = oid_parse(oid, strlen(oid), arcs);
+
+	return oid_trie_match(trie, arcs, narcs);
+}
+
+
+static void check_cases(void)
+{
+	struct oid_trie_t *trie = oid_trie_new();
+	static int a, b, c, d, e;
+
+	CHECK(oid_trie_insert(trie, ".1.3.6.1.4.1.20006.1.5", &a));
+	CHECK(oid_trie_insert(trie, ".1.3.6.1.4.1.20006.*", &b));
+	CHECK(oid_trie_insert(trie, ".1.3.6.1.4.1.*.1.5", &c));
+	CHECK(oid_trie_insert(trie, ".1.3.6.1.4.1.20006.1.*", &d));
+	CHECK(oid_trie_insert(trie, ".1.3.*.1.4.1.9.9.41.2", &e));
+
+	CHECK(match(trie, ".1.3.6.1.4.1.20006.1.5") == &a);
+	/* a literal arc wins over "*", wherever it is */
+	CHECK(match(trie, ".1.3.6.1.4.1.20006.1.6") == &d);
+	CHECK(match(trie, ".1.3.6.1.4.1.20006.2.5") == &b);
+	CHECK(match(trie, ".1.3.6.1.4.1.9.1.5") == &c);
+	/* the literal branch leads nowhere: back to the "*" one */
+	CHECK(match(trie, ".1.3.6.1.4.1.9.9.41.2") == &e);
+	/* a trailing "*" needs at least one arc */
+	CHECK(match(trie, ".1.3.6.1.4.1.20006") == NULL);
+	CHECK(match(trie, ".1.3.6.1.4.1.9.1.6") == NULL);
+	CHECK(match(trie, ".1.3.6.1.4.1.20006.1.5.0") == &d);
+}
+
+
+/*
+ * every combination of "1" and "*" on 8 arcs, then ".5": hundreds of
+ * nodes match a prefix of some OIDs
+ */
+
+static void check_wildcards(void)
+{
+	static char texts[256][32];
+	struct oid_trie_t *trie = oid_trie_new();
+	size_t len;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		for (j = 0, len = 0; j < 8; j++)
+			len += sprintf(texts[i] + len, (i >> (7 - j)) & 1 ? ".*" : ".1");
+		strcpy(texts[i] + len, ".5");
+		oid_trie_insert(trie, texts[i], texts[i]);
+	}
+
+	CHECK_STR(match(trie, ".1.1.1.1.1.1.1.1.5"), ".1.1.1.1.1.1.1.1.5");
+	CHECK_STR(match(trie, ".1.1.1.1.1.1.1.2.5"), ".1.1.1.1.1.1.1.*.5");
+	CHECK_STR(match(trie, ".2.1.1.1.1.1.1.2.5"), ".*.1.1.1.1.1.1.*.5");
+	CHECK_STR(match(trie, ".2.2.2.2.2.2.2.2.5"), ".*.*.*.*.*.*.*.*.5");
+	CHECK(match(trie, ".1.1.1.1.1.1.1.1.6") == NULL);
+}
+
+
+static void random_pattern(struct pattern_t *p)
+{
+	size_t len;
+	int i;
+
+	p->narcs = 1 + rand() % MAX_DEPTH;
+	p->subtree = p->narcs > 1 && rand() % 3 == 0;
+
+	len = 0;
+	for (i = 0; i < p->narcs; i++) {
+		/* a trailing "*" is the subtree, not one more arc */
+		if (p->subtree && i == p->narcs - 1) {
+			len += sprintf(p->text + len, ".*");
+			break;
+		}
+		/* ...and a trailing one is always that */
+		p->arcs[i] = i < p->narcs - 1 && rand() % 4 == 0 ? -1 : 1 + rand() % 3;
+		if (p->arcs[i] < 0)
+			len += sprintf(p->text + len, ".*");
+		else
+			len += sprintf(p->text + len, ".%d", p->arcs[i]);
+	}
+
+	if (p->subtree)
+		p->narcs--;
+}
+
+
+/*
+ * the choices a search makes to reach P for ARCS (0 literal, 1 "*", 2 stop
+ * at a subtree) into KEY; returns its length, -1 if P does not match
+ */
+
+static int choices(const struct pattern_t *p, const int *arcs, int narcs, int *key)
+{
+	int i;
+
+	if (p->subtree ? p->narcs >= narcs : p->narcs != narcs)
+		return -1;
+
+	for (i = 0; i < p->narcs; i++) {
+		if (p->arcs[i] >= 0 && p->arcs[i] != arcs[i])
+			return -1;
+		key[i] = p->arcs[i] < 0;
+	}
+
+	if (p->subtree)
+		key[i++] = 2;
+
+	return i;
+}
+
+
+static void *reference(int count, const int *arcs, int narcs)
+{
+	int key[MAX_DEPTH + 1], best[MAX_DEPTH + 1];
+	int n, best_n = -1, i, j, cmp;
+	void *value = NULL;
+
+	for (i = 0; i < count; i++) {
+		if ((n = choices(&patterns[i], arcs, narcs, key)) < 0)
+			continue;
+
+		for (j = 0, cmp = 0; cmp == 0 && j < n && j < best_n; j++)
+			cmp = key[j] - best[j];
+
+		/* the same pattern inserted again replaces the old value */
+		if (best_n < 0 || cmp < 0 || (cmp == 0 && n == best_n)) {
+			memcpy(best, key, n * sizeof *key);
+			best_n = n;
+			value = &patterns[i];
+		}
+	}
+
+	return value;
+}
+
+
+static void check_random(void)
+{
+	struct oid_trie_t *trie;
+	int arcs[MAX_DEPTH], narcs;
+	char oid[64];
+	size_t len;
+	int round, i, j, count, ok = 1;
+
+	srand(20006);
+
+	for (round = 0; round < ROUNDS && ok; round++) {
+		trie = oid_trie_new();
+		count = 1 + rand() % PATTERNS;
+
+		for (i = 0; i < count; i++) {
+			random_pattern(&patterns[i]);
+			oid_trie_insert(trie, patterns[i].text, &patterns[i]);
+		}
+
+		for (i = 0; i < LOOKUPS && ok; i++) {
+			narcs = 1 + rand() % MAX_DEPTH;
+			len = 0;
+			for (j = 0; j < narcs; j++) {
+				arcs[j] = 1 + rand() % 3;
+				len += sprintf(oid + len, ".%d", arcs[j]);
+			}
+
+			if (match(trie, oid) != reference(count, arcs, narcs)) {
+				fprintf(stderr, "no match or the wrong one for %s\n", oid);
+				ok = 0;
+			}
+		}
+
+		/* the trie is leaked: there is no oid_trie_free() */
+	}
+
+	CHECK(ok);
+}
+
+
+
+/*
+ *     Main
+ *
+ ******************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+	(void) argc;
+
+	if (check_config("") != 0)
+		return 1;
+
+	log_init(0, 0);
+	oid_init();
+
+	check_cases();
+	check_wildcards();
+	check_random();
+
+	return check_report(argv[0]);
+}
@@ -0,0 +1,135 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     check_trap.c --- a trap as the trap log gets it
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * A trap is serialized with an OID name table loaded: as received unless
+ * :oid_name_translation is on, and then with the OIDs shown by a longer
+ * name than the one received, for which the buffer must have room.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../nagiostrapd.h"
+#include "check.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* by OID, an empty line, by descriptor (see mib.c) */
+static const char *name_table =
+	".1.3.6.1.2.1.1.3 SNMPv2-MIB::sysUpTime\n"
+	".1.3.6.1.4.1.20006.1 NAGIOS-NOTIFY-MIB::nagiosNotify\n"
+	".1.3.6.1.6.3.1.1.4.1 SNMPv2-MIB::snmpTrapOID\n"
+	"\n"
+	"nagiosNotify .1.3.6.1.4.1.20006.1\n"
+	"snmpTrapOID .1.3.6.1.6.3.1.1.4.1\n"
+	"sysUpTime .1.3.6.1.2.1.1.3\n";
+
+static const char *raw_trap =
+	"TRAP :: localhost.localdomain :: UDP: [192.168.3.96]:47603->[127.0.0.1] :: "
+	".1.3.6.1.2.1.1.3.0 5:19:31:34.58 :: "
+	".1.3.6.1.6.3.1.1.4.1.0 .1.3.6.1.4.1.20006.1.5 :: "
+	".1.3.6.1.4.1.20006.1.1.1.2 \"testhost\"\n";
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * the serialized trap, past its timestamp
+ */
+
+static void check_serialized(const char *expected)
+{
+	struct pdu_t *pdu;
+	char *line;
+
+	pdu = trap_pdu_process(raw_trap, 0);
+	CHECK(trap_is_trap(pdu) != NULL);
+
+	if ((line = trap_serialize(trap_is_trap(pdu), 1, ",")) != NULL) {
+		CHECK_STR(strchr(line, ','), expected);
+		free(line);
+	} else {
+		CHECK(line != NULL);
+	}
+
+	trap_free_pdu(pdu);
+}
+
+
+
+/*
+ *     Main
+ *
+ ******************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+	char table[] = "/tmp/nagiostrapd-oids.XXXXXX";
+	char settings[256];
+	FILE *f;
+	int fd;
+
+	(void) argc;
+
+	if ((fd = mkstemp(table)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+		perror("cannot create OID name table");
+		return 1;
+	}
+	fputs(name_table, f);
+	fclose(f);
+
+	snprintf(settings, sizeof settings, "trap_tokenizer = ::\noid_name_table = %s\n", table);
+	if (check_config(settings) != 0)
+		return 1;
+
+	log_init(0, 0);
+	oid_init();
+	unlink(table);
+	scan_init();
+	trap_init();
+
+	/* what plugins and log parsers have always got */
+	check_serialized(",OK,localhost.localdomain,192.168.3.96,.1.3.6.1.4.1.20006.1.5,"
+		".1.3.6.1.2.1.1.3.0=\"5:19:31:34.58\" "
+		".1.3.6.1.6.3.1.1.4.1.0=\".1.3.6.1.4.1.20006.1.5\" "
+		".1.3.6.1.4.1.20006.1.1.1.2=\"testhost\"");
+
+	if (check_config("trap_tokenizer = ::\noid_name_translation = true\n") != 0)
+		return 1;
+	trap_init();
+
+	check_serialized(",OK,localhost.localdomain,192.168.3.96,.1.3.6.1.4.1.20006.1.5,"
+		"SNMPv2-MIB::sysUpTime.0=\"5:19:31:34.58\" "
+		"SNMPv2-MIB::snmpTrapOID.0=\"NAGIOS-NOTIFY-MIB::nagiosNotify.5\" "
+		"NAGIOS-NOTIFY-MIB::nagiosNotify.1.1.2=\"testhost\"");
+
+	return check_report(argv[0]);
+}
@@ -0,0 +1,77 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     stubs.c --- what the ``make check'' drivers need of the db and rules
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * The drivers are linked without MySQL and PCRE: every trap is taken to
+ * have a handler in the db (unless a driver clears stubs_db_handles), and
+ * no rule nor notify decoder claims any.  There is no monitor, nor
+ * diagnostics, to speak of either.
+ */
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../nagiostrapd.h"
+
+
+int stubs_db_handles = 1;
+
+
+int db_may_handle_oid(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	(void) oid;
+	(void) arcs;
+	(void) narcs;
+
+	return stubs_db_handles;
+}
+
+
+int notify_may_handle(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	(void) oid;
+	(void) arcs;
+	(void) narcs;
+
+	return 0;
+}
+
+
+int rule_may_handle(oid_t oid, const uint32_t *arcs, size_t narcs)
+{
+	(void) oid;
+	(void) arcs;
+	(void) narcs;
+
+	return 0;
+}
+
+
+char *diagnostics_prepare_write(void)
+{
+	return NULL;
+}
+
+
+void monitor_kill_children(void)
+{
+}
+
+
+int startup_is_completed(void)
+{
+	return 1;
+}
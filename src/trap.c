@@ -37,19 +37,35 @@
 
 struct mib_object_t {
 	char *oid;
+	oid_t oid_id;
 	char *value;
+
+	/* computed on demand by get_quoted_value() */
 	char *quoted_value;
+
+	/* OID and value as shown in the contents (translated, if possible) */
+	const char *shown_oid;
+	const char *shown_value;
 	struct mib_object_t *next;
 };
 
 
 struct trap_t {
+	struct arena_t *arena;
 	time_t seconds;
 	suseconds_t useconds;
 	char *hostname;
 	char *ipaddress;
 	char *oid;
 	struct mib_object_t *object;
+
+	/* OID parsed once: numeric arcs, or interned OID if symbolic */
+	uint32_t *arcs;
+	size_t narcs;
+	oid_t oid_id;
+
+	/* rendered on demand by trap_get_contents() */
+	char *contents;
 };
 
 
@@ -62,20 +78,33 @@ typedef enum {
 } proto_cmd_t;
 
 
+/* a pdu and everything it owns come from the same arena */
 struct pdu_t {
+	struct arena_t *arena;
 	proto_cmd_t command;
 	struct trap_t *trap;
+
+	/* the trap nobody handles, if it was built whole (trap_pdu_new_trap()) */
+	struct trap_t *unhandled;
 };
 
 
-/* tokenizer string */
+/* tokenizer string and length thereof */
 static char *trap_tokenizer;
+static size_t trap_tokenizer_len;
 
 /* trap serialized mode (new/old) */
 static int trap_serialize_mode = 0;
 
-/* number of trap parsed and mutex thereof */
+/* show numeric OIDs by name in the contents (:oid_name_translation) */
+static int translate_oids = 0;
+
+/* log one unhandled trap out of this many (0 = never) */
+static long unhandled_trap_log_sample = 0;
+
+/* number of trap parsed (and of those without handler) and mutex thereof */
 static long trap_parsed = 0;
+static long trap_unhandled = 0;
 static pthread_mutex_t trap_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
@@ -91,7 +120,7 @@ static pthread_mutex_t trap_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
  * extract ip address from string
  */
 
-static char *extract_ipaddress(char *string)
+static char *extract_ipaddress(struct arena_t *arena, const char *string, size_t len)
 {
 	/*
 	 * string is of the form:
@@ -99,143 +128,151 @@ static char *extract_ipaddress(char *string)
 	 *   UDP: [192.168.3.96]:44084->[127.0.0.1]
 	 */
 
-	int found;
-	char c;
-	char *start, *address;
-	size_t len = 0;
+	char *address;
+	size_t start, end;
 
-	if (is_empty(string)) {
+	if (len == 0) {
 		DEBUG("called on empty string");
 		return NULL;
 	}
 
 	DEBUG("called on string %s", string);
 
-	found = 0;
-	while ((c = *string++)) {
-		if (c == '[') {
-			found = 1;
-			break;
-		}
-		if (c == '\0') {
-			found = 0;
-			break;
-		}
-	}
-
-	if (found == 0) {
+	if ((start = scan_any3(string, len, '[', '[', '[')) == len) {
 		DEBUG("invalid format");
 		return NULL;
 	}
 
-	start = string;
-
-	DEBUG("start of ip address: %s", start);
+	start++;
+	end = start + scan_any3(string + start, len - start, ']', ']', ']');
 
-	while ((c = *string++)) {
-		if (c == ']') {
-			found = 1;
-			break;
-		}
-		if (c == '\0') {
-			found = 0;
-			break;
-		}
-
-		len++;
-	}
-
-	if (found == 0) {
+	if (end == len) {
 		DEBUG("invalid format");
 		return NULL;
 	}
 
-	address = xmalloc(len + 1);
-	memcpy(address, start, len);
-	address[len] = '\0';
+	address = arena_strndup(arena, string + start, end - start);
 
-	DEBUG("ip address found: %s (len: %d)", address, len);
+	DEBUG("ip address found: %s (len: %d)", address, end - start);
 
 	return address;
 }
 
 
-static struct pdu_t *alloc_pdu(void)
+static struct pdu_t *alloc_pdu(struct arena_t *arena)
 {
 	struct pdu_t *pdu;
 
 	DEBUG("called");
 
-	pdu = xmalloc(sizeof *pdu);
+	pdu = arena_alloc(arena, sizeof *pdu);
 	memset(pdu, 0, sizeof *pdu);
+	pdu->arena = arena;
 
 	return pdu;
 }
 
 
-static struct trap_t *alloc_trap(void)
+static struct trap_t *alloc_trap(struct arena_t *arena)
 {
 	struct trap_t *trap;
 
 	DEBUG("called");
 
-	trap = xmalloc(sizeof *trap);
+	trap = arena_alloc(arena, sizeof *trap);
 	memset(trap, 0, sizeof *trap);
+	trap->arena = arena;
 
 	return trap;
 }
 
 
-static void free_trap(struct trap_t *trap)
+/*
+ * the same as quote(backslash_quote(remove_quotes(VALUE))), in one pass
+ */
+
+static char *quote_value(struct arena_t *arena, const char *value)
 {
-	struct mib_object_t *object, *next;
+	char *result, *t;
+	size_t i, len;
+	int first = 1;
+	char c;
 
-	if (trap == NULL) {
-		DEBUG("called on NULL pointer");
-		return;
-	}
+	len = strlen(value);
+	t = result = arena_alloc(arena, 3 * len + 3);
 
-	DEBUG("called");
+	*t++ = '"';
 
-	object = trap->object;
+	for (i = 0; i < len; i++) {
+		c = value[i];
 
-	while (object != NULL) {
-		DEBUG("freeing list item");
-		next = object->next;
-		free(object->oid);
-		free(object->value);
-		free(object->quoted_value);
-		free(object);
-		object = next;
+		/* leading and trailing double quotes are dropped */
+		if (c == '"' && (i == 0 || i == len-1))
+			continue;
+
+		switch (c) {
+			case '"':
+				*t++ = '\\';
+				*t++ = '\\';
+				break;
+			case '\'': case '\\': case '$': case '`':
+				*t++ = '\\';
+				break;
+			case '#':
+				/* comment char */
+				if (first)
+					*t++ = '\\';
+				break;
+			default:
+				break;
+		}
+
+		*t++ = c;
+		first = 0;
 	}
 
-	DEBUG("no more items to free");
+	*t++ = '"';
+	*t = '\0';
 
-	free(trap->hostname);
-	free(trap->ipaddress);
+	return result;
+}
 
-	/* trap->oid must not be freed as it's a pointer to one of object's oid */
 
-	free(trap);
+static void parse_trap_oid(struct trap_t *trap)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t len = strlen(trap->oid);
 
-	DEBUG("done");
+	if ((trap->narcs = oid_parse(trap->oid, len, arcs)) > 0) {
+		trap->arcs = arena_alloc(trap->arena, trap->narcs * sizeof *arcs);
+		memcpy(trap->arcs, arcs, trap->narcs * sizeof *arcs);
+		trap->oid_id = OID_NONE;
+	} else {
+		trap->arcs = NULL;
+		trap->oid_id = oid_lookup(trap->oid, len);
+	}
 }
 
 
-static int oid_is_snmpTrapOID(const char *oid)
+/*
+ * pre-scan of the snmpTrapOID (LEN bytes) before the trap is complete
+ */
+
+static int is_handled(oid_t oid, const uint32_t *arcs, size_t narcs)
 {
-	int res;
-	
-	if (is_empty(oid)) {
-		DEBUG("called on empty oid");
-		return 0;
-	}
+	return db_may_handle_oid(oid, arcs, narcs) || notify_may_handle(oid, arcs, narcs) || rule_may_handle(oid, arcs, narcs);
+}
 
-	res = (strcmp(oid, "SNMPv2-MIB::snmpTrapOID.0") == 0 || strcmp(oid, ".1.3.6.1.6.3.1.1.4.1.0") == 0);
 
-	DEBUG("called on oid %s, result is %d", oid, res);
+static int may_be_handled(const char *oid, size_t len)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t narcs;
 
-	return res;
+	if ((narcs = oid_parse(oid, len, arcs)) > 0)
+		return is_handled(OID_NONE, arcs, narcs);
+	else
+		return is_handled(oid_lookup(oid, len), NULL, 0);
 }
 
 
@@ -259,8 +296,9 @@ static int post_parse(struct trap_t *trap)
 	object = trap->object;
 
 	while (object != NULL) {
-		if (oid_is_snmpTrapOID(object->oid)) {
+		if (oid_is_snmpTrapOID(object->oid_id)) {
 			trap->oid = object->value;
+			parse_trap_oid(trap);
 			return_true = 1;
 			break;
 		}
@@ -284,35 +322,99 @@ static int post_parse(struct trap_t *trap)
 
 	DEBUG("setting timestamp: %ld.%ld", (long) trap->seconds, (long) trap->useconds);
 
-	/*
-	 * finally, quote values...
-	 */
+	/* values are quoted only if somebody needs them */
 
-	object = trap->object;
+	return 1;
+}
 
-	while (object != NULL) {
-		char *value_1, *value_2;
-
-		if ((value_1 = remove_quotes(object->value)) != NULL) {
-			DEBUG("dequoting (step #1): %s", value_1);
-			if ((value_2 = backslash_quote(value_1)) != NULL) {
-				DEBUG("quoting (step #2): %s", value_2);
-				object->quoted_value = quote(value_2);
-				DEBUG("quoting (step #3): %s", object->quoted_value);
-				free(value_2);
-			} else {
-				DEBUG("cannot quote");
-			}
-			free(value_1);
-		} else {
-			DEBUG("cannot dequote");
-			object->quoted_value = NULL;
-		}
 
-		object = object->next;
+/*
+ * a trap nobody handles is accepted and counted, but not executed: PDU is
+ * left without trap (see trap_pdu_get_unhandled())
+ */
+
+static void reject_unhandled(struct pdu_t *pdu, const char *oid, const char *address)
+{
+	long count;
+
+	pdu->command = PROTO_CMD_TRAP;
+	pdu->unhandled = pdu->trap;
+	pdu->trap = NULL;
+
+	pthread_mutex_lock(&trap_counters_mutex);
+	count = ++trap_unhandled;
+	pthread_mutex_unlock(&trap_counters_mutex);
+
+	DEBUG("no handler for trap %s", oid);
+
+	if (unhandled_trap_log_sample > 0 && (count - 1) % unhandled_trap_log_sample == 0)
+		log_warning(0, "no handler for trap %s from %s (%ld unhandled traps so far)", oid, address, count);
+}
+
+
+/*
+ * a trap is handled by one thread at a time, so no locking is needed
+ */
+
+static const char *get_quoted_value(struct trap_t *trap, struct mib_object_t *object)
+{
+	if (object->quoted_value == NULL) {
+		object->quoted_value = quote_value(trap->arena, object->value);
+		DEBUG("quoted value: %s", object->quoted_value);
 	}
 
-	return 1;
+	return object->quoted_value;
+}
+
+
+/*
+ * the value of OBJECT without the quotes around it (not terminated), and
+ * its length
+ */
+
+static const char *unquoted_value(struct mib_object_t *object, size_t *len)
+{
+	const char *value = object->value;
+
+	*len = strlen(value);
+	if (*len >= 2 && value[0] == '"' && value[*len - 1] == '"') {
+		*len -= 2;
+		return value + 1;
+	}
+
+	return value;
+}
+
+
+/*
+ * numeric OIDs (of the varbind, and the snmpTrapOID value) are shown by
+ * name when the OID name table knows them, and :oid_name_translation is on
+ */
+
+static void translate_oid(struct trap_t *trap, struct mib_object_t *object)
+{
+	uint32_t arcs[OID_MAX_ARCS];
+	size_t narcs;
+	char *name;
+
+	if (object->shown_oid != NULL)
+		return;
+
+	object->shown_oid = object->oid;
+	if (translate_oids && (narcs = oid_parse(object->oid, strlen(object->oid), arcs)) > 0 && (name = mib_translate(trap->arena, arcs, narcs)) != NULL)
+		object->shown_oid = name;
+}
+
+
+static void translate_object(struct trap_t *trap, struct mib_object_t *object)
+{
+	char *name;
+
+	translate_oid(trap, object);
+
+	object->shown_value = get_quoted_value(trap, object);
+	if (translate_oids && oid_is_snmpTrapOID(object->oid_id) && trap->narcs > 0 && (name = mib_translate(trap->arena, trap->arcs, trap->narcs)) != NULL)
+		object->shown_value = quote_value(trap->arena, name);
 }
 
 
@@ -320,6 +422,54 @@ typedef enum {
 	S_STARTED, S_COMMAND_READ, S_HOSTNAME_READ, S_READING_IPADDRESS, S_IPADDRESS_READ, S_OID_READ, S_READING_VALUE, S_VALUE_READ
 } parse_status_t;
 
+
+/*
+ * the parser consumes a pdu in chunks of any size, as they come off the
+ * socket: only the word being read is buffered (a word too long for the
+ * buffer is streamed into the value it belongs to), so a trap with many
+ * varbinds never needs its raw text in memory at once
+ */
+
+struct trap_parser_t {
+	/* the parser lives in the arena of the pdu being built */
+	struct arena_t *arena;
+	int is_private;
+	struct pdu_t *pdu;
+	struct trap_t *trap;
+	struct mib_object_t *object;
+	parse_status_t status;
+	proto_cmd_t proto_cmd;
+	int tokenizer_found;
+
+	/* a simple command was read: ignore the rest */
+	int done;
+
+	/* a word did not fit its buffer */
+	int broken;
+
+	/* the snmpTrapOID has no handler: the rest is skipped */
+	int unhandled;
+	char *unhandled_oid;
+
+	/* the varbinds were looked ahead for the snmpTrapOID (and it has a handler) */
+	int prescanned;
+	int trapoid_checked;
+
+	/* length of object->value */
+	size_t valuelen;
+
+	/* "UDP: [192.168.3.96]:44084->[127.0.0.1]" */
+	char ipbuf[TMPBUFLEN];
+	size_t iplen;
+
+	/* the word being read */
+	char token[TMPBUFLEN];
+	size_t toklen;
+
+	/* the word being read has already been partly appended to the value */
+	int spilled;
+};
+
 #ifndef NDEBUG
 static char *decode_proto_cmd(proto_cmd_t cmd)
 {
@@ -367,34 +517,287 @@ static char *decode_status(parse_status_t status)
 
 
 /*
- * main parser
+ * append LEN bytes to the value being read, after a space if SEPARATE
  */
 
-static struct pdu_t *parse(char *buffer, int is_private)
+static void append_value(struct trap_parser_t *p, const char *s, size_t len, int separate)
 {
-	struct pdu_t *pdu = NULL;
-	struct trap_t *trap = NULL;
-	struct mib_object_t *object = NULL, *old_object;
-	char *str, *token, *saveptr = NULL;
-	parse_status_t status;
-	proto_cmd_t proto_cmd;
-	int tokenizer_found = 0;
-	char ipbuf[TMPBUFLEN];
-	size_t tokenlen = 0, tokenlen2;
+	struct mib_object_t *object = p->object;
 
-	DEBUG("called");
+	object->value = arena_realloc(p->arena, object->value, object->value ? p->valuelen + 1 : 0, p->valuelen + len + 2);
 
-	buffer = remove_chars(buffer, "\n\r");
+	if (separate)
+		object->value[p->valuelen++] = ' ';
 
-	if (is_empty(buffer)) {
-		DEBUG("buffer is empty");
-		pdu = alloc_pdu();
-		pdu->command = PROTO_CMD_INVALID;
-		return pdu;
+	memcpy(object->value + p->valuelen, s, len);
+	p->valuelen += len;
+	object->value[p->valuelen] = '\0';
+}
+
+
+/*
+ * a whole word has been read
+ */
+
+static void parse_token(struct trap_parser_t *p, const char *token, size_t len)
+{
+	struct mib_object_t *object;
+
+	DEBUG("token: %s", token);
+
+#ifndef NDEBUG
+	char *cmd_desc = decode_proto_cmd(p->proto_cmd);
+	char *status_desc = decode_status(p->status);
+	DEBUG("status %s, command %s", status_desc, cmd_desc);
+	free(status_desc);
+	free(cmd_desc);
+#endif
+
+	if (p->proto_cmd != PROTO_CMD_NONE && p->proto_cmd != PROTO_CMD_TRAP) {
+		DEBUG("proto command is of simple type (not TRAP)");
+		p->done = 1;
+		return;
+	}
+
+	if (len == trap_tokenizer_len && memcmp(token, trap_tokenizer, len) == 0) {
+		DEBUG("tokenizer found");
+		p->tokenizer_found = 1;
+	}
+
+	if (p->tokenizer_found && (p->status == S_STARTED || p->status == S_COMMAND_READ)) {
+		DEBUG("tokenizer found and going-ahead condition");
+		p->tokenizer_found = 0;
+		return;
+	}
+
+	switch (p->status) {
+		case S_STARTED:
+			if (strcmp(token, "TRAP") == 0) {
+				DEBUG("cmd TRAP");
+				p->proto_cmd = PROTO_CMD_TRAP;
+			} else if (strcmp(token, "ALIVE?") == 0) {
+				DEBUG("cmd ALIVE");
+				p->proto_cmd = PROTO_CMD_ALIVE;
+			} else if (strcmp(token, "DIAGNOSTICS") == 0) {
+				DEBUG("cmd DIAGNOSTICS");
+				if (p->is_private) {
+					p->proto_cmd = PROTO_CMD_DIAGNOSTICS;
+				} else {
+					DEBUG("not from private socket, invalid");
+					p->proto_cmd = PROTO_CMD_INVALID;
+				}
+			} else {
+				DEBUG("cmd INVALID");
+				p->proto_cmd = PROTO_CMD_INVALID;
+			}
+
+			p->pdu = alloc_pdu(p->arena);
+			p->pdu->command = p->proto_cmd;
+			p->status = S_COMMAND_READ;
+			break;
+		case S_COMMAND_READ:
+			p->trap = alloc_trap(p->arena);
+			p->trap->hostname = arena_strndup(p->arena, token, len);
+			DEBUG("found hostname: %s", p->trap->hostname);
+			p->status = S_HOSTNAME_READ;
+			break;
+		case S_HOSTNAME_READ:
+			memcpy(p->ipbuf, token, len + 1);
+			p->iplen = len;
+			p->status = S_READING_IPADDRESS;
+			break;
+		case S_READING_IPADDRESS:
+			if (p->tokenizer_found == 0) {
+				if (p->iplen + len + 1 >= sizeof p->ipbuf) {
+					p->broken = 1;
+					break;
+				}
+				p->ipbuf[p->iplen] = ' ';
+				memcpy(p->ipbuf + p->iplen + 1, token, len + 1);
+				p->iplen += len + 1;
+			} else {
+				p->trap->ipaddress = extract_ipaddress(p->arena, p->ipbuf, p->iplen);
+				DEBUG("found IPADDRESS: %s", p->trap->ipaddress);
+				p->status = S_IPADDRESS_READ;
+			}
+			break;
+		case S_IPADDRESS_READ:
+			/* fall through */
+		case S_VALUE_READ:
+			object = arena_alloc(p->arena, sizeof *object);
+			if (p->trap->object == NULL)
+				p->trap->object = object;
+			else
+				p->object->next = object;
+			object->value = NULL;
+			object->quoted_value = NULL;
+			object->shown_oid = NULL;
+			object->next = NULL;
+			object->oid = arena_strndup(p->arena, token, len);
+			object->oid_id = oid_lookup(token, len);
+			p->object = object;
+			p->status = S_OID_READ;
+			break;
+		case S_OID_READ:
+			p->valuelen = 0;
+			append_value(p, token, len, 0);
+			p->status = S_READING_VALUE;
+			break;
+		case S_READING_VALUE:
+			if (p->tokenizer_found == 0) {
+				append_value(p, token, len, 1);
+				break;
+			}
+
+			p->status = S_VALUE_READ;
+
+			/* pre-scan: don't bother with the rest of an unhandled trap */
+			if (!p->trapoid_checked && oid_is_snmpTrapOID(p->object->oid_id) && !may_be_handled(p->object->value, p->valuelen)) {
+				p->unhandled = 1;
+				p->unhandled_oid = p->object->value;
+				p->done = 1;
+			}
+			break;
+		default:
+			assert(0);
+			break;
+	}
+
+	p->tokenizer_found = 0;
+}
+
+
+static size_t skip_blanks(const char *s, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len && (s[i] == ' ' || s[i] == '\r' || s[i] == '\n'))
+		i++;
+
+	return i;
+}
+
+
+/*
+ * where the varbind after the one at the start of S begins, LEN if not
+ * in S: the tokenizer is searched for byte by byte, the words before it
+ * are not looked at
+ */
+
+static size_t next_varbind(const char *s, size_t len)
+{
+	size_t i = 0, end;
+	char first = trap_tokenizer[0];
+
+	while ((i += scan_any3(s + i, len - i, first, first, first)) < len) {
+		end = i + trap_tokenizer_len;
+		if (end < len && (i == 0 || s[i-1] == ' ') && (s[end] == ' ' || s[end] == '\r' || s[end] == '\n')
+			&& memcmp(s + i, trap_tokenizer, trap_tokenizer_len) == 0)
+		{
+			return end;
+		}
+		i++;
+	}
+
+	return len;
+}
+
+
+/*
+ * the header is read and S holds the first LEN bytes of the varbinds:
+ * look for the snmpTrapOID varbind in them, so that an unhandled trap is
+ * rejected without the varbinds before it being parsed.  What does not
+ * fit in S is left to parse_token()
+ */
+
+static void prescan(struct trap_parser_t *p, const char *s, size_t len)
+{
+	size_t i = 0, n;
+
+	p->prescanned = 1;
+
+	if (trap_tokenizer_len == 0)
+		return;
+
+	while ((i += skip_blanks(s + i, len - i)) < len) {
+		/* the OID of the varbind */
+		n = scan_any3(s + i, len - i, ' ', '\r', '\n');
+		if (i + n == len)
+			return;
+
+		/* however it is written, snmpTrapOID.0 ends so: spare the others the lookup */
+		if (n < 2 || s[i+n-2] != '.' || s[i+n-1] != '0' || !oid_is_snmpTrapOID(oid_lookup(s + i, n))) {
+			i += n;
+			i += next_varbind(s + i, len - i);
+			continue;
+		}
+
+		/* its value, a single word followed by the tokenizer or the end of the line */
+		i += n;
+		i += skip_blanks(s + i, len - i);
+		n = scan_any3(s + i, len - i, ' ', '\r', '\n');
+		if (n == 0 || i + n == len)
+			return;
+		if (s[i+n] == ' ' && next_varbind(s + i + n, len - i - n) != skip_blanks(s + i + n, len - i - n) + trap_tokenizer_len)
+			return;
+
+		if (may_be_handled(s + i, n)) {
+			p->trapoid_checked = 1;
+		} else {
+			p->unhandled = 1;
+			p->unhandled_oid = arena_strndup(p->arena, s + i, n);
+			p->done = 1;
+		}
+		return;
+	}
+}
+
+
+/*
+ * the word buffer is full: only a value can go on
+ */
+
+static void spill_token(struct trap_parser_t *p)
+{
+	if (p->status == S_OID_READ) {
+		p->valuelen = 0;
+		append_value(p, p->token, p->toklen, 0);
+		p->status = S_READING_VALUE;
+	} else if (p->status == S_READING_VALUE) {
+		append_value(p, p->token, p->toklen, !p->spilled);
 	} else {
-		DEBUG("buffer: %s", buffer);
+		DEBUG("word too long");
+		p->broken = 1;
+	}
+
+	p->spilled = 1;
+	p->toklen = 0;
+}
+
+
+static void end_token(struct trap_parser_t *p)
+{
+	if (p->spilled) {
+		/* never the tokenizer, which is short */
+		if (!p->broken)
+			append_value(p, p->token, p->toklen, 0);
+		p->spilled = 0;
+	} else if (p->toklen > 0) {
+		p->token[p->toklen] = '\0';
+		parse_token(p, p->token, p->toklen);
 	}
 
+	p->toklen = 0;
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
 /*
  * EXAMPLE OF RAW TRAP
  *
@@ -402,189 +805,230 @@ static struct pdu_t *parse(char *buffer, int is_private)
  *
  */
 
- 	DEBUG("trap parsing BEGINS");
+struct trap_parser_t *trap_parser_new(int is_private)
+{
+	struct arena_t *arena;
+	struct trap_parser_t *p;
 
-	for (str = buffer, status = S_STARTED, proto_cmd = PROTO_CMD_NONE; ; str = NULL) {
+	arena = arena_new();
+	p = arena_alloc(arena, sizeof *p);
+	memset(p, 0, sizeof *p);
 
-		token = strtok_r(str, " ", &saveptr);
+	p->arena = arena;
+	p->is_private = is_private;
+	p->status = S_STARTED;
+	p->proto_cmd = PROTO_CMD_NONE;
 
-		if (token == NULL) {
-			DEBUG("token is NULL");
-			break;
-		} else {
-			DEBUG("token: %s", token);
-		}
+	return p;
+}
 
-#ifndef NDEBUG
-		char *cmd_desc = decode_proto_cmd(proto_cmd);
-		char *status_desc = decode_status(status);
-		DEBUG("FOR iteration: status %s, command %s", status_desc, cmd_desc);
-		free(status_desc);
-		free(cmd_desc);
-#endif
 
-		if (proto_cmd != PROTO_CMD_NONE && proto_cmd != PROTO_CMD_TRAP) {
-			DEBUG("proto command is of simple type (not TRAP)");
-			break;
-		}
+/*
+ * consume the next LEN bytes of the pdu (newlines, only found in
+ * length-prefixed frames, separate words like spaces)
+ */
 
-		if (strcmp(token, trap_tokenizer) == 0) {
-			DEBUG("tokenizer found");
-			tokenizer_found = 1;
+void trap_parser_feed(struct trap_parser_t *p, const char *buffer, size_t len)
+{
+	size_t i = 0, n, room;
+
+	while (i < len && !p->done && !p->broken) {
+		/* the rest of the word */
+		n = scan_any3(buffer + i, len - i, ' ', '\r', '\n');
+
+		while (n > 0) {
+			if ((room = sizeof p->token - 1 - p->toklen) == 0) {
+				spill_token(p);
+				room = sizeof p->token - 1;
+			}
+			if (room > n)
+				room = n;
+
+			memcpy(p->token + p->toklen, buffer + i, room);
+			p->toklen += room;
+			i += room;
+			n -= room;
 		}
 
-		if (tokenizer_found && (status == S_STARTED || status == S_COMMAND_READ)) {
-			DEBUG("tokenizer found and going-ahead condition");
-			tokenizer_found = 0;
-			continue;
+		/* the delimiter */
+		if (i < len) {
+			end_token(p);
+			i++;
+
+			if (p->status == S_IPADDRESS_READ && !p->prescanned && !p->done && !p->broken)
+				prescan(p, buffer + i, len - i);
 		}
+	}
+}
 
-		DEBUG("main switch BEGINS");
-
-		switch(status) {
-			case S_STARTED:
-				DEBUG("status S_STARTED");
-				if (strcmp(token, "TRAP") == 0) {
-					DEBUG("cmd TRAP");
-					proto_cmd = PROTO_CMD_TRAP;
-				} else if (strcmp(token, "ALIVE?") == 0) {
-					DEBUG("cmd ALIVE");
-					proto_cmd = PROTO_CMD_ALIVE;
-				} else if (strcmp(token, "DIAGNOSTICS") == 0) {
-					DEBUG("cmd DIAGNOSTICS");
-					if (is_private) {
-						proto_cmd = PROTO_CMD_DIAGNOSTICS;
-					} else {
-						DEBUG("not from private socket, invalid");
-						proto_cmd = PROTO_CMD_INVALID;
-					}
-				} else {
-					DEBUG("cmd INVALID");
-					proto_cmd = PROTO_CMD_INVALID;
-				}
 
-				pdu = alloc_pdu();
-				pdu->command = proto_cmd;
-				status = S_COMMAND_READ;
-				break;
-			case S_COMMAND_READ:
-				DEBUG("status S_COMMAND_READ");
-				trap = alloc_trap();
-				trap->hostname = xstrdup(token);
-				DEBUG("found hostname: %s", trap->hostname);
-				status = S_HOSTNAME_READ;
-				break;
-			case S_HOSTNAME_READ:
-				DEBUG("status S_HOSTNAME_READ");
-				tokenlen = strlen(token);
-				strcpy(ipbuf, token);
-				status = S_READING_IPADDRESS;
-				break;
-			case S_READING_IPADDRESS:
-				DEBUG("status S_READING_IPADDRESS");
-				if (tokenizer_found == 0) {
-					tokenlen2 = strlen(token);
-					ipbuf[tokenlen] = ' ';
-					memcpy(ipbuf+tokenlen+1, token, tokenlen2);
-					tokenlen += tokenlen2 + 1;
-				} else {
-					ipbuf[tokenlen] = '\0';
-					trap->ipaddress = extract_ipaddress(ipbuf);
-					DEBUG("found IPADDRESS: %s", trap->ipaddress);
-					status = S_IPADDRESS_READ;
-				}
-				break;
-			case S_IPADDRESS_READ:
-				DEBUG("status S_IPADDRESS_READ");
-				/* fall through */
-			case S_VALUE_READ:
-				DEBUG("status S_VALUE_READ");
-				old_object = object;
-				object = xmalloc(sizeof *object);
-				if (trap->object == NULL) {
-					trap->object = object;
-				} else {
-					old_object->next = object;
-				}
-				object->value = NULL;
-				object->next = NULL;
-				object->oid = xstrdup(token);
-				status = S_OID_READ;
-				break;
-			case S_OID_READ:
-				tokenlen = strlen(token);
-				object->value = xmalloc(tokenlen + 1);
-				memcpy(object->value, token, tokenlen);
-				status = S_READING_VALUE;
-				break;
-			case S_READING_VALUE:
-				if (tokenizer_found == 0) {
-					tokenlen2 = strlen(token);
-					object->value = xrealloc(object->value, tokenlen+tokenlen2+2);
-					object->value[tokenlen] = ' ';
-					memcpy(object->value+tokenlen+1, token, tokenlen2);
-					tokenlen += tokenlen2 + 1;
-				} else {
-					object->value[tokenlen] = '\0';
-					status = S_VALUE_READ;
-				}
-				break;
-			default:
-				assert(0);
-				break;
+/*
+ * the pdu is over: returns it (the parser is gone with it)
+ */
 
+struct pdu_t *trap_parser_finish(struct trap_parser_t *p)
+{
+	struct pdu_t *pdu;
 
-		}
+	if (!p->done && !p->broken)
+		end_token(p);
 
-		tokenizer_found = 0;
+	if ((pdu = p->pdu) == NULL) {
+		DEBUG("buffer is blank");
+		pdu = alloc_pdu(p->arena);
+		pdu->command = PROTO_CMD_INVALID;
 	}
 
-	if (proto_cmd == PROTO_CMD_TRAP) {
+	if (p->unhandled) {
 
-		if (status == S_READING_VALUE) {
-			object->value[tokenlen] = '\0';
-			status = S_VALUE_READ;
-		}
+		reject_unhandled(pdu, p->unhandled_oid, p->trap->ipaddress);
 
-		if (status != S_IPADDRESS_READ && status != S_VALUE_READ) {
+	} else if (p->proto_cmd == PROTO_CMD_TRAP) {
+
+		if (p->status == S_READING_VALUE)
+			p->status = S_VALUE_READ;
+
+		if (p->broken || (p->status != S_IPADDRESS_READ && p->status != S_VALUE_READ)) {
 			/* malformed trap */
-			free_trap(trap);
 			pdu->command = PROTO_CMD_INVALID;
 			DEBUG("malformed trap!");
+		} else if (!post_parse(p->trap)) {
+			/* cannot post parse trap */
+			pdu->command = PROTO_CMD_INVALID;
+			DEBUG("trap is not post-parsable!");
+		} else if (!is_handled(p->trap->oid_id, p->trap->arcs, p->trap->narcs)) {
+			reject_unhandled(pdu, p->trap->oid, p->trap->ipaddress);
 		} else {
-			if (!post_parse(trap)) {
-				/* cannot post parse trap */
-				free_trap(trap);
-				pdu->command = PROTO_CMD_INVALID;
-				DEBUG("trap is not post-parsable!");
-			} else {
-				/* trap OK */
-				pthread_mutex_lock(&trap_counters_mutex);
-				trap_parsed++;
-				pthread_mutex_unlock(&trap_counters_mutex);
-				pdu->trap = trap;
-				DEBUG("trap is OK!");
-			}
+			/* trap OK */
+			pthread_mutex_lock(&trap_counters_mutex);
+			trap_parsed++;
+			pthread_mutex_unlock(&trap_counters_mutex);
+			pdu->trap = p->trap;
+			DEBUG("trap is OK!");
 		}
-
 	}
 
-	free(buffer);
-
 	return pdu;
 }
 
 
+/*
+ * throw away a partial pdu
+ */
+
+void trap_parser_free(struct trap_parser_t *p)
+{
+	if (p == NULL)
+		return;
+
+	arena_free(p->arena);
+}
+
+
 
 /*
- *     Public methods
- *
- ******************************************************************************/
+ * parse a whole pdu at once
+ */
+
+struct pdu_t *trap_pdu_process(const char *buffer, int is_private)
+{
+	struct trap_parser_t *p;
 
+	DEBUG("called");
 
-struct pdu_t *trap_pdu_process(char *buffer, int is_private)
+	p = trap_parser_new(is_private);
+
+	if (!is_empty(buffer))
+		trap_parser_feed(p, buffer, strlen(buffer));
+
+	return trap_parser_finish(p);
+}
+
+
+/*
+ * build a trap pdu piece by piece (for traps not received as text)
+ */
+
+struct pdu_t *trap_pdu_new_trap(const char *hostname, const char *ipaddress)
 {
-	return parse(buffer, is_private);
+	struct pdu_t *pdu;
+
+	pdu = alloc_pdu(arena_new());
+	pdu->command = PROTO_CMD_TRAP;
+	pdu->trap = alloc_trap(pdu->arena);
+	pdu->trap->hostname = arena_strdup(pdu->arena, hostname);
+	pdu->trap->ipaddress = arena_strdup(pdu->arena, ipaddress);
+
+	return pdu;
+}
+
+
+/*
+ * scratch memory released along with PDU
+ */
+
+void *trap_pdu_alloc(struct pdu_t *pdu, size_t size)
+{
+	return arena_alloc(pdu->arena, size);
+}
+
+
+void trap_pdu_add_object(struct pdu_t *pdu, const char *oid, const char *value)
+{
+	struct mib_object_t *object, *last;
+
+	if (pdu == NULL || pdu->trap == NULL || is_empty(oid)) {
+		DEBUG("called on NULL trap or empty oid");
+		return;
+	}
+
+	object = arena_alloc(pdu->arena, sizeof *object);
+	object->oid = arena_strdup(pdu->arena, oid);
+	object->oid_id = oid_lookup(object->oid, strlen(object->oid));
+	/* an empty value is not a missing value */
+	object->value = arena_strdup(pdu->arena, value);
+	object->quoted_value = NULL;
+	object->shown_oid = NULL;
+	object->next = NULL;
+
+	if (pdu->trap->object == NULL) {
+		pdu->trap->object = object;
+	} else {
+		for (last = pdu->trap->object; last->next != NULL; last = last->next)
+			;
+		last->next = object;
+	}
+}
+
+
+/*
+ * the trap is complete: returns 0 (and invalidates the pdu) if it is not
+ * acceptable; a trap without handler is accepted, but the pdu is left
+ * without it
+ */
+
+int trap_pdu_finalize(struct pdu_t *pdu)
+{
+	if (pdu == NULL || pdu->trap == NULL)
+		return 0;
+
+	if (!post_parse(pdu->trap)) {
+		DEBUG("trap is not post-parsable!");
+		pdu->trap = NULL;
+		pdu->command = PROTO_CMD_INVALID;
+		return 0;
+	}
+
+	if (!is_handled(pdu->trap->oid_id, pdu->trap->arcs, pdu->trap->narcs)) {
+		reject_unhandled(pdu, pdu->trap->oid, pdu->trap->ipaddress);
+		return 1;
+	}
+
+	pthread_mutex_lock(&trap_counters_mutex);
+	trap_parsed++;
+	pthread_mutex_unlock(&trap_counters_mutex);
+
+	return 1;
 }
 
 
@@ -615,43 +1059,158 @@ char *trap_get_oid(struct trap_t *trap)
 }
 
 
+oid_t trap_get_oid_id(struct trap_t *trap)
+{
+	if (trap == NULL)
+		return OID_NONE;
+
+	return trap->oid_id;
+}
+
+
+const uint32_t *trap_get_oid_arcs(struct trap_t *trap, size_t *narcs)
+{
+	if (trap == NULL) {
+		*narcs = 0;
+		return NULL;
+	}
+
+	*narcs = trap->narcs;
+	return trap->arcs;
+}
+
+
+/*
+ * the value of the first varbind of TRAP whose OID is OID, without the
+ * quotes around it; NULL if there is none
+ */
+
+const char *trap_get_value(struct trap_t *trap, oid_t oid)
+{
+	struct mib_object_t *object;
+	const char *value;
+	char *unquoted;
+	size_t len;
+
+	if (trap == NULL || oid == OID_NONE)
+		return NULL;
+
+	for (object = trap->object; object != NULL; object = object->next) {
+		if (object->oid_id == oid)
+			break;
+	}
+
+	if (object == NULL || (value = object->value) == NULL)
+		return NULL;
+
+	len = strlen(value);
+	if (len < 2 || value[0] != '"' || value[len - 1] != '"')
+		return value;
+
+	unquoted = arena_alloc(trap->arena, len - 1);
+	memcpy(unquoted, value + 1, len - 2);
+	unquoted[len - 2] = '\0';
+
+	return unquoted;
+}
+
+
+/*
+ * the contents are rendered once and belong to TRAP
+ */
+
 char *trap_get_contents(struct trap_t *trap)
 {
 	struct mib_object_t *object;
-	char *buffer = NULL;
-	size_t oid_len, value_len, len, oldlen = 0;
+	const char *quoted_value;
+	size_t len = 0, oid_len, value_len;
+	char *p;
 
-	if (trap != NULL) {
-		object = trap->object;
+	if (trap == NULL || trap->object == NULL)
+		return NULL;
 
-		while (object != NULL) {
-			oid_len = strlen(object->oid);
-			value_len = strlen(object->quoted_value);
-			/* '+1' is for '=' */
-			len = oid_len + value_len + 1;
+	if (trap->contents != NULL)
+		return trap->contents;
 
-			if (buffer == NULL) {
-				buffer = xmalloc(len + 1);
-			} else {
-				buffer[oldlen-1] = ' ';
-				buffer = xrealloc(buffer, oldlen + len + 1);
-			}
+	/* first, sum up total length ('+2' is for '=' and ' ') */
 
-			memcpy(buffer+oldlen, object->oid, oid_len);
-			buffer[oldlen+oid_len] = '=';
-			memcpy(buffer+oldlen+oid_len+1, object->quoted_value, value_len);
+	for (object = trap->object; object != NULL; object = object->next) {
+		translate_object(trap, object);
+		len += strlen(object->shown_oid) + strlen(object->shown_value) + 2;
+	}
 
-			oldlen += len + 1;
-			object = object->next;
+	p = trap->contents = arena_alloc(trap->arena, len);
 
-		}
+	for (object = trap->object; object != NULL; object = object->next) {
+		quoted_value = object->shown_value;
+		oid_len = strlen(object->shown_oid);
+		value_len = strlen(quoted_value);
 
-		if (buffer != NULL) {
-			buffer[oldlen-1] = '\0';
-		}
+		memcpy(p, object->shown_oid, oid_len);
+		p[oid_len] = '=';
+		memcpy(p + oid_len + 1, quoted_value, value_len);
+		p += oid_len + value_len + 1;
+		*p++ = ' ';
 	}
 
-	return buffer;
+	p[-1] = '\0';
+
+	return trap->contents;
+}
+
+
+/*
+ * the varbinds of TRAP as OID=value lines, with the values as received (no
+ * quotes around them, line breaks turned into blanks), for plugins that read
+ * them from their standard input: only those whose OID is one of OIDS, unless
+ * COUNT is 0.  The text belongs to TRAP, and its length goes into *LEN
+ */
+
+char *trap_get_varbinds(struct trap_t *trap, const oid_t *oids, size_t count, size_t *len)
+{
+	struct mib_object_t *object;
+	size_t oid_len, value_len, i;
+	const char *value;
+	char *text, *p;
+
+	*len = 0;
+
+	if (trap == NULL)
+		return NULL;
+
+	for (object = trap->object; object != NULL; object = object->next) {
+		for (i = 0; i < count && oids[i] != object->oid_id; i++)
+			;
+		if (count > 0 && i == count)
+			continue;
+
+		translate_oid(trap, object);
+		unquoted_value(object, &value_len);
+		*len += strlen(object->shown_oid) + value_len + 2;
+	}
+
+	p = text = arena_alloc(trap->arena, *len + 1);
+
+	for (object = trap->object; object != NULL; object = object->next) {
+		for (i = 0; i < count && oids[i] != object->oid_id; i++)
+			;
+		if (count > 0 && i == count)
+			continue;
+
+		oid_len = strlen(object->shown_oid);
+		value = unquoted_value(object, &value_len);
+
+		memcpy(p, object->shown_oid, oid_len);
+		p[oid_len] = '=';
+		p += oid_len + 1;
+		for (i = 0; i < value_len; i++)
+			*p++ = (value[i] == '\n' || value[i] == '\r') ? ' ' : value[i];
+		*p++ = '\n';
+	}
+
+	*p = '\0';
+
+	return text;
 }
 
 
@@ -664,25 +1223,33 @@ unsigned int trap_get_timestamp(struct trap_t *trap)
 }
 
 
-char *trap_pdu_get_response(struct pdu_t *pdu)
+/*
+ * the response belongs to PDU
+ */
+
+const char *trap_pdu_get_response(struct pdu_t *pdu)
 {
-	char *response = NULL;
+	const char *response = NULL;
+	char *diagnostics;
 
 	if (pdu == NULL)
 		return NULL;
 
 	switch (pdu->command) {
 		case PROTO_CMD_TRAP:
-			response = xstrdup("ACCEPTED");
+			response = "ACCEPTED";
 			break;
 		case PROTO_CMD_ALIVE:
-			response = xstrdup("YES");
+			response = "YES";
 			break;
 		case PROTO_CMD_DIAGNOSTICS:
-			response = diagnostics_prepare_write();
+			if ((diagnostics = diagnostics_prepare_write()) != NULL) {
+				response = arena_strdup(pdu->arena, diagnostics);
+				free(diagnostics);
+			}
 			break;
 		case PROTO_CMD_INVALID:
-			response = xstrdup("INVALID");
+			response = "INVALID";
 			break;
 		default:
 			break;
@@ -701,10 +1268,25 @@ struct trap_t *trap_is_trap(struct pdu_t *pdu)
 }
 
 
+/*
+ * the trap of PDU that has no handler, for the trap log: only traps built
+ * with trap_pdu_new_trap() keep it, the parser stops reading the others as
+ * soon as their snmpTrapOID tells
+ */
+
+struct trap_t *trap_pdu_get_unhandled(struct pdu_t *pdu)
+{
+	if (pdu && pdu->command == PROTO_CMD_TRAP && pdu->trap == NULL)
+		return pdu->unhandled;
+	else
+		return NULL;
+}
+
+
 char *trap_serialize(struct trap_t *trap, int executed, const char *delimiter)
 {
 	struct mib_object_t *object;
-	char *buffer;
+	char *buffer, *contents = NULL;
 	size_t buflen = 0, auxlen, delimit_len;
 	int first_oid = 1;
 
@@ -724,15 +1306,20 @@ char *trap_serialize(struct trap_t *trap, int executed, const char *delimiter)
 	buflen += 4 * delimit_len;
 	auxlen = buflen;
 
-	/* first, sum up total length */
+	/* first, sum up total length: the contents may show OIDs by name */
 
-	object = trap->object;
+	if (trap_serialize_mode == TRAP_SERIALIZE_MODE_NEW) {
+		contents = trap_get_contents(trap);
+		buflen += delimit_len + xstrlen(contents);
+	} else {
+		object = trap->object;
 
-	while (object != NULL) {
-		buflen += xstrlen(object->oid);
-		buflen += xstrlen(object->quoted_value);
-		buflen += 2 * max(delimit_len, 1);
-		object = object->next;
+		while (object != NULL) {
+			buflen += xstrlen(object->oid);
+			buflen += xstrlen(get_quoted_value(trap, object));
+			buflen += 2 * max(delimit_len, 1);
+			object = object->next;
+		}
 	}
 
 	buflen += 1;
@@ -751,7 +1338,7 @@ char *trap_serialize(struct trap_t *trap, int executed, const char *delimiter)
 		object = trap->object;
 
 		while (object != NULL) {
-			if (!is_empty(object->oid) && !is_empty(object->quoted_value)) {
+			if (!is_empty(object->oid) && !is_empty(get_quoted_value(trap, object))) {
 				if (first_oid) {
 					sprintf(buffer+auxlen, "%s%s;%s", delimiter, object->oid, object->quoted_value);
 					auxlen += 1 + delimit_len + strlen(object->oid) + strlen(object->quoted_value);
@@ -765,13 +1352,9 @@ char *trap_serialize(struct trap_t *trap, int executed, const char *delimiter)
 			object = object->next;
 		}
 
-	} else if (trap_serialize_mode == TRAP_SERIALIZE_MODE_NEW) {
-		char *contents = trap_get_contents(trap);
-		size_t contents_len = strlen(contents);
-
+	} else if (trap_serialize_mode == TRAP_SERIALIZE_MODE_NEW && contents != NULL) {
 		sprintf(buffer+auxlen, "%s%s", delimiter, contents);
-		free(contents);
-		auxlen += delimit_len + contents_len;
+		auxlen += delimit_len + strlen(contents);
 	}
 
 	buffer[auxlen] = '\0';
@@ -789,12 +1372,8 @@ void trap_free_pdu(struct pdu_t *pdu)
 	
 	DEBUG("called");
 
-	if (pdu->trap != NULL) {
-		DEBUG("found associated trap");
-		free_trap(pdu->trap);
-	}
-	
-	free(pdu);
+	/* the pdu itself is in the arena */
+	arena_free(pdu->arena);
 
 	DEBUG("done");
 }
@@ -810,11 +1389,16 @@ void trap_free_pdu(struct pdu_t *pdu)
 void trap_init(void)
 {
 	trap_tokenizer = config_get_option_value(":trap_tokenizer");
+	trap_tokenizer_len = xstrlen(trap_tokenizer);
+
+	unhandled_trap_log_sample = atol(config_get_option_value(":unhandled_trap_log_sample"));
 
 	if (!strcmp(config_get_option_value(":trap_serialize_mode"), "old"))
 		trap_serialize_mode = TRAP_SERIALIZE_MODE_OLD;
 	else
 		trap_serialize_mode = TRAP_SERIALIZE_MODE_NEW;
+
+	translate_oids = !strcmp(config_get_option_value(":oid_name_translation"), "true");
 }
 
 
@@ -825,6 +1409,17 @@ void trap_init(void)
  ******************************************************************************/
 
 
+long trap_get_trap_unhandled(void)
+{
+	long res;
+	pthread_mutex_lock(&trap_counters_mutex);
+	res = trap_unhandled;
+	pthread_mutex_unlock(&trap_counters_mutex);
+
+	return res;
+}
+
+
 long trap_get_trap_parsed(void)
 {
 	long res;
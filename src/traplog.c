@@ -112,7 +112,7 @@ void traplog_init(void)
 		DEBUG("trap_log_delimiter: %s", trap_log_delimiter);
 	}
 
-	if ((trap_log_handler = fopen(config_get_option_value(":trap_log"), "a")) == NULL)
+	if ((trap_log_handler = fopen(config_get_option_value(":trap_log"), "ae")) == NULL)
 		log_critical(errno, "cannot open trap log");
 
 	bogomips = get_bogomips();
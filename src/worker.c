@@ -14,7 +14,7 @@
 
 
 
-#define _BSD_SOURCE
+#define _GNU_SOURCE /* for accept4() */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -27,7 +27,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/un.h>
 #include <errno.h>
 
@@ -51,6 +51,9 @@ struct threadpool *pool = NULL;
 /* primary socket */
 static unsigned int server_sckt = 0;
 
+/* UDP socket for native SNMP traps (-1 = disabled) */
+static int snmp_sckt = -1;
+
 /* shall we terminate? */
 volatile sig_atomic_t worker_must_terminate = 0;
 
@@ -63,11 +66,13 @@ static unsigned int private_s = 0;
 /* do we write on socket? */
 static int send_enabled = 1;
 
-/* holds data passed to child thread */
-struct child_data_t {
-	unsigned int client_s;
-	int is_private;
-};
+/* max number of events returned by a single epoll_wait() */
+#define MAX_EVENTS 64
+
+/* tags identifying the listening sockets in the epoll set */
+static int primary_tag;
+static int private_tag;
+static int snmp_tag;
 
 
 
@@ -132,67 +137,228 @@ static void catch_signal(int signal)
  ******************************************************************************/
 
 
-static void child_thread(void *arg)
+/*
+ * run a trap, log it, and free its pdu
+ */
+
+static void exec_pdu(struct pdu_t *pdu)
+{
+	struct trap_t *trap = trap_is_trap(pdu);
+
+	traplog_log(trap, exec_trap(trap, NULL, NULL));
+	trap_free_pdu(pdu);
+}
+
+
+/*
+ * a trap dropped by the bulkhead of its command: too many are waiting
+ */
+
+static void drop_pdu(struct pdu_t *pdu)
+{
+	traplog_log(trap_is_trap(pdu), 0);
+	trap_free_pdu(pdu);
+}
+
+
+/*
+ * process a single pdu received on CONN
+ */
+
+static void process_frame(struct connection_t *conn, struct pdu_t *pdu)
 {
-	struct child_data_t *child_data;
+	/* response (freed along with the pdu) */
+	const char *response;
 
-	/* ad-hoc protocol data unit */
-	struct pdu_t *pdu;
+	/* the trap's place in the bulkhead of its command, if it has one */
+	struct bulkhead_ticket_t *ticket = NULL;
 
-	/* dynamically allocated buffer */
-	char *buffer;
 
-	/* response */
-	char *response;
+	/* get response: a trap with no place is answered so, then dropped */
+	if (trap_is_trap(pdu) != NULL && (ticket = bulkhead_reserve(pdu)) == NULL)
+		response = "DROPPED";
+	else
+		response = trap_pdu_get_response(pdu);
 
+	if (response != NULL) {
+		char *line;
+		size_t len;
 	
-	child_data = (struct child_data_t *) arg;
+		DEBUG("sending response: %s", response);
+
+		/* send response */
+		if (send_enabled) {
+			len = strlen(response);
+			line = trap_pdu_alloc(pdu, len + 1);
+			memcpy(line, response, len);
+			line[len] = '\n';
+			socket_send(connection_get_fd(conn), line, len + 1);
+		}
 
+		/* exec & log trap (the pdu is freed there) */
+		if (trap_is_trap(pdu) != NULL) {
+			if (ticket != NULL)
+				bulkhead_submit(ticket, exec_pdu);
+			else
+				drop_pdu(pdu);
+			return;
+		}
+	} else {
+		
+		DEBUG("response is NULL");
+	}
+
+	/* free pdu */
+	trap_free_pdu(pdu);
+}
+
+
+static void child_thread(void *arg)
+{
 	DEBUG("thread started");
 
-	buffer = socket_read_pdu(child_data->client_s);
+	/* the connection is closed here once the peer is done with it */
+	connection_process((struct connection_t *) arg, process_frame);
+}
 
-	if (buffer) {
-		/* process pdu */
-		pdu = trap_pdu_process(buffer, child_data->is_private);
 
-		/* get response */
-		if ((response = trap_pdu_get_response(pdu)) != NULL) {
-			struct trap_t *trap;
-		
-			DEBUG("sending response: %s", response);
+/*
+ * traps received natively over SNMP: there is nobody to answer, and those
+ * nobody handles are logged as not executed
+ */
 
-			/* send response */
-			if (send_enabled) {
-				send(child_data->client_s, response, strlen(response), 0);
-				send(child_data->client_s, "\n", 1, 0);
-			}
+static void snmp_thread(void *arg)
+{
+	struct pdu_t *pdu = (struct pdu_t *) arg;
+	struct bulkhead_ticket_t *ticket;
+	struct trap_t *trap;
 
-			/* free response */
-			free(response);
+	DEBUG("thread started");
 
-			/* log & exec trap */
-			if ((trap = trap_is_trap(pdu)) != NULL) {
-				int executed;
-				executed = exec_trap(trap, NULL, NULL);
-				traplog_log(trap, executed);
-			}
-		} else {
-			
-			DEBUG("response is NULL");
+	if (trap_is_trap(pdu) == NULL) {
+		if ((trap = trap_pdu_get_unhandled(pdu)) != NULL)
+			traplog_log(trap, 0);
+		trap_free_pdu(pdu);
+	} else if ((ticket = bulkhead_reserve(pdu)) != NULL)
+		bulkhead_submit(ticket, exec_pdu);
+	else
+		drop_pdu(pdu);
+}
+
+
+/*
+ * hand the frames queued on CONN to a pool thread
+ */
+
+static void dispatch_connection(struct connection_t *conn)
+{
+	if (threadpool_size > 0) {
+		if (threadpool_add_task(pool, child_thread, conn, 1) != 0) {
+			log_error(0, "cannot add task to thread pool queue");
+			child_thread(conn);
 		}
+	} else {
+		child_thread(conn);
+	}
+}
 
-		/* free pdu */
-		trap_free_pdu(pdu);
 
-		/* close the client connection */
-		close(child_data->client_s);
+/*
+ * read without blocking whatever is pending on a client connection
+ */
+
+static void serve_connection(struct connection_t *conn)
+{
+	switch (connection_read(conn)) {
+		case CONNECTION_DISPATCH:
+		case CONNECTION_DISPATCH_DONE:
+			dispatch_connection(conn);
+			break;
+		default:
+			/* wait for the next edge, or CONN is not ours anymore */
+			break;
+	}
+}
+
+
+/*
+ * accept every pending connection on a listening socket (edge-triggered)
+ */
+
+static void drain_listener(int epfd, int listener, int is_private)
+{
+	struct epoll_event ev;
+	struct connection_t *conn;
+	int client_s;
+
+	while (1) {
+		client_s = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (client_s < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			/* e.g. EMFILE: we'll be woken up again by the next connection */
+			log_error(errno, "cannot accept() connection");
+			break;
+		}
+
+		DEBUG("accepted new connection (fd: %d)", client_s);
 
-		/* don't forget to free buffer! */
-		free(buffer);
+		conn = connection_new(client_s, is_private, epfd);
+
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = conn;
+
+		/* data already waiting on the socket is reported by the next epoll_wait() */
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_s, &ev) < 0) {
+			log_error(errno, "cannot add fd %d to epoll set", client_s);
+			connection_destroy(conn);
+		}
+	}
+}
+
+
+/*
+ * read every pending datagram on the SNMP socket (edge-triggered), a
+ * recvmmsg() batch at a time; decoding is cheap and happens here, each
+ * trap is then handed to the pool as a task of its own, so that a slow
+ * plugin only holds up the trap it runs for
+ */
+
+static void drain_snmp_socket(void)
+{
+	struct pdu_t *pdu[SNMP_BATCH_SIZE];
+	int count, i;
+
+	while (snmp_receive_batch(snmp_sckt, pdu, &count) != 0) {
+		for (i = 0; i < count; i++) {
+			if (threadpool_size > 0) {
+				if (threadpool_add_task(pool, snmp_thread, pdu[i], 1) != 0) {
+					log_error(0, "cannot add task to thread pool queue");
+					snmp_thread(pdu[i]);
+				}
+			} else {
+				snmp_thread(pdu[i]);
+			}
+		}
 	}
+}
+
+
+static void add_listener(int epfd, int sock, int *tag)
+{
+	struct epoll_event ev;
+
+	socket_force_nonblocking(sock);
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = tag;
 
-	free(arg);
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+		log_critical(errno, "cannot add listening socket to epoll set");
 }
 
 
@@ -251,6 +417,12 @@ void worker_init(int id, uid_t uid, gid_t gid)
 			log_critical(0, "cannot create thread pool");
 	}
 
+	/* per-command limits */
+	bulkhead_init(pool);
+
+	/* client deadlines */
+	connection_init();
+
 	/* change user and group */
 	if (uid > 0) {
 		if (setuid(uid) < 0)
@@ -278,21 +450,13 @@ int worker_get_id(void)
 
 void worker_start_main_loop(void)
 {
-	/* client socket descriptor */
-	int client_s;
-
-	/* client internet address */
-	struct sockaddr_in client_addr;
-	struct sockaddr_un client_addr_unix;
+	/* epoll instance */
+	int epfd;
 
-	/* internet address length */
-	socklen_t addr_len;
-	socklen_t addr_len_unix;
+	/* events returned by epoll_wait() */
+	struct epoll_event events[MAX_EVENTS];
 
-        /* socket file descriptors we want to wake up for, using select() */
-	fd_set socks;
-
-	int maxfd;
+	int nfds, i;
 
 
 	send_enabled = !strcmp(config_get_option_value(":send_enabled"), "true");
@@ -306,11 +470,15 @@ void worker_start_main_loop(void)
 	if (listen(private_s, 5))
 		log_critical(errno, "cannot listen()");
 
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		log_critical(errno, "cannot create epoll instance");
 
-	addr_len = sizeof(client_addr);
-	addr_len_unix = sizeof(client_addr_unix);
+	add_listener(epfd, server_sckt, &primary_tag);
+	add_listener(epfd, private_s, &private_tag);
 
-	maxfd = max(server_sckt, private_s) + 1;
+	/* native SNMP traps */
+	if ((snmp_sckt = daemon_get_snmp_socket()) >= 0)
+		add_listener(epfd, snmp_sckt, &snmp_tag);
 
 
 	/*
@@ -318,60 +486,38 @@ void worker_start_main_loop(void)
 	 */
 
 	while (1) {
-		struct child_data_t *child_data;
-		int is_private = 0;
-
-		client_s = -1;
-
 		DEBUG("server ready ...");  
 
 		if (worker_must_terminate)
 			break;
 
-		FD_ZERO(&socks);
-		FD_SET(server_sckt, &socks);
-		FD_SET(private_s, &socks);
-
-		if (select(maxfd, &socks, NULL, NULL, NULL) < 0 && errno != EINTR)
-			log_critical(errno, "select() error");
-
-
-		if (FD_ISSET(server_sckt, &socks)) {
-			DEBUG("new connection on primary socket...");
-		
-			/* wait for the next client ... */
-			client_s = accept(server_sckt, (struct sockaddr *) &client_addr, &addr_len);
-		} else if (FD_ISSET(private_s, &socks)) {
-			DEBUG("new connection on private socket...");
-		
-			/* wait for the next client ... */
-			client_s = accept(private_s, (struct sockaddr *)&client_addr_unix, &addr_len_unix);
-
-			is_private = 1;
+		/* wake up in time to hang up on clients past their deadline */
+		if ((nfds = epoll_wait(epfd, events, MAX_EVENTS, connection_next_timeout())) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_critical(errno, "epoll_wait() error");
 		}
 
-
-		if (client_s < 0) {
-			log_critical(errno, "cannot accept() connection");
-		} else {
-			DEBUG("accepted new connection");
-
-			child_data = xmalloc(sizeof *child_data);
-			child_data->client_s = client_s;
-			child_data->is_private = is_private;
-
-			if (threadpool_size > 0) {
-				if (threadpool_add_task(pool, child_thread, child_data, 1) != 0)
-					log_error(0, "cannot add task to thread pool queue");
+		for (i = 0; i < nfds; i++) {
+			if (events[i].data.ptr == &primary_tag) {
+				DEBUG("new connection(s) on primary socket...");
+				drain_listener(epfd, server_sckt, 0);
+			} else if (events[i].data.ptr == &private_tag) {
+				DEBUG("new connection(s) on private socket...");
+				drain_listener(epfd, private_s, 1);
+			} else if (events[i].data.ptr == &snmp_tag) {
+				DEBUG("new datagram(s) on SNMP socket...");
+				drain_snmp_socket();
 			} else {
-				child_thread(child_data);
+				serve_connection((struct connection_t *) events[i].data.ptr);
 			}
-
-			/* child_data is freed in the child */
-			/* free(child_data); */
 		}
+
+		connection_expire();
 	}
 
+	close(epfd);
+
 	kill(getpid(), SIGTERM);
 
 	return;
@@ -0,0 +1,497 @@
+/*
+ *     N a g i o s   S N M P   T r a p   D a e m o n 
+ *
+ ******************************************************************************
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ *     zygote.c --- launch plugins from a small helper process
+ *
+ ******************************************************************************
+ ******************************************************************************/
+
+
+/*
+ * The zygote is forked before the db tables are fetched, so it stays small,
+ * and it does nothing but start plugins on behalf of the workers: a request
+ * is a single SOCK_SEQPACKET message with the words of the command line
+ * (each terminated by '\0') and, as SCM_RIGHTS, the writing end of the
+ * pipe the plugin's standard output goes to, and one end of a socket pair
+ * the zygote answers on with the pid of the plugin (-1 if it couldn't be
+ * started), so that the worker can watch it and kill it if it hangs; a
+ * third one, if any, becomes the plugin's standard input.
+ *
+ * The zygote reaps plugins as they exit, so their pid may be reused by the
+ * time the worker signals one: with the pid comes a pidfd (as SCM_RIGHTS,
+ * if the kernel has them), opened before SIGCHLD lets the plugin be reaped.
+ * The answer socket is kept until then: a second message on it tells the
+ * CPU time the plugin took (a long, in milliseconds), for the trap's budget.
+ *
+ * The zygote goes away when the last process holding the other end of the
+ * socket (the monitor and the workers) does.  A worker that cannot reach it
+ * starts plugins on its own.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "nagiostrapd.h"
+
+
+
+/*
+ *     Global declarations
+ *
+ ******************************************************************************/
+
+
+/* longest request (the words of a command line) */
+#define ZYGOTE_MAX_REQUEST 65536
+
+/* most words in a request */
+#define ZYGOTE_MAX_ARGS 4096
+
+/* the workers' end of the socket, -1 if there is no zygote */
+static int zygote_s = -1;
+
+
+/* (zygote) a plugin not reaped yet, and the socket its CPU time goes to */
+struct zygote_child_t {
+	pid_t pid;
+	int s;
+};
+
+/* (zygote) changed only with SIGCHLD blocked; free slots have pid 0 */
+static struct zygote_child_t *children = NULL;
+static size_t children_size = 0;
+
+
+
+/*
+ *     Private methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * reap plugins as they exit (the handler doesn't survive execve(), unlike
+ * SIG_IGN, so plugins still get to wait for their own children)
+ */
+
+static void reap_children(__attribute__((unused)) int signum)
+{
+	int saved_errno = errno;
+	struct rusage usage;
+	long cpu_ms;
+	pid_t pid;
+	size_t i;
+
+	while ((pid = wait4(-1, NULL, WNOHANG, &usage)) > 0) {
+		for (i = 0; i < children_size && children[i].pid != pid; i++)
+			;
+		if (i == children_size)
+			continue;
+
+		/* send() and close() are async-signal-safe */
+		cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000L + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+		send(children[i].s, &cpu_ms, sizeof cpu_ms, MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(children[i].s);
+		children[i].pid = 0;
+	}
+
+	errno = saved_errno;
+}
+
+
+/*
+ * remember that the CPU time of PID goes to S, once reaped (with SIGCHLD
+ * blocked); returns 0 if there is no room
+ */
+
+static int add_child(pid_t pid, int s)
+{
+	struct zygote_child_t *grown;
+	size_t i, size;
+
+	for (i = 0; i < children_size && children[i].pid != 0; i++)
+		;
+
+	if (i == children_size) {
+		size = children_size ? children_size * 2 : 64;
+		if ((grown = realloc(children, size * sizeof *children)) == NULL)
+			return 0;
+		memset(grown + children_size, 0, (size - children_size) * sizeof *children);
+		children = grown;
+		children_size = size;
+	}
+
+	children[i].pid = pid;
+	children[i].s = s;
+
+	return 1;
+}
+
+
+/*
+ * receive a request into BUF: returns its length, 0 at EOF, -1 if it must
+ * be dropped; FDS (3 of them) are the output pipe, the answer socket and
+ * the standard input, or -1
+ */
+
+static ssize_t receive_request(int s, char *buf, size_t size, int *fds)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	iov.iov_base = buf;
+	iov.iov_len = size;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	while ((len = recvmsg(s, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+		if (errno != EINTR)
+			log_critical(errno, "zygote: cannot receive request");
+	}
+
+	fds[0] = fds[1] = fds[2] = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		if (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+		else if (cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	}
+
+	if (len == 0)
+		return 0;
+
+	if (fds[0] == -1 || fds[1] == -1 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || buf[len - 1] != '\0') {
+		log_error(0, "zygote: malformed request dropped");
+		return -1;
+	}
+
+	return len;
+}
+
+
+/*
+ * tell the worker on S the PID of its plugin, and pass PIDFD (unless -1)
+ */
+
+static int send_answer(int s, pid_t pid, int pidfd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t res;
+
+	iov.iov_base = &pid;
+	iov.iov_len = sizeof pid;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (pidfd != -1) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+	}
+
+	while ((res = sendmsg(s, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+
+	return res == sizeof pid ? 0 : -1;
+}
+
+
+/*
+ * the zygote's main loop
+ */
+
+static void zygote_main_loop(int s)
+{
+	static char buf[ZYGOTE_MAX_REQUEST];
+	char *argv[ZYGOTE_MAX_ARGS + 1];
+	sigset_t sigchld, oldset;
+	ssize_t len;
+	size_t argc;
+	pid_t pid;
+	char *p;
+	int fds[3], i, pidfd;
+
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+
+	while ((len = receive_request(s, buf, sizeof buf, fds)) != 0) {
+		if (len > 0) {
+			for (argc = 0, p = buf; p < buf + len && argc < ZYGOTE_MAX_ARGS; p += strlen(p) + 1)
+				argv[argc++] = p;
+			argv[argc] = NULL;
+
+			/*
+			 * not reaped before its pidfd is open and its answer socket
+			 * remembered (the worker sees EOF right away if it fails)
+			 */
+			sigprocmask(SIG_BLOCK, &sigchld, &oldset);
+			pid = spawn_plugin_to(argv, fds[2], fds[0]);
+			pidfd = spawn_pidfd(pid);
+
+			if (send_answer(fds[1], pid, pidfd) == -1)
+				log_error(errno, "zygote: cannot tell the pid of %s", argv[0]);
+			else if (pid > 0 && add_child(pid, fds[1]))
+				fds[1] = -1;
+
+			sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+			if (pidfd != -1)
+				close(pidfd);
+		}
+
+		for (i = 0; i < 3; i++) {
+			if (fds[i] != -1)
+				close(fds[i]);
+		}
+	}
+
+	DEBUG("no more workers, zygote exiting");
+
+	exit(EXIT_SUCCESS);
+}
+
+
+
+/*
+ *     Public methods
+ *
+ ******************************************************************************/
+
+
+/*
+ * have the zygote start ARGV[0] with IN as its standard input (unless it's
+ * -1) and its standard output on a pipe, whose reading end goes into *FD,
+ * its pid into *PID (-1 if it couldn't be started: *FD is at EOF then), a
+ * pidfd for it into *PIDFD (-1 if there is none) and the socket its CPU
+ * time comes on, once reaped, into *REPORT (-1 if it won't); returns 0, or
+ * -1 if the caller must start the plugin itself
+ */
+
+int zygote_spawn(char *const *argv, int in, int *fd, pid_t *pid, int *pidfd, int *report)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	size_t len = 0, argc;
+	char *buf, *p;
+	int pipefd[2], answer[2], fds[3], nfds;
+	ssize_t res;
+
+	if (zygote_s == -1 || argv == NULL || argv[0] == NULL)
+		return -1;
+
+	for (argc = 0; argv[argc] != NULL; argc++)
+		len += strlen(argv[argc]) + 1;
+
+	if (len > ZYGOTE_MAX_REQUEST || argc > ZYGOTE_MAX_ARGS) {
+		DEBUG("command line too long for the zygote");
+		return -1;
+	}
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		log_error(errno, "cannot create pipe for %s", argv[0]);
+		return -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, answer) == -1) {
+		log_error(errno, "cannot create socket for %s", argv[0]);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+
+	buf = p = xmalloc(len);
+	for (argc = 0; argv[argc] != NULL; argc++)
+		p = stpcpy(p, argv[argc]) + 1;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	fds[0] = pipefd[1];
+	fds[1] = answer[1];
+	fds[2] = in;
+	nfds = in != -1 ? 3 : 2;
+
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	while ((res = sendmsg(zygote_s, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+
+	free(buf);
+	close(pipefd[1]);
+	close(answer[1]);
+
+	if (res == -1) {
+		log_error(errno, "cannot send request to zygote, spawning %s directly", argv[0]);
+		close(pipefd[0]);
+		close(answer[0]);
+		return -1;
+	}
+
+	/* the zygote answers as soon as the plugin is started */
+	iov.iov_base = pid;
+	iov.iov_len = sizeof *pid;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int));
+
+	while ((res = recvmsg(answer[0], &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+		;
+
+	*pidfd = -1;
+	for (cmsg = res > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(pidfd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if (res != sizeof *pid)
+		*pid = -1;
+
+	if (*pid == -1 && *pidfd != -1) {
+		close(*pidfd);
+		*pidfd = -1;
+	}
+
+	if (*pid == -1) {
+		close(answer[0]);
+		*report = -1;
+	} else {
+		*report = answer[0];
+	}
+
+	DEBUG("%s spawned by the zygote (pid %d)", argv[0], (int) *pid);
+
+	*fd = pipefd[0];
+
+	return 0;
+}
+
+
+
+/*
+ *     Class constructor
+ *
+ ******************************************************************************/
+
+
+/*
+ * fork the zygote; to be called before the db tables are fetched
+ */
+
+void zygote_init(uid_t uid, gid_t gid)
+{
+	struct sigaction sa;
+	int sv[2], fd;
+	pid_t pid;
+
+	if (strcmp(config_get_option_value(":plugin_zygote"), "true")) {
+		DEBUG("zygote disabled");
+		return;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		log_error(errno, "cannot create zygote socket, workers will spawn plugins");
+		return;
+	}
+
+	if ((pid = fork()) < 0) {
+		log_error(errno, "cannot fork() zygote, workers will spawn plugins");
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	} else if (pid > 0) {
+		/* the daemon (and, later, the workers) */
+		close(sv[1]);
+		zygote_s = sv[0];
+		DEBUG("zygote forked (pid %d)", (int) pid);
+		return;
+	}
+
+	/* we are the zygote */
+	close(sv[0]);
+
+	/* don't get the daemon's terminal signals */
+	setsid();
+
+	/* plugins get what they would get from a worker */
+	if (!strcmp(config_get_option_value(":daemonize"), "true")) {
+		if (chdir("/") < 0)
+			log_error(errno, "cannot chdir('/')");
+		umask(0);
+	}
+
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = reap_children;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	/* change group and user */
+	if (gid > 0) {
+		if (setgid(gid) < 0)
+			log_error(errno, "cannot set GID %d", (int) gid);
+	}
+	if (uid > 0) {
+		if (setuid(uid) < 0)
+			log_error(errno, "cannot set UID %d", (int) uid);
+	}
+
+	zygote_main_loop(sv[1]);
+}